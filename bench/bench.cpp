@@ -0,0 +1,223 @@
+#include "bench.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    std::atomic<uint64_t> g_allocations(0);
+
+    void *Allocate(size_t size)
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        return malloc(size ? size : 1);
+    }
+
+    // Returns the id of the raw_syscalls:sys_enter tracepoint, or 0 if tracefs is not mounted
+    uint64_t SysEnterId()
+    {
+        const char *paths[] = {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                               "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+        for (auto path : paths)
+        {
+            std::ifstream fin(path);
+            uint64_t id = 0;
+            if (fin >> id)
+                return id;
+        }
+        return 0;
+    }
+
+    // Prints <name> as a JSON string
+    void PrintString(const char *name)
+    {
+        putchar('"');
+        for (const char *p = name; *p; p++)
+        {
+            if (*p == '"' || *p == '\\')
+                putchar('\\');
+            putchar(*p);
+        }
+        putchar('"');
+    }
+}
+
+// Every allocation of the benchmarks is counted
+void *operator new(size_t size)
+{
+    void *result = Allocate(size);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return Allocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+namespace rb_bench
+{
+    volatile uint64_t g_sink = 0;
+
+    uint64_t Allocations()
+    {
+        return g_allocations.load(std::memory_order_relaxed);
+    }
+
+    SyscallCounter::SyscallCounter() : m_fd(-1), m_overhead(0)
+    {
+        uint64_t id = SysEnterId();
+        if (id == 0)
+            return;
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if (m_fd < 0)
+            return;
+
+        // The ioctl which disables the counter is counted too
+        Start();
+        m_overhead = Stop();
+    }
+
+    SyscallCounter::~SyscallCounter()
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    void SyscallCounter::Start()
+    {
+        if (m_fd < 0)
+            return;
+        ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t SyscallCounter::Stop()
+    {
+        if (m_fd < 0)
+            return 0;
+        ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count > m_overhead ? count - m_overhead : 0;
+    }
+
+    void Runner::Report(const char *name, const Result &result, const Extras &extras) const
+    {
+        printf("{\"benchmark\":");
+        PrintString(name);
+        printf(",\"iterations\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"syscalls_per_op\":",
+               static_cast<unsigned long long>(result.iterations), result.ns, result.allocs);
+        if (result.syscalls < 0)
+            printf("null");
+        else
+            printf("%.2f", result.syscalls);
+        for (const auto &extra : extras)
+        {
+            printf(",");
+            PrintString(extra.first);
+            printf(":%.1f", extra.second);
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+
+    void Runner::Fail(const char *name, const char *reason)
+    {
+        fprintf(stderr, "FAILED %s: %s\n", name, reason);
+        m_failed = true;
+    }
+
+    std::vector<pid_t> SpawnChildren(int count)
+    {
+        std::vector<pid_t> children;
+        for (int i = 0; i < count; i++)
+        {
+            pid_t child = fork();
+            if (child == 0)
+            {
+                while (true)
+                    pause();
+            }
+            if (child > 0)
+                children.push_back(child);
+        }
+        return children;
+    }
+
+    void KillChildren(const std::vector<pid_t> &children)
+    {
+        for (auto child : children)
+        {
+            kill(child, SIGKILL);
+        }
+        for (auto child : children)
+        {
+            waitpid(child, nullptr, 0);
+        }
+    }
+}
+
+// Usage: rb_metrics_bench [filter]
+// Runs every benchmark whose name contains <filter>, all of them without one
+int main(int argc, char *argv[])
+{
+    rb_bench::Runner runner(argc > 1 ? argv[1] : "");
+    rb_bench::BenchProcParsers(runner);
+    rb_bench::BenchProcessTree(runner);
+    rb_bench::BenchSampleCycle(runner);
+    rb_bench::BenchSharedSnapshot(runner);
+    rb_bench::BenchParallelCollect(runner);
+    rb_bench::BenchTopProcesses(runner);
+    return runner.Failed() ? 1 : 0;
+}
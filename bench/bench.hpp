@@ -0,0 +1,127 @@
+#ifndef RB_BENCH
+#define RB_BENCH
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+
+// Harness of rb_metrics_bench. Every benchmark prints one JSON object per line to stdout:
+//   {"benchmark":"..","iterations":..,"ns_per_op":..,"allocs_per_op":..,"syscalls_per_op":..}
+// syscalls_per_op is null when the raw_syscalls tracepoint cannot be opened (tracefs not mounted,
+// perf_event_paranoid), extra fields follow for the benchmarks which measure more
+namespace rb_bench
+{
+    // Keeps the compiler from dropping the benchmarked work
+    extern volatile uint64_t g_sink;
+
+    // Returns the number of operator new calls so far, bench.cpp replaces them
+    uint64_t Allocations();
+
+    // Counts the system calls of the calling thread by the raw_syscalls:sys_enter tracepoint
+    class SyscallCounter
+    {
+    public:
+        SyscallCounter();
+        ~SyscallCounter();
+
+        SyscallCounter(const SyscallCounter &) = delete;
+        SyscallCounter &operator=(const SyscallCounter &) = delete;
+
+        bool IsOpen() const { return m_fd >= 0; }
+
+        // Starts counting from zero
+        void Start();
+
+        // Stops counting. Returns the system calls since Start(), without those of the counter itself
+        uint64_t Stop();
+
+    private:
+        int m_fd;            // Perf event of the tracepoint, -1 if it cannot be opened
+        uint64_t m_overhead; // System calls counted by an empty Start()/Stop()
+    };
+
+    // Per-operation costs of a benchmark
+    struct Result
+    {
+        uint64_t iterations = 0;
+        double ns = 0;       // Wall time per operation
+        double allocs = 0;   // operator new calls per operation
+        double syscalls = 0; // System calls per operation, negative if not counted
+    };
+
+    // Extra measurements of a benchmark, printed after the costs
+    typedef std::vector<std::pair<const char *, double>> Extras;
+
+    // Runs the benchmarks whose name contains the filter given on the command line
+    class Runner
+    {
+    public:
+        explicit Runner(std::string filter) : m_filter(std::move(filter)) {}
+
+        // Returns true if the benchmark <name> should run
+        bool Selected(const char *name) const { return m_filter.empty() || std::string(name).find(m_filter) != std::string::npos; }
+
+        // Calls <func> <iterations> times, summing its results into g_sink, and returns the costs
+        template <typename Func>
+        Result Measure(uint64_t iterations, Func func)
+        {
+            uint64_t allocations = Allocations();
+            m_syscalls.Start();
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < iterations; i++)
+            {
+                g_sink += func();
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            uint64_t syscalls = m_syscalls.Stop();
+
+            Result result;
+            result.iterations = iterations;
+            result.ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+            result.allocs = static_cast<double>(Allocations() - allocations) / iterations;
+            result.syscalls = m_syscalls.IsOpen() ? static_cast<double>(syscalls) / iterations : -1;
+            return result;
+        }
+
+        // Measures and reports the benchmark <name> if it is selected
+        template <typename Func>
+        void Run(const char *name, uint64_t iterations, Func func)
+        {
+            if (Selected(name))
+                Report(name, Measure(iterations, func));
+        }
+
+        // Prints <result> of the benchmark <name> with <extras>
+        void Report(const char *name, const Result &result, const Extras &extras = Extras()) const;
+
+        // Reports that the benchmark <name> did not hold what it checks, the suite then exits non-zero
+        void Fail(const char *name, const char *reason);
+
+        // Returns true if a benchmark failed
+        bool Failed() const { return m_failed; }
+
+    private:
+        std::string m_filter;      // Substring of the benchmarks to run, empty for all
+        SyscallCounter m_syscalls; // Counts the system calls of the benchmarks
+        bool m_failed = false;     // True once a benchmark failed
+    };
+
+    // Forks <count> children which sleep until killed
+    std::vector<pid_t> SpawnChildren(int count);
+
+    // Kills and reaps <children>
+    void KillChildren(const std::vector<pid_t> &children);
+
+    // Benchmark suites
+    void BenchProcParsers(Runner &runner);     // proc_parser_bench.cpp
+    void BenchProcessTree(Runner &runner);     // process_tree_bench.cpp
+    void BenchSampleCycle(Runner &runner);     // sample_cycle_bench.cpp
+    void BenchSharedSnapshot(Runner &runner);  // shm_snapshot_bench.cpp
+    void BenchParallelCollect(Runner &runner); // parallel_collect_bench.cpp
+    void BenchTopProcesses(Runner &runner);    // top_processes_bench.cpp
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "sampler.hpp"
+#include "worker_pool.hpp"
+#include "bench.hpp"
+
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Collects a tree of 2000 processes with the per-pid stages on 1, 4 and 16 workers. Throughput only
+// grows with the workers up to the cores the host has: compare cores_online before reading the numbers
+namespace
+{
+    const int kProcesses = 2000;
+    const size_t kWorkers[] = {1, 4, 16};
+}
+
+void rb_bench::BenchParallelCollect(Runner &runner)
+{
+    // What the pool itself costs per loop: waking the threads, stealing and joining over empty work
+    for (auto workers : kWorkers)
+    {
+        std::string name = "worker pool: " + std::to_string(workers) + " workers, empty loop of 20000";
+        if (!runner.Selected(name.c_str()))
+            continue;
+        system_metrics::WorkerPool pool(workers);
+        uint64_t sum = 0;
+        auto loop = [&sum](size_t, size_t begin, size_t end)
+        {
+            __atomic_add_fetch(&sum, end - begin, __ATOMIC_RELAXED);
+        };
+        runner.Run(name.c_str(), 2000, [&]
+                   {
+                       pool.ForEach(20000, loop);
+                       return sum;
+                   });
+    }
+
+    std::vector<std::string> names;
+    bool selected = false;
+    for (auto workers : kWorkers)
+    {
+        names.push_back("parallel " + std::to_string(kProcesses) + " processes: " + std::to_string(workers) + " workers");
+        selected = selected || runner.Selected(names.back().c_str());
+    }
+    if (!selected)
+        return;
+
+    // Only the syscalls of the calling thread are counted: with more workers, most of them are not
+    auto children = SpawnChildren(kProcesses);
+    double cores = std::thread::hardware_concurrency();
+    double single = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const char *name = names[i].c_str();
+        if (!runner.Selected(name))
+            continue;
+
+        Rb_sampler sampler(getpid(), std::chrono::milliseconds(1000));
+        sampler.SetWorkers(kWorkers[i]);
+        for (int warmup = 0; warmup < 3; warmup++)
+        {
+            sampler.Collect();
+        }
+        auto result = runner.Measure(20, [&sampler]
+                                     { return sampler.Collect().collect_ns; });
+        if (kWorkers[i] == 1)
+            single = result.ns;
+        runner.Report(name, result,
+                      {{"workers", static_cast<double>(kWorkers[i])},
+                       {"cores_online", cores},
+                       {"processes_per_s", kProcesses * 1e9 / result.ns},
+                       {"speedup", single != 0 ? single / result.ns : 0}});
+    }
+
+    KillChildren(children);
+}
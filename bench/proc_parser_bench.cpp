@@ -0,0 +1,185 @@
+#include "system_metrics.hpp"
+#include "proc_reader.hpp"
+#include "proc_parser.hpp"
+#include "block_devices.hpp"
+#include "sock_diag.hpp"
+#include "bench.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Returns parent process id of the provided parent process, rb_metrics.cpp
+uint32_t GetPpid(uint32_t pid);
+
+namespace
+{
+    // Opens <count> TCP connections to a listener of its own over loopback. Returns both ends of every one
+    std::vector<int> OpenLoopbackPairs(int count)
+    {
+        std::vector<int> fds;
+        int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(addr);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listener, count) != 0 || getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &size) != 0)
+        {
+            if (listener >= 0)
+                close(listener);
+            return fds;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (client < 0 || connect(client, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+            {
+                if (client >= 0)
+                    close(client);
+                break;
+            }
+            fds.push_back(client);
+            int server = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (server >= 0)
+                fds.push_back(server);
+        }
+        close(listener);
+        return fds;
+    }
+}
+
+// Compares the ifstream based readers with the pread + pointer scanning ones
+void rb_bench::BenchProcParsers(Runner &runner)
+{
+    using namespace system_metrics;
+    const int iterations = 20000;
+    const uint32_t pid = getpid();
+    ProcReader reader;
+    auto Bench = [&runner](const char *name, int iterations, auto func)
+    { runner.Run(name, iterations, func); };
+
+    // /proc/stat
+    Bench("cpu: ifstream", iterations, []
+          { return GetCpuSnapshot(); });
+    Bench("cpu: pread + parser", iterations, [&]
+          {
+              auto file = reader.Stat();
+              return file ? proc_parser::ParseCpuTimes(file->Data(), file->Size()).user : 0;
+          });
+
+    // /proc/[pid]/stat
+    Bench("pid stat: ifstream", iterations, [pid]
+          { return GetCpuSnapshot(pid); });
+    Bench("pid stat: pread + parser", iterations, [&]
+          {
+              proc_parser::PidStat stat;
+              auto file = reader.PidStat(pid);
+              return file && proc_parser::ParsePidStat(file->Data(), file->Size(), stat) ? stat.utime : 0;
+          });
+
+    // /proc/meminfo
+    Bench("meminfo: ifstream", iterations, []
+          { return GetRamTotal(); });
+    Bench("meminfo: pread + parser", iterations, [&]
+          {
+              auto file = reader.Meminfo();
+              return file ? proc_parser::ParseMeminfo(file->Data(), file->Size()).total : 0;
+          });
+
+    // Process RSS: /proc/[pid]/status against /proc/[pid]/statm
+    Bench("rss: ifstream status", iterations, [pid]
+          { return GetRamOccupied(pid); });
+    Bench("rss: pread + parser statm", iterations, [&]
+          {
+              auto file = reader.PidStatm(pid);
+              return file ? proc_parser::ParseStatm(file->Data(), file->Size()).resident : 0;
+          });
+
+    // Process memory breakdown: /proc/[pid]/smaps_rollup, whose cost is mostly the kernel's walk of the mappings
+    Bench("smaps_rollup: pread + parser", iterations, [&]
+          {
+              proc_parser::SmapsRollup rollup;
+              auto file = reader.PidSmapsRollup(pid);
+              return file && proc_parser::ParseSmapsRollup(file->Data(), file->Size(), rollup) ? rollup.pss : 0;
+          });
+    auto smaps = reader.PidSmapsRollup(pid);
+    std::string smaps_text(smaps ? smaps->Data() : "", smaps ? smaps->Size() : 0);
+    Bench("smaps_rollup parse: parser", iterations, [&]
+          {
+              proc_parser::SmapsRollup rollup;
+              return proc_parser::ParseSmapsRollup(smaps_text.data(), smaps_text.size(), rollup) ? rollup.pss : 0;
+          });
+
+    // /proc/[pid]/io
+    Bench("pid io: ifstream", iterations, [pid]
+          { return ParseIoStats(pid).first; });
+    Bench("pid io: pread + parser", iterations, [&]
+          {
+              auto file = reader.PidIo(pid);
+              return file ? proc_parser::ParsePidIo(file->Data(), file->Size()).rchar : 0;
+          });
+
+    // /proc/net/dev, parsing only
+    auto net_dev = reader.NetDev();
+    std::string net_dev_text(net_dev ? net_dev->Data() : "", net_dev ? net_dev->Size() : 0);
+    Bench("net dev parse: istringstream", iterations, [&]
+          {
+              std::istringstream fin(net_dev_text);
+              std::string tmp;
+              uint64_t result = 0;
+              while (fin >> tmp)
+              {
+                  if (tmp.find_first_of(":") != std::string::npos)
+                  {
+                      fin >> tmp;
+                      result += atol(tmp.c_str());
+                  }
+              }
+              return result;
+          });
+    Bench("net dev parse: parser", iterations, [&]
+          {
+              uint64_t result = 0;
+              proc_parser::ForEachNetDev(net_dev_text.data(), net_dev_text.size(),
+                                         [&](const char *, size_t, const proc_parser::NetDevCounters &counters)
+                                         { result += counters.rx_bytes; });
+              return result;
+          });
+
+    // Block devices: a read of /proc/diskstats against the /sys/block/<dev>/stat file per device it replaced
+    BlockDevices devices;
+    std::vector<DiskSnapshot> disks;
+    Bench("diskstats: pread + parser", iterations, [&]
+          { return devices.Read(disks) ? disks.size() : 0; });
+
+    // Per-process network: one sock_diag dump for every TCP socket, and the descriptors of a process.
+    // <pairs> loopback connections give both a few hundred sockets
+    const int pairs = 400;
+    std::vector<int> connections = OpenLoopbackPairs(pairs);
+    SockDiagClient sock_diag;
+    std::vector<SocketBytes> sockets;
+    std::vector<uint64_t> inodes;
+    Bench("sockets: sock_diag dump", iterations / 10, [&]
+          { return sock_diag.Dump(sockets) ? sockets.size() : 0; });
+    Bench("sockets: /proc/[pid]/fd scan", iterations / 10, [&]
+          {
+              inodes.clear();
+              return ReadSocketInodes(pid, inodes) ? inodes.size() : 0;
+          });
+    for (auto fd : connections)
+    {
+        close(fd);
+    }
+
+    // The remaining legacy readers
+    Bench("net: ParseNetData", iterations, [pid]
+          { return ParseNetData(pid).first; });
+    Bench("io: ParseIoStats", iterations / 10, []
+          { return ParseIoStats().first; });
+    Bench("ppid: GetPpid", iterations, [pid]
+          { return GetPpid(pid); });
+}
@@ -0,0 +1,34 @@
+#include "process_tree.hpp"
+#include "bench.hpp"
+
+#include <unistd.h>
+
+// Finds the descendants of a tree of 1000 processes, as getAllChildren() does, then keeps them up to date
+void rb_bench::BenchProcessTree(Runner &runner)
+{
+    const int processes = 1000;
+    const char *const fresh = "tree 1000 processes: getAllChildren";
+    const char *const refresh = "tree 1000 processes: refresh";
+    if (!runner.Selected(fresh) && !runner.Selected(refresh))
+        return;
+
+    auto children = SpawnChildren(processes);
+    const uint32_t pid = getpid();
+
+    // Rb_metrics::getAllChildren() builds a tracker and walks the whole subtree
+    runner.Run(fresh, 200, [pid]
+               {
+                   system_metrics::DescendantTracker tree(pid);
+                   return tree.Descendants().size();
+               });
+
+    // The samplers keep the tracker and only reread the children files
+    system_metrics::DescendantTracker tree(pid);
+    runner.Run(refresh, 200, [&tree]
+               {
+                   tree.Refresh();
+                   return tree.Descendants().size();
+               });
+
+    KillChildren(children);
+}
@@ -0,0 +1,75 @@
+#include "sampler.hpp"
+#include "bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+// Measures a full sample cycle of a 200-process tree against a 10 ms period. The suite fails if the
+// 99th percentile of a collection takes more than half the period, or if the scheduled run misses a deadline
+namespace
+{
+    const int kProcesses = 200;
+    const std::chrono::milliseconds kBudget(10);
+    const char *const kProcfs = "cycle 200 processes: procfs tree";
+    const char *const kConnector = "cycle 200 processes: proc connector";
+
+    // Times <cycles> back to back collections, then <cycles> scheduled samples
+    void BenchCycle(rb_bench::Runner &runner, const char *name, bool track_events, int cycles)
+    {
+        if (!runner.Selected(name))
+            return;
+
+        Rb_sampler sampler(getpid(), kBudget, track_events);
+        for (int i = 0; i < 10; i++)
+        {
+            sampler.Collect();
+        }
+
+        std::vector<uint64_t> times;
+        times.reserve(cycles);
+        auto result = runner.Measure(cycles, [&]
+                                     {
+                                         times.push_back(sampler.Collect().collect_ns);
+                                         return times.back();
+                                     });
+        std::sort(times.begin(), times.end());
+        uint64_t budget = std::chrono::duration_cast<std::chrono::nanoseconds>(kBudget).count();
+        auto over = times.end() - std::upper_bound(times.begin(), times.end(), budget);
+
+        // The schedule: every deadline of the period should be met. The first sample catches up
+        // with the deadlines which passed while the collections above were timed
+        sampler.Sample();
+        uint64_t missed = sampler.Missed();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < cycles; i++)
+        {
+            sampler.Sample();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        uint64_t p99 = times[cycles * 99 / 100];
+        runner.Report(name, result,
+                      {{"p99_ns", static_cast<double>(p99)},
+                       {"max_ns", static_cast<double>(times.back())},
+                       {"over_budget", static_cast<double>(over)},
+                       {"period_ns", std::chrono::duration<double, std::nano>(elapsed).count() / cycles},
+                       {"missed", static_cast<double>(sampler.Missed() - missed)}});
+        // Half the period leaves the other half to the consumers of the metrics
+        if (p99 > budget / 2)
+            runner.Fail(name, "the 99th percentile of a collection exceeds half the period");
+        if (sampler.Missed() != missed)
+            runner.Fail(name, "the scheduled run missed deadlines");
+    }
+}
+
+void rb_bench::BenchSampleCycle(Runner &runner)
+{
+    if (!runner.Selected(kProcfs) && !runner.Selected(kConnector))
+        return;
+
+    auto children = SpawnChildren(kProcesses);
+    BenchCycle(runner, kProcfs, false, 500);
+    BenchCycle(runner, kConnector, true, 500);
+    KillChildren(children);
+}
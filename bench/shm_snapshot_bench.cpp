@@ -0,0 +1,95 @@
+#include "shm_publisher.hpp"
+#include "bench.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Publishes into and reads from a shared memory segment, alone and with the publisher running
+namespace
+{
+    const int kTargets = 16;
+
+    // Returns metrics of <kTargets> targets whose every pid is <value>, so that a torn copy shows
+    system_metrics::Metrics Stamped(uint32_t value)
+    {
+        system_metrics::Metrics metrics;
+        metrics.general_cpu = value;
+        metrics.targets.resize(kTargets);
+        for (auto &target : metrics.targets)
+        {
+            target.pid = value;
+        }
+        return metrics;
+    }
+
+    // Returns true if every pid of <metrics> is its cpu
+    bool Consistent(const system_metrics::shm::SharedMetrics &metrics)
+    {
+        for (uint32_t i = 0; i < metrics.targets; i++)
+        {
+            if (metrics.target[i].pid != metrics.cpu)
+                return false;
+        }
+        return true;
+    }
+}
+
+void rb_bench::BenchSharedSnapshot(Runner &runner)
+{
+    using namespace system_metrics;
+    const std::string name = "/rb_metrics_bench." + std::to_string(getpid());
+    const int iterations = 200000;
+    SharedSnapshotPublisher publisher(name);
+    SharedSnapshotReader reader(name);
+    if (!publisher.IsOpen() || !reader.IsOpen())
+        return;
+
+    auto metrics = Stamped(1);
+    runner.Run("shm: publish 16 targets", iterations, [&]
+               {
+                   publisher.Publish(metrics);
+                   return 1;
+               });
+
+    shm::SharedMetrics copy;
+    runner.Run("shm: read", iterations, [&]
+               { return reader.Read(copy) ? copy.targets : 0; });
+
+    // A reader against a publisher which never stops: every copy must be consistent
+    const char *concurrent = "shm: read while publishing";
+    if (runner.Selected(concurrent))
+    {
+        std::atomic<bool> stop(false);
+        std::thread writer([&]
+                           {
+                               auto stamped = Stamped(0);
+                               for (uint32_t value = 1; !stop.load(std::memory_order_relaxed); value++)
+                               {
+                                   stamped.general_cpu = value;
+                                   for (auto &target : stamped.targets)
+                                       target.pid = value;
+                                   publisher.Publish(stamped);
+                               }
+                           });
+        uint64_t torn = 0;
+        uint64_t failed = 0;
+        uint64_t before = reader.Publications();
+        auto result = runner.Measure(iterations, [&]
+                                     {
+                                         if (!reader.Read(copy))
+                                             ++failed;
+                                         else if (!Consistent(copy))
+                                             ++torn;
+                                         return copy.cpu;
+                                     });
+        uint64_t publications = reader.Publications() - before;
+        stop = true;
+        writer.join();
+        runner.Report(concurrent, result,
+                      {{"torn", static_cast<double>(torn)},
+                       {"failed", static_cast<double>(failed)},
+                       {"publications", static_cast<double>(publications)}});
+    }
+}
@@ -0,0 +1,45 @@
+#include "top_processes.hpp"
+#include "bench.hpp"
+
+// Ranks every process of the host with 2000 more of them, and churns the table of the ranking
+void rb_bench::BenchTopProcesses(Runner &runner)
+{
+    using namespace system_metrics;
+    const char *const update = "top 2000 processes: update";
+    const char *const churn = "process table: 20000 processes, 10% replaced";
+
+    // Every tick a tenth of the processes exits and as many new ones start: lookups, inserts and evictions
+    if (runner.Selected(churn))
+    {
+        const uint32_t processes = 20000;
+        ProcessTable table;
+        uint64_t generation = 0;
+        uint32_t next = processes;
+        runner.Run(churn, 200, [&]
+                   {
+                       ++generation;
+                       for (uint32_t pid = 1; pid <= processes; pid++)
+                       {
+                           // The oldest tenth is replaced by as many pids never seen before
+                           uint32_t live = pid % 10 == generation % 10 ? ++next : pid;
+                           table.Insert(live, live).generation = generation;
+                       }
+                       table.Evict(generation);
+                       return table.Size();
+                   });
+    }
+
+    if (!runner.Selected(update))
+        return;
+    auto children = SpawnChildren(2000);
+    TopProcesses top(10);
+    top.Update();
+    top.Update();
+    auto result = runner.Measure(50, [&top]
+                                 {
+                                     top.Update();
+                                     return top.Top(TOP_CPU).size();
+                                 });
+    runner.Report(update, result, {{"processes", static_cast<double>(top.Processes())}});
+    KillChildren(children);
+}
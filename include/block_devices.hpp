@@ -0,0 +1,50 @@
+#ifndef RB_BLOCK_DEVICES
+#define RB_BLOCK_DEVICES
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "proc_reader.hpp"
+#include "proc_parser.hpp"
+
+namespace system_metrics
+{
+    // Raw counters of a block device
+    struct DiskSnapshot
+    {
+        std::string name;                   // Kernel name, e.g. "nvme0n1"
+        proc_parser::DiskCounters counters; // As of the tick
+    };
+
+    // Block devices of the system, read from a single /proc/diskstats per tick.
+    // Loop and ram devices and partitions are left out, so no I/O is counted twice. Whether a device is
+    // counted is looked up in sysfs once, when it first shows up
+    class BlockDevices
+    {
+    public:
+        BlockDevices();
+
+        // Rereads /proc/diskstats into <disks>, one entry per counted device in the kernel's order.
+        // Returns false if it cannot be read
+        bool Read(std::vector<DiskSnapshot> &disks);
+
+    private:
+        // Device seen in /proc/diskstats
+        struct Device
+        {
+            uint32_t major;
+            uint32_t minor;
+            bool counted; // False for loop and ram devices and partitions
+        };
+
+        // Returns true if the device <major>:<minor> named <name> is counted
+        bool counted(uint32_t major, uint32_t minor, const char *name, size_t size);
+
+        ProcFile m_diskstats;          // /proc/diskstats
+        std::vector<Device> m_devices; // Devices seen so far, sorted by number
+    };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef RB_CGROUP
+#define RB_CGROUP
+
+#include <string>
+#include <cstdint>
+
+#include "proc_reader.hpp"
+
+namespace system_metrics
+{
+    // Counters of a cgroup v2 and everything below it
+    struct CgroupCounters
+    {
+        // cpu.stat, in microseconds
+        uint64_t usage_usec = 0;
+        uint64_t user_usec = 0;
+        uint64_t system_usec = 0;
+
+        // memory.current and memory.stat, in bytes
+        uint64_t memory_current = 0; // Every page charged to the cgroup, page cache included
+        uint64_t anon = 0;           // Anonymous memory
+        uint64_t file = 0;           // Page cache
+        uint64_t file_mapped = 0;    // Page cache mapped into processes
+
+        // io.stat, summed over every device, in bytes
+        uint64_t rbytes = 0;
+        uint64_t wbytes = 0;
+    };
+
+    // Reads the accounting files of a cgroup v2, which cover every process of the cgroup and of its
+    // descendant cgroups at a constant cost, however many processes the service forks.
+    // Files of disabled controllers are missing: their counters stay 0
+    class CgroupReader
+    {
+    public:
+        // <path> is a directory under the cgroup2 mount point or a cgroup path as in /proc/[pid]/cgroup,
+        // e.g. "/system.slice/ssh.service"
+        explicit CgroupReader(const std::string &path);
+
+        // Rereads every file. Returns false if the cgroup does not exist (anymore)
+        bool Read(CgroupCounters &counters);
+
+        // Returns the absolute path of the cgroup directory
+        const std::string &Path() const { return m_path; }
+
+    private:
+        std::string m_path; // Cgroup directory
+        ProcFile m_cpu;     // cpu.stat
+        ProcFile m_current; // memory.current
+        ProcFile m_memory;  // memory.stat
+        ProcFile m_io;      // io.stat
+    };
+
+    // Returns the cgroup2 mount point, "/sys/fs/cgroup" unless found otherwise in /proc/self/mountinfo
+    const std::string &CgroupMountPoint();
+
+    // Returns the directory of the cgroup <path>: <path> itself if it is under the mount point,
+    // otherwise <path> taken relative to the mount point
+    std::string CgroupDirectory(const std::string &path);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef RB_CPU_STAT
+#define RB_CPU_STAT
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace system_metrics
+{
+    // Columns of a cpu line of /proc/stat
+    enum CpuState
+    {
+        CPU_USER,
+        CPU_NICE,
+        CPU_SYSTEM,
+        CPU_IDLE,
+        CPU_IOWAIT,
+        CPU_IRQ,
+        CPU_SOFTIRQ,
+        CPU_STEAL,
+        CPU_GUEST,      // Already accounted in CPU_USER
+        CPU_GUEST_NICE, // Already accounted in CPU_NICE
+        CPU_STATES
+    };
+
+    // Time spent in every state by every cpu, in clock ticks, kept in one contiguous
+    // row-major matrix: row 0 is the aggregate "cpu" line, the next rows are the "cpuN" lines
+    class CpuStatMatrix
+    {
+    public:
+        // Parses the cpu lines of /proc/stat. Reuses the memory of the previous parse.
+        // Returns false if there is no aggregate line
+        bool Parse(const char *data, size_t size);
+
+        // Returns the number of rows: the aggregate one and one per online core
+        size_t Rows() const { return m_ids.size(); }
+
+        // Returns the number N of the "cpuN" line of <row>, -1 for the aggregate row
+        int Id(size_t row) const { return m_ids[row]; }
+
+        // Returns the counter of <state> of <row>
+        uint64_t At(size_t row, CpuState state) const { return m_counters[row * CPU_STATES + state]; }
+        uint64_t &At(size_t row, CpuState state) { return m_counters[row * CPU_STATES + state]; }
+
+        // Sets the number of rows, keeping the memory. Added rows are numbered -1 and count nothing
+        void Resize(size_t rows);
+
+        // Sets the number N of the "cpuN" line of <row>
+        void SetId(size_t row, int id) { m_ids[row] = id; }
+
+        // Returns the time <row> was busy: everything but idle and iowait
+        uint64_t Busy(size_t row) const;
+
+        // Returns the time of every state of <row>, guest time counted once
+        uint64_t Total(size_t row) const;
+
+        // Returns the whole matrix, Rows() x CPU_STATES
+        const uint64_t *Data() const { return m_counters.data(); }
+
+    private:
+        std::vector<uint64_t> m_counters; // Rows() x CPU_STATES counters
+        std::vector<int> m_ids;           // Cpu number of every row
+    };
+
+    // Share of every state of every cpu between two CpuStatMatrix, in percent
+    class CpuUsage
+    {
+    public:
+        // Computes the shares of all cores and states in a single pass over the matrices.
+        // If the set of online cores changed in between, every share is 0
+        void Compute(const CpuStatMatrix &prev, const CpuStatMatrix &curr);
+
+        // Returns the number of rows: the aggregate one and one per online core
+        size_t Rows() const { return m_ids.size(); }
+
+        // Returns the number N of the "cpuN" line of <row>, -1 for the aggregate row
+        int Id(size_t row) const { return m_ids[row]; }
+
+        // Returns the share of <state> of <row>
+        float At(size_t row, CpuState state) const { return m_percent[row * CPU_STATES + state]; }
+
+        // Returns the share of time <row> was busy: everything but idle and iowait
+        float Busy(size_t row) const { return m_busy[row]; }
+
+    private:
+        std::vector<float> m_percent; // Rows() x CPU_STATES shares
+        std::vector<float> m_busy;    // Busy share of every row
+        std::vector<float> m_scale;   // 100 / total time of every row, scratch
+        std::vector<int> m_ids;       // Cpu number of every row
+    };
+}
+
+#endif
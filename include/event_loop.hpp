@@ -0,0 +1,94 @@
+#ifndef RB_EVENT_LOOP
+#define RB_EVENT_LOOP
+
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "sampler.hpp"
+
+namespace system_metrics
+{
+    // Runs any number of samplers, each at its own period, on a single thread: every sampler has a
+    // timerfd and one epoll_wait(2) waits for all of them, so no thread sleeps per monitor.
+    // Subscribers get the metrics of every period by callback or one period at a time by future.
+    // Every method may be called from any thread, callbacks included
+    class EventLoop
+    {
+    public:
+        typedef uint64_t Subscription;
+        typedef std::function<void(const Metrics &)> Callback;
+
+        EventLoop();
+        ~EventLoop();
+
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        // Samples <sampler> every period of its own on the loop thread and calls <callback> there,
+        // which may be empty when only futures are wanted
+        Subscription Subscribe(std::shared_ptr<Rb_sampler> sampler, Callback callback = Callback());
+
+        // Returns the metrics of the next period of <subscription>.
+        // The future throws std::future_error (broken_promise) if the subscription ends first
+        std::future<Metrics> Next(Subscription subscription);
+
+        // Stops sampling <subscription>
+        void Unsubscribe(Subscription subscription);
+
+        // Runs the loop on the calling thread until Stop()
+        void Run();
+
+        // Runs the loop on a thread of its own until Stop() or destruction
+        void Start();
+
+        // Makes Run() return and joins the thread of Start()
+        void Stop();
+
+        // Makes Run() return once any of <signals> is delivered to the process. The signals are blocked in the
+        // calling thread and in the threads it creates afterwards, so call it before any other thread starts.
+        // Returns false if they cannot be waited for
+        bool StopOnSignals(std::initializer_list<int> signals);
+
+    private:
+        // Sampler driven by the loop
+        struct Monitor
+        {
+            std::shared_ptr<Rb_sampler> sampler;                         // Sampler of the subscription
+            Callback callback;                                           // Called every period, may be empty
+            int timer_fd;                                                // Timerfd firing every period
+            std::vector<std::shared_ptr<std::promise<Metrics>>> waiting; // Futures of the next period
+        };
+
+        // Queues <command> to run on the loop thread and wakes it up
+        void post(std::function<void()> command);
+
+        // Runs the queued commands
+        void runCommands();
+
+        // Samples the monitor <subscription> whose timer has fired
+        void tick(Subscription subscription);
+
+        // Consumes the signal which made the signalfd readable and stops the loop
+        void stopOnSignal();
+
+        int m_epoll_fd;                                // Waits for the timers and the wake up
+        int m_wake_fd;                                 // Eventfd which wakes the loop up for commands
+        int m_signal_fd;                               // Signalfd of StopOnSignals(), -1 if none
+        std::atomic<bool> m_stop;                      // True once Stop() was called
+        std::atomic<Subscription> m_next;              // Last subscription handed out
+        std::map<Subscription, Monitor> m_monitors;    // Loop thread only
+        std::mutex m_mutex;                            // Guards m_commands
+        std::vector<std::function<void()>> m_commands; // Commands posted to the loop thread
+        std::thread m_thread;                          // Thread of Start()
+    };
+}
+
+#endif
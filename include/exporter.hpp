@@ -0,0 +1,72 @@
+#ifndef RB_EXPORTER
+#define RB_EXPORTER
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "sampler.hpp"
+
+namespace system_metrics
+{
+    // Serves the latest metrics at http://<address>:<port>/metrics in the OpenMetrics text format.
+    // The whole HTTP response is rendered once per tick by Publish() into one of two buffers;
+    // a scrape only writes the current buffer out, so any number of scrapers adds no formatting work.
+    // One background thread multiplexes every connection with poll(2); a connection not done within
+    // a few seconds is closed, so idle ones cannot hold every slot
+    class MetricsExporter
+    {
+    public:
+        // Listens on <address>:<port>, loopback unless told otherwise
+        explicit MetricsExporter(uint16_t port, const std::string &address = "127.0.0.1");
+        ~MetricsExporter();
+
+        MetricsExporter(const MetricsExporter &) = delete;
+        MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+        // Renders <metrics>, with the overhead of the monitor if <self> is given, and makes them the
+        // response to the next scrapes
+        void Publish(const Metrics &metrics, const SelfStats *self = nullptr);
+
+        // Returns true if the listener is up
+        bool IsListening() const { return m_listen_fd >= 0; }
+
+    private:
+        typedef std::shared_ptr<const std::string> Response;
+
+        // Connection of a scraper
+        struct Client
+        {
+            int fd;               // Socket
+            std::string request;  // Request read so far
+            Response response;    // Response being sent, nullptr while the request is read
+            size_t sent;          // Bytes of the response sent so far
+            uint64_t accepted_ns; // Monotonic time the connection was accepted at
+        };
+
+        // Accepts and serves connections until stopped
+        void serve();
+
+        // Reads from <client>. Returns false if the connection is done
+        bool receive(Client &client);
+
+        // Writes to <client>. Returns false if the connection is done
+        bool send(Client &client);
+
+        // Renders the exposition of <metrics> and <self> into m_body
+        void render(const Metrics &metrics, const SelfStats *self);
+
+        int m_listen_fd;                     // Listening socket, -1 if it could not be set up
+        int m_wake_fd;                       // Eventfd which stops the server thread
+        std::string m_body;                  // Exposition rendered last, reused
+        std::shared_ptr<std::string> m_back; // Buffer the next response is rendered into
+        Response m_front;                    // Response served now, guarded by m_mutex
+        std::mutex m_mutex;                  // Guards the swap of m_front only
+        std::thread m_thread;                // Server thread
+    };
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef RB_HISTORY
+#define RB_HISTORY
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "sampler.hpp"
+
+namespace system_metrics
+{
+    // Fixed-capacity history of a single metric: a ring buffer written by one producer (the sampler)
+    // and read by any number of consumers without locks. Min, max, mean and rate over the last
+    // <window> samples are kept up to date on every push in amortized O(1).
+    // Readers never block the producer: a reader which races with it skips or retries, never the producer
+    class MetricSeries
+    {
+    public:
+        struct Sample
+        {
+            uint64_t timestamp_ns; // CLOCK_MONOTONIC
+            double value;
+        };
+
+        // Aggregates of the last Window().count samples
+        struct Window
+        {
+            size_t count = 0;
+            double min = 0;
+            double max = 0;
+            double mean = 0;
+            double rate = 0; // Change of the value per second from the oldest to the newest sample
+        };
+
+        // Keeps the last <capacity> samples and aggregates the last <window> of them (at most <capacity>)
+        MetricSeries(size_t capacity, size_t window);
+
+        MetricSeries(const MetricSeries &) = delete;
+        MetricSeries &operator=(const MetricSeries &) = delete;
+
+        // Producer only. Appends a sample, overwriting the oldest one when full
+        void Push(uint64_t timestamp_ns, double value);
+
+        // Reads the newest sample. Returns false if there is none yet
+        bool Latest(Sample &sample) const;
+
+        // Copies up to <max> newest samples to <out>, oldest first. Returns the number copied.
+        // Samples overwritten by the producer while copying are left out
+        size_t Read(Sample *out, size_t max) const;
+
+        // Returns the aggregates of the current window
+        Window Aggregates() const;
+
+        // Returns the number of samples pushed so far
+        uint64_t Pushed() const { return m_head.load(std::memory_order_acquire); }
+
+        size_t Capacity() const { return m_capacity; }
+        size_t WindowSize() const { return m_window; }
+
+    private:
+        // A sample guarded by its own sequence: 2n+1 while sample n is written, 2n+2 once it is complete
+        struct Slot
+        {
+            std::atomic<uint64_t> sequence{0};
+            std::atomic<uint64_t> timestamp_ns{0};
+            std::atomic<uint64_t> value{0}; // Bits of a double
+        };
+
+        // Fixed-capacity deque of (sample number, value), for the sliding window min and max
+        struct MonotonicQueue
+        {
+            std::vector<std::pair<uint64_t, double>> items; // Ring of <m_window> items
+            size_t first = 0;                               // Index of the front item
+            size_t size = 0;                                // Number of items
+        };
+
+        // Reads the slot of the sample n. Returns false if it does not hold the complete sample n
+        bool readSlot(uint64_t n, Sample &sample) const;
+
+        // Pushes the sample n to the back of <queue>, first dropping the back items <dominates(new, back)>
+        template <typename Dominates>
+        void enqueue(MonotonicQueue &queue, uint64_t n, double value, Dominates dominates);
+
+        // Drops the front of <queue> when it has left the window ending at the sample n
+        void expire(MonotonicQueue &queue, uint64_t n);
+
+        // Publishes the aggregates for the readers
+        void publish(uint64_t n);
+
+        const size_t m_capacity;         // Number of samples kept
+        const size_t m_window;           // Number of samples aggregated
+        std::unique_ptr<Slot[]> m_slots; // Ring of <m_capacity> samples
+        std::atomic<uint64_t> m_head;    // Number of samples pushed, published after the sample
+
+        // Producer state of the window
+        double m_sum;         // Sum of the values within the window
+        MonotonicQueue m_min; // Increasing values: the front is the window minimum
+        MonotonicQueue m_max; // Decreasing values: the front is the window maximum
+
+        // Aggregates published under their own sequence, odd while being written
+        std::atomic<uint64_t> m_aggregates_sequence;
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_min_value;
+        std::atomic<uint64_t> m_max_value;
+        std::atomic<uint64_t> m_mean_value;
+        std::atomic<uint64_t> m_rate_value;
+    };
+
+    // Metrics a history is kept of, for every target and the system
+    enum HistoryMetric
+    {
+        HISTORY_CPU,       // %
+        HISTORY_RAM,       // %
+        HISTORY_RAM_M,     // Megabytes
+        HISTORY_NET_READ,  // Kilobytes per second
+        HISTORY_NET_WRITE, // Kilobytes per second
+        HISTORY_IO_READ,   // Kilobytes per second
+        HISTORY_IO_WRITE,  // Kilobytes per second
+        HISTORY_METRICS
+    };
+
+    // History of every metric of the system and of every target, fed by the sampler.
+    // Memory is fixed by the retention: every series is allocated once, when its target first shows up,
+    // and dropped with the first record that no longer has the target.
+    // Series are looked up in an immutable map the producer replaces when the targets change,
+    // so readers never wait for the producer and reading a series needs no lock at all
+    class MetricHistory
+    {
+    public:
+        // Keeps <retention> samples of every metric and aggregates the last <window> of them
+        MetricHistory(size_t retention, size_t window);
+
+        // Producer only. Appends every metric of <metrics>, measured at <timestamp_ns>
+        void Record(uint64_t timestamp_ns, const Metrics &metrics);
+
+        // Returns the series of a system-wide metric
+        std::shared_ptr<const MetricSeries> General(HistoryMetric metric) const;
+
+        // Returns the series of a metric of the target <pid>, or of the cgroup target <cgroup> if not empty.
+        // Returns nullptr if the target has never been recorded
+        std::shared_ptr<const MetricSeries> Target(uint32_t pid, HistoryMetric metric,
+                                                   const std::string &cgroup = std::string()) const;
+
+    private:
+        typedef std::pair<uint32_t, std::string> Key;                  // (pid, cgroup) of a target
+        typedef std::vector<std::shared_ptr<MetricSeries>> SeriesSet; // HISTORY_METRICS series
+        typedef std::map<Key, SeriesSet> Targets;                      // Series of every target
+
+        // Returns a new set of HISTORY_METRICS series
+        SeriesSet makeSeries() const;
+
+        // Returns the series of the <index>th target of a record, creating them if the target is new.
+        // Sets <changed> if the target was not the <index>th one of the last record
+        const SeriesSet &seriesOf(size_t index, const TargetMetrics &target, bool &changed);
+
+        const size_t m_retention;                        // Samples kept by every series
+        const size_t m_window;                           // Samples aggregated by every series
+        SeriesSet m_general;                             // System-wide series
+        std::shared_ptr<const Targets> m_targets;        // Targets of the last record, only swapped atomically
+        std::vector<std::pair<Key, SeriesSet>> m_recent; // Producer cache of the targets of the last record
+    };
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef RB_NDJSON
+#define RB_NDJSON
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <boost/json.hpp>
+
+#include "sampler.hpp"
+
+namespace system_metrics
+{
+    // When buffered ticks are written out: as soon as either limit is reached
+    struct FlushPolicy
+    {
+        size_t max_ticks = 1;         // Ticks buffered before a write
+        size_t max_bytes = 64 * 1024; // Bytes buffered before a write
+    };
+
+    // Writes one JSON object per tick, newline delimited, to stdout, a file or a FIFO.
+    // The document, its memory and the serializer are reused across ticks, so a tick allocates nothing
+    // once the buffers have grown to size. The output is non-blocking: when the consumer cannot keep up
+    // and more than <max_pending> bytes wait to be written, new ticks are dropped and counted
+    class NdjsonWriter
+    {
+    public:
+        // "-" is stdout. A FIFO is opened read-write, so it may be opened before its reader
+        explicit NdjsonWriter(const std::string &path, FlushPolicy policy = FlushPolicy(),
+                              size_t max_pending = 1024 * 1024);
+        ~NdjsonWriter();
+
+        NdjsonWriter(const NdjsonWriter &) = delete;
+        NdjsonWriter &operator=(const NdjsonWriter &) = delete;
+
+        // Serializes <metrics> measured at <timestamp_ns>, on whatever clock the caller uses.
+        // Returns false if the tick was dropped
+        bool Write(uint64_t timestamp_ns, const Metrics &metrics);
+
+        // Writes out as much of the buffered output as the consumer takes without blocking.
+        // Returns true if nothing is left
+        bool Flush();
+
+        // Returns the number of ticks dropped so far
+        uint64_t Dropped() const { return m_dropped; }
+
+        bool IsOpen() const { return m_fd >= 0; }
+
+    private:
+        // Builds the document of a tick
+        void build(uint64_t timestamp_ns, const Metrics &metrics);
+
+        int m_fd;                                   // Output, -1 if it cannot be opened
+        bool m_owned;                               // True if the descriptor is closed on destruction
+        FlushPolicy m_policy;                       // When to write
+        size_t m_max_pending;                       // Bytes kept for a slow consumer before ticks are dropped
+        std::vector<char> m_output;                 // Serialized ticks, the first m_offset bytes already written
+        size_t m_offset;                            // Bytes of m_output already written
+        size_t m_ticks;                             // Ticks buffered since the last write
+        uint64_t m_dropped;                         // Ticks dropped so far
+        std::vector<unsigned char> m_arena;         // Initial memory of the document
+        boost::json::monotonic_resource m_resource; // Memory of the document, released every tick
+        boost::json::value m_document;              // Document of the tick
+        boost::json::serializer m_serializer;       // Reused serializer
+    };
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef RB_NET_INTERFACES
+#define RB_NET_INTERFACES
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace system_metrics
+{
+    // Cached view of the system's network interfaces.
+    // Built from an rtnetlink RTM_GETLINK dump and kept up to date by RTNLGRP_LINK events,
+    // so checking whether an interface is active is an in-memory lookup.
+    // Falls back to getifaddrs(3) when a netlink socket cannot be opened.
+    class NetInterfaceRegistry
+    {
+    public:
+        NetInterfaceRegistry();
+        ~NetInterfaceRegistry();
+
+        NetInterfaceRegistry(const NetInterfaceRegistry &) = delete;
+        NetInterfaceRegistry &operator=(const NetInterfaceRegistry &) = delete;
+
+        // Applies pending link events without blocking. Call once per tick
+        void Update();
+
+        // Returns true if the interface <name> is up (operational state UP, like "state UP" of `ip addr`)
+        bool IsActive(const char *name, size_t size) const;
+        bool IsActive(const std::string &name) const { return IsActive(name.data(), name.size()); }
+
+        // Returns names of the active interfaces
+        std::vector<std::string> Active() const;
+
+        // Returns true if the registry is fed by netlink events, false if it polls getifaddrs(3)
+        bool IsNetlink() const { return m_fd >= 0; }
+
+    private:
+        // Interface known to the registry
+        struct Link
+        {
+            int index;
+            std::string name;
+            bool active;
+        };
+
+        // Requests a full RTM_GETLINK dump and applies it. Returns false on failure
+        bool dump();
+
+        // Receives and applies netlink messages. With <until_done> blocks until the dump is complete
+        bool receive(bool until_done);
+
+        // Applies a single RTM_NEWLINK/RTM_DELLINK message
+        void apply(const void *message);
+
+        // Rebuilds the list with getifaddrs(3)
+        void pollIfaddrs();
+
+        int m_fd;                   // Netlink socket, -1 when getifaddrs(3) is used
+        uint32_t m_seq;             // Sequence number of the last request
+        std::vector<char> m_buffer; // Receive buffer
+        std::vector<Link> m_links;  // Known interfaces
+    };
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef RB_PROC_CONNECTOR
+#define RB_PROC_CONNECTOR
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "process_tree.hpp"
+
+namespace system_metrics
+{
+    // Keeps the tree of a root process up to date from the kernel proc connector
+    // (PROC_EVENT_FORK/EXIT over NETLINK_CONNECTOR), so the tree stays fresh without scanning /proc
+    // and processes which start and exit between two refreshes are still counted.
+    // Listening needs CAP_NET_ADMIN; without it the tracker polls with a DescendantTracker.
+    class ProcEventTracker : public ProcessTracker
+    {
+    public:
+        explicit ProcEventTracker(uint32_t root);
+        ~ProcEventTracker();
+
+        ProcEventTracker(const ProcEventTracker &) = delete;
+        ProcEventTracker &operator=(const ProcEventTracker &) = delete;
+
+        // Applies the pending events without blocking
+        bool Refresh() override;
+
+        uint32_t Root() const override { return m_poller.Root(); }
+
+        const std::vector<uint32_t> &Descendants() const override;
+
+        void SetPool(WorkerPool *pool) override { m_poller.SetPool(pool); }
+
+        // Returns true if the tree is kept by events, false if it is polled
+        bool IsEventDriven() const { return m_fd >= 0; }
+
+    private:
+        // Opens the connector socket and starts listening. Returns false if not permitted
+        bool subscribe();
+
+        // Rebuilds the tree from /proc: at start and after events were lost
+        void resync();
+
+        // Applies a single proc connector event
+        void handle(const void *event);
+
+        // Removes <pid> and every process below it
+        void removeSubtree(uint32_t pid);
+
+        // Finds out where the children of exited processes were reparented to
+        void adoptOrphans();
+
+        // Returns true if <pid> is the root or one of its descendants
+        bool inTree(uint32_t pid) const;
+
+        int m_fd;                                      // Connector socket, -1 when polling
+        DescendantTracker m_poller;                    // Initial tree, resyncs and the polling fallback
+        std::unordered_map<uint32_t, uint32_t> m_parents; // Parent of every descendant
+        std::vector<uint32_t> m_orphans;               // Children of exited processes, not yet reparented
+        std::vector<uint32_t> m_descendants;           // Sorted descendants
+        std::vector<char> m_buffer;                    // Receive buffer
+        bool m_changed;                                // True if the tree changed since the last refresh
+    };
+}
+
+#endif
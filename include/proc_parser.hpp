@@ -0,0 +1,259 @@
+#ifndef RB_PROC_PARSER
+#define RB_PROC_PARSER
+
+#include <cstdint>
+#include <cstddef>
+
+// Hand-written parsers of procfs files. They scan the text in place with a pointer,
+// never allocate and keep every counter in 64 bits.
+namespace system_metrics
+{
+    namespace proc_parser
+    {
+        // Skips spaces and tabs, returns the first other character or <end>
+        inline const char *SkipSpaces(const char *p, const char *end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                ++p;
+            return p;
+        }
+
+        // Returns the character after the end of the current line or <end>
+        inline const char *NextLine(const char *p, const char *end)
+        {
+            while (p < end && *p != '\n')
+                ++p;
+            return p < end ? p + 1 : end;
+        }
+
+        // Parses an unsigned decimal after optional spaces. Returns 0 if there is no number
+        inline uint64_t ParseU64(const char *&p, const char *end)
+        {
+            p = SkipSpaces(p, end);
+            uint64_t result = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                result = result * 10 + static_cast<uint64_t>(*p - '0');
+                ++p;
+            }
+            return result;
+        }
+
+        // Skips <count> whitespace separated fields
+        inline const char *SkipFields(const char *p, const char *end, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                p = SkipSpaces(p, end);
+                while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+                    ++p;
+            }
+            return p;
+        }
+
+        // Time spent in every state by the cpu, in clock ticks (a line of /proc/stat)
+        struct CpuTimes
+        {
+            uint64_t user = 0;
+            uint64_t nice = 0;
+            uint64_t system = 0;
+            uint64_t idle = 0;
+            uint64_t iowait = 0;
+            uint64_t irq = 0;
+            uint64_t softirq = 0;
+            uint64_t steal = 0;
+            uint64_t guest = 0;
+            uint64_t guest_nice = 0;
+        };
+
+        // Parses the aggregate "cpu" line of /proc/stat
+        CpuTimes ParseCpuTimes(const char *data, size_t size);
+
+        // Fields of /proc/[pid]/stat
+        struct PidStat
+        {
+            char state = 0;
+            uint32_t ppid = 0;
+            uint64_t utime = 0;
+            uint64_t stime = 0;
+            uint64_t cutime = 0;
+            uint64_t cstime = 0;
+            uint64_t num_threads = 0;
+            uint64_t starttime = 0;
+            uint64_t vsize = 0; // Bytes
+            uint64_t rss = 0;   // Pages
+        };
+
+        // Parses /proc/[pid]/stat. The comm field may contain spaces and parentheses,
+        // so fields are counted from the last ')'. Returns false if the data is malformed
+        bool ParsePidStat(const char *data, size_t size, PidStat &result);
+
+        // Copies the comm field of /proc/[pid]/stat, without its parentheses, into <comm> of <capacity> bytes,
+        // truncated and '\0'-terminated. Returns false if the data is malformed
+        bool ParsePidComm(const char *data, size_t size, char *comm, size_t capacity);
+
+        // Fields of /proc/meminfo, in kilobytes
+        struct Meminfo
+        {
+            uint64_t total = 0;
+            uint64_t free = 0;
+            uint64_t available = 0;
+            uint64_t buffers = 0;
+            uint64_t cached = 0;
+            uint64_t swap_total = 0;
+            uint64_t swap_free = 0;
+        };
+
+        // Parses /proc/meminfo
+        Meminfo ParseMeminfo(const char *data, size_t size);
+
+        // Fields of /proc/[pid]/statm, in pages
+        struct Statm
+        {
+            uint64_t size = 0;
+            uint64_t resident = 0;
+            uint64_t shared = 0;
+        };
+
+        // Parses /proc/[pid]/statm
+        Statm ParseStatm(const char *data, size_t size);
+
+        // Fields of /proc/[pid]/smaps_rollup, in kilobytes
+        struct SmapsRollup
+        {
+            uint64_t rss = 0;
+            uint64_t pss = 0;
+            uint64_t private_clean = 0;
+            uint64_t private_dirty = 0;
+            uint64_t anonymous = 0;
+            uint64_t swap = 0;
+            uint64_t swap_pss = 0;
+        };
+
+        // Parses /proc/[pid]/smaps_rollup. Returns false if it has no Rss line (e.g. a kernel thread)
+        bool ParseSmapsRollup(const char *data, size_t size, SmapsRollup &result);
+
+        // Fields of /proc/[pid]/io, in bytes
+        struct PidIo
+        {
+            uint64_t rchar = 0;
+            uint64_t wchar = 0;
+            uint64_t syscr = 0;
+            uint64_t syscw = 0;
+            uint64_t read_bytes = 0;
+            uint64_t write_bytes = 0;
+            uint64_t cancelled_write_bytes = 0;
+        };
+
+        // Parses /proc/[pid]/io
+        PidIo ParsePidIo(const char *data, size_t size);
+
+        // Counters of a single interface line of /proc/net/dev
+        struct NetDevCounters
+        {
+            uint64_t rx_bytes = 0;
+            uint64_t rx_packets = 0;
+            uint64_t tx_bytes = 0;
+            uint64_t tx_packets = 0;
+        };
+
+        // Calls <callback>(const char *name, size_t name_size, const NetDevCounters &) for every
+        // interface line of /proc/net/dev. The name is not '\0'-terminated
+        template <typename Callback>
+        void ForEachNetDev(const char *data, size_t size, Callback callback)
+        {
+            const char *p = data;
+            const char *end = data + size;
+            // Two header lines
+            p = NextLine(NextLine(p, end), end);
+            while (p < end)
+            {
+                const char *name = SkipSpaces(p, end);
+                const char *colon = name;
+                while (colon < end && *colon != ':' && *colon != '\n')
+                    ++colon;
+                if (colon >= end || *colon != ':')
+                {
+                    p = NextLine(colon, end);
+                    continue;
+                }
+
+                // Values may follow the colon without a space when they are wide
+                const char *q = colon + 1;
+                NetDevCounters counters;
+                counters.rx_bytes = ParseU64(q, end);
+                counters.rx_packets = ParseU64(q, end);
+                q = SkipFields(q, end, 6);
+                counters.tx_bytes = ParseU64(q, end);
+                counters.tx_packets = ParseU64(q, end);
+                callback(name, static_cast<size_t>(colon - name), counters);
+
+                p = NextLine(q, end);
+            }
+        }
+
+        // Fields of a device line of /proc/diskstats. Sectors are 512 bytes whatever the sector size
+        // of the device, times are in milliseconds
+        struct DiskCounters
+        {
+            uint32_t major = 0;
+            uint32_t minor = 0;
+            uint64_t reads = 0;     // Reads completed
+            uint64_t sectors_read = 0;
+            uint64_t read_ms = 0;   // Time spent by the reads
+            uint64_t writes = 0;    // Writes completed
+            uint64_t sectors_written = 0;
+            uint64_t write_ms = 0;  // Time spent by the writes
+            uint64_t in_flight = 0; // I/Os in progress now
+            uint64_t io_ms = 0;     // Time with at least one I/O in progress
+            uint64_t queue_ms = 0;  // Time in progress summed over the I/Os (weighted time in queue)
+        };
+
+        // Calls <callback>(const char *name, size_t name_size, const DiskCounters &) for every
+        // device line of /proc/diskstats. The name is not '\0'-terminated
+        template <typename Callback>
+        void ForEachDiskstat(const char *data, size_t size, Callback callback)
+        {
+            /*
+            /proc/diskstats
+                 254       0 vda 63942 27216 2310658 10533 10950 18607 2032400 6049 0 5236 17395 ...
+                major minor name
+                (1) reads completed       (2) reads merged       (3) sectors read      (4) ms reading
+                (5) writes completed      (6) writes merged      (7) sectors written   (8) ms writing
+                (9) I/Os in progress      (10) ms doing I/O      (11) weighted ms doing I/O
+                    ... discards (since 4.18), flushes (since 5.5)
+            */
+            const char *p = data;
+            const char *end = data + size;
+            while (p < end)
+            {
+                DiskCounters counters;
+                counters.major = static_cast<uint32_t>(ParseU64(p, end));
+                counters.minor = static_cast<uint32_t>(ParseU64(p, end));
+                const char *name = SkipSpaces(p, end);
+                p = name;
+                while (p < end && *p != ' ' && *p != '\n')
+                    ++p;
+                size_t name_size = static_cast<size_t>(p - name);
+
+                counters.reads = ParseU64(p, end);
+                p = SkipFields(p, end, 1);
+                counters.sectors_read = ParseU64(p, end);
+                counters.read_ms = ParseU64(p, end);
+                counters.writes = ParseU64(p, end);
+                p = SkipFields(p, end, 1);
+                counters.sectors_written = ParseU64(p, end);
+                counters.write_ms = ParseU64(p, end);
+                counters.in_flight = ParseU64(p, end);
+                counters.io_ms = ParseU64(p, end);
+                counters.queue_ms = ParseU64(p, end);
+                if (name_size != 0)
+                    callback(name, name_size, counters);
+
+                p = NextLine(p, end);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef RB_PROC_READER
+#define RB_PROC_READER
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+namespace system_metrics
+{
+    // Procfs file which is kept open between reads and reread with pread(2) from offset 0
+    class ProcFile
+    {
+    public:
+        explicit ProcFile(std::string path = std::string(), size_t capacity = 4096);
+        ~ProcFile();
+
+        ProcFile(ProcFile &&other) noexcept;
+        ProcFile &operator=(ProcFile &&other) noexcept;
+        ProcFile(const ProcFile &) = delete;
+        ProcFile &operator=(const ProcFile &) = delete;
+
+        // Rereads the whole file into the buffer. Returns false if the file cannot be read,
+        // errno is kept in Error() (ESRCH means the process the file belongs to has exited)
+        bool Read();
+
+        // Closes the descriptor. The next Read() opens the file again
+        void Close();
+
+        // File content of the last successful Read(). Always followed by '\0'
+        const char *Data() const { return m_buffer.data(); }
+        size_t Size() const { return m_size; }
+
+        int Error() const { return m_error; }
+        bool IsOpen() const { return m_fd >= 0; }
+        const std::string &Path() const { return m_path; }
+
+    private:
+        bool open();
+
+        std::string m_path;        // Path of the file
+        int m_fd;                  // Descriptor, -1 if the file is not open
+        int m_error;               // errno of the last failed open or read
+        std::vector<char> m_buffer; // Reusable read buffer, grows when the file does not fit
+        size_t m_size;             // Size of the data read last time
+    };
+
+    // Keeps the hot procfs files open: system-wide ones and the ones of every tracked pid
+    class ProcReader
+    {
+    public:
+        ProcReader();
+
+        // System-wide files. Each call rereads the file, nullptr is returned if it cannot be read
+        const ProcFile *Stat();
+        const ProcFile *Meminfo();
+        const ProcFile *NetDev();
+
+        // Files of the process <pid>. Each call rereads the file, nullptr is returned if it cannot be read.
+        // Descriptors are opened on the first call; when the process has exited all of them are closed
+        const ProcFile *PidStat(uint32_t pid);
+        const ProcFile *PidStatm(uint32_t pid);
+        const ProcFile *PidIo(uint32_t pid);
+        const ProcFile *PidNetDev(uint32_t pid);
+
+        // /proc/[pid]/smaps_rollup, nullptr as well if the kernel has none (before Linux 4.14).
+        // Walking every mapping of the process, it costs the kernel far more than the other files
+        const ProcFile *PidSmapsRollup(uint32_t pid);
+
+        // Closes descriptors of every pid which is not in <pids>
+        void Retain(const std::vector<uint32_t> &pids);
+
+        // Prepares the files of every pid of <pids> so that several threads may read them at once, each pid
+        // by a single thread at a time, until Settle(): the pids of exited processes are only marked meanwhile.
+        // Pids outside of <pids> cannot be read in between
+        void Reserve(const std::vector<uint32_t> &pids);
+
+        // Forgets the pids which have exited since Reserve()
+        void Settle();
+
+        // Returns the number of pids which have descriptors open
+        size_t TrackedPids() const { return m_pids.size(); }
+
+    private:
+        // Files of a single process
+        struct PidFiles
+        {
+            ProcFile stat;
+            ProcFile statm;
+            ProcFile io;
+            ProcFile net_dev;
+            ProcFile smaps_rollup;
+            bool exited;       // Set instead of forgetting the pid between Reserve() and Settle()
+        };
+
+        // Returns <file> reread, or nullptr
+        const ProcFile *read(ProcFile &file);
+
+        // Opens nothing yet: descriptors are opened on the first read
+        static PidFiles pidFiles(uint32_t pid);
+
+        // Rereads <member> of <pid>'s files; forgets the pid if it has exited
+        const ProcFile *readPid(uint32_t pid, ProcFile PidFiles::*member);
+
+        ProcFile m_stat;                                // /proc/stat
+        ProcFile m_meminfo;                             // /proc/meminfo
+        ProcFile m_net_dev;                             // /proc/net/dev
+        std::unordered_map<uint32_t, PidFiles> m_pids;  // Files of the tracked pids
+        bool m_has_rollup;                              // True if the kernel has smaps_rollup
+        bool m_reserved;                                // True between Reserve() and Settle()
+    };
+}
+
+#endif
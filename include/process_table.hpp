@@ -0,0 +1,84 @@
+#ifndef RB_PROCESS_TABLE
+#define RB_PROCESS_TABLE
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace system_metrics
+{
+    // What is kept of a process between two walks of /proc
+    struct ProcessState
+    {
+        uint32_t pid = 0;        // 0 for an empty slot, no process has it
+        uint64_t starttime = 0;  // Clock ticks after boot the process started at: tells a reused pid apart
+        uint64_t generation = 0; // Last walk which saw the process
+
+        // Counters as of the last walk, for the deltas of the next one
+        uint64_t cpu = 0;                       // utime + stime, in clock ticks
+        std::pair<uint64_t, uint64_t> io{0, 0}; // Characters read and written, in bytes
+
+        // Measured by the last walk, 0 for a process seen for the first time
+        uint64_t cpu_delta = 0;                       // Clock ticks since the walk before
+        std::pair<uint64_t, uint64_t> io_delta{0, 0}; // Bytes since the walk before (read, write)
+        uint64_t rss = 0;                             // Resident set size, in kilobytes
+
+        char comm[16] = {}; // Name of the executable, '\0'-terminated, as the kernel truncates it
+    };
+
+    // Flat open-addressing hash table of processes keyed by (pid, starttime), with linear probing. Nothing
+    // is allocated per lookup or removal: the slots only grow, once the table is half full, so memory follows
+    // the largest number of processes seen at once and lookups stay short. Removal shifts the following
+    // entries back instead of leaving tombstones, the table never needs a rebuild
+    class ProcessTable
+    {
+    public:
+        // Starts with room for <capacity> processes, rounded up to a power of two
+        explicit ProcessTable(size_t capacity = 1024);
+
+        // Returns the state of (<pid>, <starttime>). A process not in the table yet is inserted with
+        // generation 0 and every counter 0. The reference is valid until the next Insert() or Evict()
+        ProcessState &Insert(uint32_t pid, uint64_t starttime);
+
+        // Returns the state of (<pid>, <starttime>), or nullptr
+        const ProcessState *Find(uint32_t pid, uint64_t starttime) const;
+
+        // Removes every process whose generation is not <generation>: the ones the last walk did not see.
+        // Returns the number of processes removed
+        size_t Evict(uint64_t generation);
+
+        // Calls <func>(const ProcessState &) for every process, in no particular order
+        template <typename Func>
+        void ForEach(Func func) const
+        {
+            for (const auto &slot : m_slots)
+            {
+                if (slot.pid != 0)
+                    func(slot);
+            }
+        }
+
+        // Returns the number of processes in the table
+        size_t Size() const { return m_size; }
+
+        // Returns the number of slots
+        size_t Capacity() const { return m_slots.size(); }
+
+    private:
+        // Returns the slot (<pid>, <starttime>) is looked up from
+        size_t home(uint32_t pid, uint64_t starttime) const;
+
+        // Doubles the slots and inserts every process again
+        void grow();
+
+        // Empties <slot>, moving back the entries of the probe sequence which follows it
+        void erase(size_t slot);
+
+        std::vector<ProcessState> m_slots; // Power of two in size
+        size_t m_mask;                     // m_slots.size() - 1
+        size_t m_size;                     // Slots in use
+    };
+}
+
+#endif
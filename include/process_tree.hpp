@@ -0,0 +1,102 @@
+#ifndef RB_PROCESS_TREE
+#define RB_PROCESS_TREE
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "proc_reader.hpp"
+#include "worker_pool.hpp"
+
+namespace system_metrics
+{
+    // Keeps the set of descendants of a root process up to date
+    class ProcessTracker
+    {
+    public:
+        virtual ~ProcessTracker() = default;
+
+        // Brings the set of descendants up to date. Returns true if it changed
+        virtual bool Refresh() = 0;
+
+        // Returns the pid of the root process
+        virtual uint32_t Root() const = 0;
+
+        // Returns every descendant of the root process, sorted, as of the last Refresh()
+        virtual const std::vector<uint32_t> &Descendants() const = 0;
+
+        // Lets Refresh() read on the workers of <pool>, nullptr for none. Trackers without enough work ignore it
+        virtual void SetPool(WorkerPool *pool) { (void)pool; }
+
+        // Returns the number of processes which have joined (forked into) and left (exited) the tree so far
+        uint64_t Forks() const { return m_forks; }
+        uint64_t Exits() const { return m_exits; }
+
+    protected:
+        uint64_t m_forks = 0; // Processes which have joined the tree
+        uint64_t m_exits = 0; // Processes which have left the tree
+    };
+
+    // Tracks every descendant (children, grandchildren, ...) of a root process.
+    // Walks only the monitored subtree through /proc/[pid]/task/[tid]/children and keeps
+    // it cached between refreshes, so the cost scales with the subtree, not with the host.
+    // Falls back to a full /proc scan when the kernel has no children files (CONFIG_PROC_CHILDREN).
+    class DescendantTracker : public ProcessTracker
+    {
+    public:
+        // A full /proc scan reads the stat of every process on the workers of <pool>, if any
+        explicit DescendantTracker(uint32_t root, WorkerPool *pool = nullptr);
+
+        // Rereads the children of every cached node, expanding only the new ones.
+        // Returns true if the set of descendants changed.
+        // Polling only sees the processes which are alive at a refresh: the ones which
+        // started and exited in between are not counted in Forks()/Exits()
+        bool Refresh() override;
+
+        uint32_t Root() const override { return m_root; }
+
+        const std::vector<uint32_t> &Descendants() const override { return m_descendants; }
+
+        // Returns true if the tracker scans the whole /proc instead of the subtree
+        bool IsFallback() const { return m_fallback; }
+
+        void SetPool(WorkerPool *pool) override { m_pool = pool; }
+
+        // Closes the files of the subtree, keeping the descendants. The next Refresh() opens them again
+        void Close() { m_nodes.clear(); }
+
+    private:
+        // Cached process of the subtree
+        struct Node
+        {
+            ProcFile stat;                 // /proc/[pid]/stat, tells the number of threads
+            std::vector<ProcFile> threads; // /proc/[pid]/task/[tid]/children of every thread
+            std::vector<uint32_t> children; // Children found by the last refresh
+        };
+
+        // Creates the node of <pid> with a children file per thread. Returns nullptr if the process is gone
+        Node *addNode(uint32_t pid);
+
+        // Reopens the children files when the number of threads of <node> changed
+        void updateThreads(uint32_t pid, Node &node, uint64_t num_threads);
+
+        // Rereads the children of <pid> into <node>. Returns false if the process is gone
+        bool readChildren(uint32_t pid, Node &node);
+
+        // Finds the descendants with a full /proc scan
+        bool refreshByScan();
+
+        // Replaces the descendants with <descendants>, counting processes which joined and left
+        bool update(std::vector<uint32_t> &descendants);
+
+        uint32_t m_root;                           // Pid of the root process
+        bool m_fallback;                           // True if children files are not available
+        WorkerPool *m_pool;                        // Workers of the /proc scan, nullptr to scan on the caller's thread
+        std::unordered_map<uint32_t, Node> m_nodes; // Cached nodes of the subtree, the root included
+        std::vector<uint32_t> m_descendants;       // Descendants found by the last refresh
+        std::vector<uint32_t> m_scratch;           // Reusable buffer for the traversal
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> m_parents; // (ppid, pid) found by every worker of a scan
+    };
+}
+
+#endif
@@ -5,6 +5,10 @@
 #include <iostream>
 #include <cstdint>
 #include <thread>
+#include <memory>
+#include <string>
+
+#include "sampler.hpp"
 
 class Rb_metrics
 {
@@ -12,6 +16,12 @@ public:
     Rb_metrics(unsigned int pid, unsigned long seconds) : m_pid(pid),
                                                           m_period(seconds),
                                                           m_children_pids(getAllChildren(m_pid)) {}
+
+    // Measures the cgroup v2 <cgroup> as a whole instead of a process tree: every process of the
+    // service is counted, at a constant cost. <cgroup> is e.g. "/system.slice/ssh.service"
+    Rb_metrics(const std::string &cgroup, unsigned long seconds) : m_pid(0),
+                                                                   m_period(seconds),
+                                                                   m_cgroup(new system_metrics::CgroupReader(cgroup)) {}
     // Cpu metrics
 
     // Returns general cpu usage percentage over the period
@@ -34,6 +44,10 @@ public:
     // Returns process and its children's ram usage in megabytes over the period
     uint32_t GetRamUsage_m();
 
+    // Returns process and its children's memory by kind in kilobytes: RSS, and PSS and USS which
+    // count the pages shared between processes once
+    system_metrics::MemoryUsage GetMemoryUsage();
+
     // Network
 
     // Returns general net usage in kilobytes(read, write) over the period
@@ -50,28 +64,37 @@ public:
     // Returns process and its children's general io statistics in kilobytes(read, write) over the period
     std::pair<uint64_t, uint64_t> GetIoStats();
 
-private:
-    // Returns cpu usage percentage over the period(m_period)
-    uint32_t getCpuUsage(uint32_t pid = 0);
-
-    // Returns RAM usage percentage over the period(m_period)
-    uint32_t getRamUsage(uint32_t pid = 0);
+    // Per-process accounting
 
-    // Returns RAM usage in megabytes over the period(m_period)
-    uint32_t getRamUsage_m(uint32_t pid = 0);
+    // Reads per-process cpu and io by taskstats queries instead of procfs, by tgid or by pid as <mode>.
+    // Returns false, keeping procfs, if taskstats is not available
+    bool UseTaskstats(system_metrics::TaskstatsClient::Mode mode = system_metrics::TaskstatsClient::PER_TGID);
 
-    // Returns network usage(pair of (uint32_t readed, uint32_t written)) in kilobytes over the period(m_period)
-    std::pair<uint64_t, uint64_t> getNetUsage(uint32_t pid = 0);
+    // Reads and parses the files of the processes on <workers> threads, this one included, and finds the
+    // descendants again with them. 1, the default, starts none
+    void SetWorkers(size_t workers);
 
-    // Returns IO usage (pair of (uint32_t readed, uint32_t written)) in kilobytes over the period(m_period)
-    std::pair<uint64_t, uint64_t> getIoStats(uint32_t pid = 0);
+    // Self-instrumentation
 
-    // Returns all children of the current pid(m_pid)
-    std::vector<uint32_t> getAllChildren(uint32_t pid);
+    // Returns what every collector has cost per snapshot so far, two snapshots per getter
+    const system_metrics::SelfStats &GetSelfStats() const { return m_self; }
 
-    uint32_t m_pid;                        // Pid of the process under examination
-    uint32_t m_period;                     // Time period which data should be measured within
-    std::vector<uint32_t> m_children_pids; // Vector of children processes pids
+private:
+    // Takes two snapshots m_period apart and returns metrics measured between them.
+    // Use Rb_sampler instead when more than one metric per period is needed.
+    system_metrics::Metrics measure();
+
+    // Returns all descendants (children, grandchildren, ...) of the current pid(m_pid),
+    // a /proc scan reads on the workers of <pool> if any
+    std::vector<uint32_t> getAllChildren(uint32_t pid, system_metrics::WorkerPool *pool = nullptr);
+
+    uint32_t m_pid;                                         // Pid of the process under examination
+    uint32_t m_period;                                      // Time period which data should be measured within
+    std::vector<uint32_t> m_children_pids;                  // Vector of descendant processes pids
+    std::unique_ptr<system_metrics::CgroupReader> m_cgroup; // Cgroup measured instead of the tree of m_pid, or nullptr
+    system_metrics::Sources m_sources;                      // Keeps every source open between getters
+    system_metrics::TargetAccounting m_accounting;          // Counters of the processes of the tree, between snapshots
+    system_metrics::SelfStats m_self;                       // Overhead of the snapshots
 };
 
 #endif
\ No newline at end of file
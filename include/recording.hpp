@@ -0,0 +1,120 @@
+#ifndef RB_RECORDING
+#define RB_RECORDING
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "sampler.hpp"
+
+/*
+Recording file format, little-endian:
+
+    file header  "RBREC001" u32 version u32 reserved
+    chunk        u32 'RBCK' u32 payload size u32 records u32 reserved u64 first timestamp u64 last timestamp
+                 payload: records
+    ...
+    index        (u64 chunk offset, u64 first timestamp, u64 last timestamp) per chunk
+    trailer      u64 chunks u64 index offset "RBINDEX1"
+
+Every record is a Snapshot. Its timestamp is stored as the zigzag varint of the change of the interval,
+every counter as the zigzag varint of its change since the previous record, so a steady counter takes
+a byte or two. Targets are written in full (pid and cgroup) only when they differ from the target at the
+same position in the previous record, and so are the cores (number), the network namespaces of the
+system and of every target (inode and whether it is the sampler's) and the block devices (name and
+numbers). Each chunk
+starts from a zero state, so its first record is a keyframe and any chunk decodes on its own. The index
+and the trailer are written on Close(); a file without them (the recorder was killed) is indexed by
+walking the chunk headers.
+*/
+namespace system_metrics
+{
+    // Index entry of a chunk of a recording
+    struct RecordingChunk
+    {
+        uint64_t offset;          // Offset of the chunk header in the file
+        uint64_t first_timestamp; // Timestamp of the first snapshot of the chunk
+        uint64_t last_timestamp;  // Timestamp of the last snapshot of the chunk
+    };
+
+    // Appends snapshots to a recording file
+    class RecordingWriter
+    {
+    public:
+        // Creates (truncates) <path>. Every <keyframe_interval> records, or once a chunk spans <chunk_duration>,
+        // the chunk is written and a new one started, so a killed recorder loses at most that much
+        explicit RecordingWriter(const std::string &path, size_t keyframe_interval = 256,
+                                 std::chrono::milliseconds chunk_duration = std::chrono::milliseconds(5000));
+        ~RecordingWriter();
+
+        RecordingWriter(const RecordingWriter &) = delete;
+        RecordingWriter &operator=(const RecordingWriter &) = delete;
+
+        // Encodes <snapshot> into the current chunk. Returns false if a full chunk could not be written
+        bool Append(const Snapshot &snapshot);
+
+        // Writes the current chunk, so everything appended so far is on disk
+        bool Flush();
+
+        // Flushes and writes the index. Nothing can be appended afterwards
+        void Close();
+
+        bool IsOpen() const { return m_fd >= 0; }
+
+    private:
+        // Writes <size> bytes of <data> at the end of the file. Returns false on error
+        bool write(const void *data, size_t size);
+
+        int m_fd;                            // Recording file, -1 when closed
+        size_t m_keyframe_interval;          // Records per chunk
+        uint64_t m_chunk_ns;                 // Longest time a chunk spans
+        uint64_t m_offset;                   // Size of the file written so far
+        std::vector<char> m_chunk;           // Header and encoded records of the current chunk
+        uint32_t m_records;                  // Records in the current chunk
+        uint64_t m_first_timestamp;          // Timestamp of the first record of the current chunk
+        Snapshot m_prev;                     // Previous record of the chunk, the base of the deltas
+        int64_t m_prev_interval;             // Interval between the two previous records of the chunk
+        std::vector<RecordingChunk> m_index; // Every chunk written
+    };
+
+    // Replays a recording file mapped into memory
+    class RecordingReader
+    {
+    public:
+        explicit RecordingReader(const std::string &path);
+        ~RecordingReader();
+
+        RecordingReader(const RecordingReader &) = delete;
+        RecordingReader &operator=(const RecordingReader &) = delete;
+
+        // Calls <callback> for every snapshot taken within [<from_ns>, <to_ns>], in order.
+        // Only the chunks overlapping the range are decoded. Returns the number of snapshots replayed
+        size_t Replay(uint64_t from_ns, uint64_t to_ns, const std::function<void(const Snapshot &)> &callback) const;
+
+        // Returns true if the file was mapped and is a recording
+        bool IsOpen() const { return m_data != nullptr; }
+
+        // Returns the number of chunks
+        size_t Chunks() const { return m_index.size(); }
+
+        // Returns the timestamps of the first and of the last snapshot, 0 if there are none
+        uint64_t FirstTimestamp() const { return m_index.empty() ? 0 : m_index.front().first_timestamp; }
+        uint64_t LastTimestamp() const { return m_index.empty() ? 0 : m_index.back().last_timestamp; }
+
+    private:
+        // Reads the index out of the trailer. Returns false if there is no valid one
+        bool readIndex();
+
+        // Builds the index out of the chunk headers
+        void scanChunks();
+
+        const char *m_data;                  // Mapped file, nullptr if it could not be mapped
+        size_t m_size;                       // Size of the mapping
+        std::vector<RecordingChunk> m_index; // Every chunk, in time order
+    };
+}
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef RB_SAMPLER
+#define RB_SAMPLER
+
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <utility>
+#include <memory>
+#include <string>
+
+#include "proc_reader.hpp"
+#include "net_interfaces.hpp"
+#include "process_tree.hpp"
+#include "cpu_stat.hpp"
+#include "taskstats.hpp"
+#include "cgroup.hpp"
+#include "block_devices.hpp"
+#include "sock_diag.hpp"
+#include "self_stats.hpp"
+#include "worker_pool.hpp"
+#include "top_processes.hpp"
+
+namespace system_metrics
+{
+    class MetricHistory;
+    class RecordingWriter;
+
+    // Memory of a process or a target by kind, in kilobytes
+    struct MemoryUsage
+    {
+        uint64_t rss = 0;  // Resident set size, every resident page counted whoever shares it
+        uint64_t pss = 0;  // Proportional set size, a shared page divided among the processes sharing it
+        uint64_t uss = 0;  // Unique set size, private pages only
+        uint64_t anon = 0; // Resident anonymous memory
+        uint64_t file = 0; // Resident file-backed and shared memory
+        uint64_t swap = 0; // Swapped out anonymous memory
+    };
+
+    // Raw counters of a single process
+    struct ProcessCounters
+    {
+        uint64_t cpu = 0;                        // utime + stime + cutime + cstime, in clock ticks
+        uint64_t ram = 0;                        // Resident set size, in kilobytes
+        std::pair<uint64_t, uint64_t> net{0, 0}; // Traffic of its TCP sockets so far, in bytes (read, write)
+        std::pair<uint64_t, uint64_t> io{0, 0};  // Characters read and written, in kilobytes
+        MemoryUsage memory;                      // By smaps_rollup, by statm where it cannot be read
+    };
+
+    // Interface counters of a network namespace which monitored processes live in
+    struct NetNamespaceSnapshot
+    {
+        uint64_t inode = 0;                      // Inode of /proc/[pid]/ns/net
+        bool own = false;                        // True for the namespace of the sampler
+        std::pair<uint64_t, uint64_t> net{0, 0}; // Bytes of its interfaces (read, write), loopback left out
+    };
+
+    // Raw counters of a monitored target: a process alone, with its descendants or a whole cgroup
+    struct TargetSnapshot
+    {
+        uint32_t pid = 0;         // Root process of the target, 0 for a cgroup
+        std::string cgroup;       // Cgroup of the target, empty for a process
+        ProcessCounters counters; // Sum over every process of the target
+        uint64_t forks = 0;       // Processes which have joined the tree so far
+        uint64_t exits = 0;       // Processes which have left the tree so far
+
+        // Network namespaces of its processes whose interface counters count for it, once each, sorted by inode
+        std::vector<NetNamespaceSnapshot> namespaces;
+    };
+
+    // Raw counters of every metric source, read once per tick
+    struct Snapshot
+    {
+        uint64_t timestamp_ns = 0; // CLOCK_MONOTONIC time the sources were read at
+
+        // Cpu, in clock ticks
+        CpuStatMatrix cpus;     // Every state of the aggregate and of every core
+        uint64_t cpu_busy = 0;  // System-wide time spent in every state but idle and iowait
+        uint64_t cpu_total = 0; // System-wide time spent in every state
+
+        // RAM, in kilobytes
+        uint64_t ram_total = 0;
+        uint64_t ram_occupied = 0;
+
+        // Network, in bytes (read, write)
+        std::pair<uint64_t, uint64_t> net{0, 0};
+        std::vector<NetNamespaceSnapshot> namespaces; // Every namespace of the monitored processes, sorted by inode
+
+        // Block devices, in kilobytes (read, write)
+        std::pair<uint64_t, uint64_t> io{0, 0};
+        std::vector<DiskSnapshot> disks; // Counters of every counted block device
+
+        std::vector<TargetSnapshot> targets; // Counters of every monitored target
+
+        CollectorCosts costs; // What reading every collector cost the monitor
+    };
+
+    // Metrics of a monitored target computed from two consecutive snapshots
+    struct TargetMetrics
+    {
+        uint32_t pid = 0;   // Root process of the target, 0 for a cgroup
+        std::string cgroup; // Cgroup of the target, empty for a process
+
+        uint32_t cpu = 0;   // %
+        uint32_t ram = 0;   // %
+        uint32_t ram_m = 0; // Megabytes
+
+        std::pair<uint64_t, uint64_t> net{0, 0}; // Kilobytes per second (read, write)
+        std::pair<uint64_t, uint64_t> io{0, 0};  // Kilobytes per second (read, write)
+
+        uint64_t forks = 0; // Processes which have joined the tree within the period, 0 for a cgroup
+        uint64_t exits = 0; // Processes which have left the tree within the period, 0 for a cgroup
+
+        MemoryUsage memory; // Kilobytes, as of the second snapshot
+    };
+
+    // Metrics of a network namespace computed from two consecutive snapshots
+    struct NetNamespaceMetrics
+    {
+        uint64_t inode = 0; // Inode of /proc/[pid]/ns/net
+        bool own = false;   // True for the namespace of the sampler
+
+        std::pair<uint64_t, uint64_t> net{0, 0}; // Kilobytes per second (read, write)
+    };
+
+    // Metrics of a block device computed from two consecutive snapshots
+    struct DiskMetrics
+    {
+        std::string name; // Device, empty for the aggregate of every device
+
+        std::pair<uint64_t, uint64_t> kbps{0, 0};   // Kilobytes per second (read, write)
+        std::pair<uint64_t, uint64_t> iops{0, 0};   // Operations per second (read, write)
+        std::pair<double, double> latency_ms{0, 0}; // Average time an operation took (read, write)
+        double queue_depth = 0;                     // Average number of I/Os in progress
+        double utilization = 0;                     // Time with I/O in progress, %. The busiest device's for the aggregate
+    };
+
+    // Metrics computed from two consecutive snapshots
+    struct Metrics
+    {
+        uint64_t elapsed_ns = 0; // Measured time between the snapshots
+        uint64_t collect_ns = 0; // Time spent reading the sources and computing the metrics
+        uint64_t missed = 0;     // Periods skipped since the previous sample because collection overran
+
+        uint32_t general_cpu = 0;   // %
+        CpuUsage cpus;              // Share of every state of the aggregate and of every core, %
+        uint32_t general_ram = 0;   // %
+        uint32_t general_ram_m = 0; // Megabytes
+
+        std::pair<uint64_t, uint64_t> general_net{0, 0}; // Kilobytes per second (read, write)
+        std::pair<uint64_t, uint64_t> general_io{0, 0};  // Kilobytes per second (read, write)
+        DiskMetrics general_disk;                        // Every counted block device together
+        std::vector<DiskMetrics> disks;                  // Every counted block device
+        std::vector<NetNamespaceMetrics> namespaces;     // Every network namespace of the monitored processes
+
+        std::vector<TargetMetrics> targets; // Metrics of every monitored target, in the order they were added
+
+        CollectorCosts costs; // What reading every collector cost the monitor at the second snapshot
+    };
+
+    // What the processes of a target counted at the previous snapshot. The counters of a target are the sum
+    // over its processes: without it, the sum would fall when one leaves whose counters its parent does not
+    // take over, and the target would show nothing for the period
+    struct TargetAccounting
+    {
+        std::vector<uint32_t> pids;                 // Processes of the target which could be read, sorted
+        std::vector<ProcessCounters> counters;      // Counters of <pids>
+        std::vector<char> by_taskstats;             // Non-zero for the <counters> whose cpu and io taskstats gave
+        std::vector<uint32_t> next_pids;            // Built by the current snapshot, swapped with <pids>
+        std::vector<ProcessCounters> next_counters; // Built by the current snapshot, swapped with <counters>
+        std::vector<char> next_by_taskstats;        // Built by the current snapshot, swapped with <by_taskstats>
+
+        // Added to the sum: the last counters of the processes which left, and what a process lost or gained
+        // when its cpu and io moved between taskstats and procfs or went backwards as it exited. Modulo 2^64,
+        // it may stand for a negative value
+        ProcessCounters carried;
+    };
+
+    // Processes a monitored target consists of
+    struct TargetProcesses
+    {
+        uint32_t pid;                             // Root process of the target
+        const std::vector<uint32_t> *descendants; // Its descendants, nullptr for a single process
+        uint64_t forks;                           // Processes which have joined the tree so far
+        uint64_t exits;                           // Processes which have left the tree so far
+        CgroupReader *cgroup;                     // Cgroup read as a whole instead of processes, or nullptr
+        TargetAccounting *accounting;             // Kept between snapshots, nullptr to sum the processes alone
+    };
+
+    // Memory of the processes as smaps_rollup gave it
+    struct RollupCache
+    {
+        std::vector<uint32_t> pids;      // Processes smaps_rollup was read for, sorted
+        std::vector<MemoryUsage> memory; // Memory of <pids>
+        uint64_t read_ns = 0;            // Last time it was read for every process
+    };
+
+    // Sockets of a process among those a worker found
+    struct SocketSpan
+    {
+        size_t worker = 0;        // Worker which listed the descriptors
+        size_t offset = 0;        // First socket in the inodes of the worker
+        size_t count = 0;         // Number of sockets
+        bool known = false;       // The descriptors were not listed again: <offset> is in the known sockets instead
+        uint32_t descriptors = 0; // Descriptors the process had when they were listed
+        uint64_t listed_ns = 0;   // Timestamp of the tick which listed them
+    };
+
+    // Traffic attributed to the monitored processes from the TCP sockets they hold
+    struct SocketAttribution
+    {
+        std::vector<SocketBytes> sockets;                      // Sockets of the last dump, sorted by inode
+        std::vector<SocketBytes> next_sockets;                 // Dumped by the current tick, swapped with <sockets>
+        std::vector<bool> claimed;                             // True for the <next_sockets> already attributed
+        std::vector<std::vector<uint64_t>> inodes;             // Sockets found by every worker within the tick
+        std::vector<SocketSpan> spans;                         // Sockets of every pid in <inodes> or <known>
+        std::vector<uint32_t> known_pids;                      // Processes whose sockets are known, sorted
+        std::vector<SocketSpan> known_spans;                   // Sockets of <known_pids> in <known>
+        std::vector<uint64_t> known;                           // Sockets of <known_pids> as of the last tick
+        std::vector<uint32_t> next_known_pids;                 // Built by the current tick, swapped with <known_pids>
+        std::vector<SocketSpan> next_known_spans;              // Built by the current tick, swapped with <known_spans>
+        std::vector<uint64_t> next_known;                      // Built by the current tick, swapped with <known>
+        std::vector<uint32_t> pids;                            // Processes traffic was attributed to, sorted
+        std::vector<std::pair<uint64_t, uint64_t>> bytes;      // Bytes attributed to <pids> so far (read, write)
+        std::vector<uint32_t> next_pids;                       // Built by the current tick, swapped with <pids>
+        std::vector<std::pair<uint64_t, uint64_t>> next_bytes; // Built by the current tick, swapped with <bytes>
+        uint64_t relist_interval_ns = 5000000000;              // Time after which known descriptors are listed again
+    };
+
+    // Everything snapshots are read from, kept open between ticks
+    struct Sources
+    {
+        ProcReader reader;                         // Procfs files
+        NetInterfaceRegistry interfaces;           // Active network interfaces
+        BlockDevices disks;                        // Block devices
+        SockDiagClient sock_diag;                  // TCP sockets of the network namespace
+        std::unique_ptr<TaskstatsClient> taskstats; // Per-process cpu and io by taskstats, nullptr to read procfs
+
+        // Every per-pid file is read and parsed on the workers of the pool, each into its own entries
+        // of the vectors below; whatever pids share is merged on the calling thread afterwards
+        std::unique_ptr<WorkerPool> pool;                               // nullptr to read on the calling thread only
+        std::vector<std::unique_ptr<TaskstatsClient>> worker_taskstats; // Queries of workers 1 and up, one socket each
+
+        std::vector<uint32_t> pids;            // Every monitored pid of the tick, sorted and unique
+        std::vector<ProcessCounters> counters; // Counters of <pids>, read once per tick
+        std::vector<char> by_taskstats;        // Non-zero for the <counters> whose cpu and io taskstats answered
+        std::vector<char> found;               // Non-zero for the <counters> whose process could be read
+        std::vector<size_t> members;           // Indexes of the processes of a target, reused
+        std::vector<char> rolled;              // Non-zero for the <counters> whose memory smaps_rollup gave
+        std::vector<uint64_t> netns;           // Network namespace of <pids>, the sampler's where it cannot be read
+        std::vector<uint64_t> target_netns;    // Namespaces of a target, reused
+
+        // smaps_rollup walks every mapping of a process in the kernel: it is read once per interval, and
+        // for the new processes only in between
+        uint64_t rollup_interval_ns = 5000000000; // Time between two reads of every process
+        RollupCache rollup;                       // Memory read last
+        RollupCache next_rollup;                  // Built by the current tick, swapped with <rollup>
+
+        SocketAttribution sockets; // Per-process traffic, unless sock_diag cannot be dumped
+        bool by_sockets = false;   // True if the tick attributed the traffic of the sampler's namespace by socket
+    };
+
+    // Reads the system-wide sources once, and every pid of the <targets> once, even if several targets share it
+    Snapshot TakeSnapshot(Sources &sources, const std::vector<TargetProcesses> &targets);
+
+    // Computes usage and rates between <prev> and <curr> using their measured elapsed time
+    Metrics ComputeMetrics(const Snapshot &prev, const Snapshot &curr);
+}
+
+// Samples every metric of a set of monitored targets in a single pass per period
+class Rb_sampler
+{
+public:
+    // With <track_events> process trees are kept by proc connector events when permitted
+    Rb_sampler(unsigned int pid, unsigned long seconds, bool track_events = false);
+
+    // Monitors the trees of every pid of <pids>
+    Rb_sampler(const std::vector<uint32_t> &pids, unsigned long seconds, bool track_events = false);
+
+    // Samples every <period>, down to a millisecond
+    Rb_sampler(unsigned int pid, std::chrono::milliseconds period, bool track_events = false);
+    Rb_sampler(const std::vector<uint32_t> &pids, std::chrono::milliseconds period, bool track_events = false);
+    ~Rb_sampler();
+
+    // Adds a target: the process <pid> with its descendants if <tree>, the process alone otherwise
+    void AddTarget(uint32_t pid, bool tree = true);
+
+    // Stops monitoring the target <pid>
+    void RemoveTarget(uint32_t pid);
+
+    // Adds a target which is the cgroup v2 <path> as a whole, e.g. "/system.slice/ssh.service"
+    void AddCgroup(const std::string &path);
+
+    // Stops monitoring the cgroup <path>, as it was added
+    void RemoveCgroup(const std::string &path);
+
+    // Reads per-process cpu and io by taskstats queries instead of procfs, by tgid or by pid as <mode>.
+    // Returns false, keeping procfs, if taskstats is not available
+    bool UseTaskstats(system_metrics::TaskstatsClient::Mode mode = system_metrics::TaskstatsClient::PER_TGID);
+
+    // Blocks until the next deadline and returns metrics measured since the previous sample.
+    // Deadlines are absolute, every period from construction: time spent on collection does not drift
+    // the schedule, and deadlines which passed during an overrun are skipped and reported as missed
+    system_metrics::Metrics Sample();
+
+    // Returns metrics measured since the previous sample right away, for callers which keep time
+    // themselves, such as system_metrics::EventLoop. <missed> is the number of periods they skipped
+    system_metrics::Metrics Collect(uint64_t missed = 0);
+
+    // Reads and parses the files of the processes on <workers> threads, the sampling one included, instead
+    // of on the sampling thread alone; discovery by /proc scan uses them too. 1, the default, starts none
+    void SetWorkers(size_t workers);
+
+    // Returns the time period between two samples
+    std::chrono::milliseconds Period() const { return m_period; }
+
+    // Reads the memory breakdown of every process from smaps_rollup at most once per <interval>,
+    // 5 s by default. Processes which join a target in between are read on their first sample
+    void SetRollupInterval(std::chrono::milliseconds interval);
+
+    // Lists the descriptors of a process again, to find the sockets it holds, at least once per <interval>,
+    // 5 s by default, and whenever its number of descriptors changes
+    void SetRelistInterval(std::chrono::milliseconds interval);
+
+    // Returns the number of deadlines missed so far
+    uint64_t Missed() const { return m_missed; }
+
+    // Returns what every collector has cost the sampler itself over the samples so far
+    const system_metrics::SelfStats &Self() const { return m_self; }
+
+    // Starts recording every metric of every sample: <retention> samples are kept per metric and target,
+    // windowed aggregates cover the last <window> of them
+    void KeepHistory(size_t retention, size_t window);
+
+    // Ranks every process of the system at every sample, see top_processes.hpp: the <count> highest by cpu,
+    // RSS and io, whether they are monitored or not
+    void KeepTop(size_t count);
+
+    // Returns the rankings as of the last sample, nullptr unless KeepTop() was called
+    const system_metrics::TopProcesses *Top() const { return m_top.get(); }
+
+    // Returns the recorded history, nullptr unless KeepHistory() was called.
+    // It may be read from other threads while the sampler runs
+    std::shared_ptr<const system_metrics::MetricHistory> History() const { return m_history; }
+
+    // Starts appending every snapshot to the recording file <path>, see recording.hpp. A chunk reaches
+    // the file every <keyframe_interval> samples or every <chunk_duration>, whichever comes first.
+    // Returns false if the file cannot be created
+    bool RecordTo(const std::string &path, size_t keyframe_interval = 60,
+                  std::chrono::milliseconds chunk_duration = std::chrono::milliseconds(5000));
+
+private:
+    // Monitored target
+    struct Target
+    {
+        uint32_t pid;                                                 // Root process, 0 for a cgroup
+        std::unique_ptr<system_metrics::ProcessTracker> tree;         // Its descendants, nullptr for a single process
+        std::string cgroup_path;                                      // Cgroup as added, empty for a process
+        std::unique_ptr<system_metrics::CgroupReader> cgroup;         // Cgroup files, nullptr for a process
+        std::unique_ptr<system_metrics::TargetAccounting> accounting; // Counters of its processes, nullptr for a cgroup
+    };
+
+    // Returns the processes of every target
+    std::vector<system_metrics::TargetProcesses> processes() const;
+
+    std::chrono::milliseconds m_period;                           // Time period between two snapshots
+    bool m_track_events;                                          // Keep process trees by proc connector events
+    std::vector<Target> m_targets;                                // Monitored targets
+    bool m_targets_changed;                                       // True if a process left a target since the last tick
+    system_metrics::Sources m_sources;                            // Keeps every source open between ticks
+    system_metrics::Snapshot m_last;                              // Snapshot taken at the previous tick
+    std::chrono::steady_clock::time_point m_deadline;             // Time the next snapshot is due at
+    uint64_t m_missed;                                            // Deadlines missed so far
+    system_metrics::SelfStats m_self;                             // Overhead of the samples
+    std::shared_ptr<system_metrics::MetricHistory> m_history;     // History of the samples, nullptr if not kept
+    std::unique_ptr<system_metrics::RecordingWriter> m_recording; // Recording of the snapshots, nullptr if not recorded
+    std::unique_ptr<system_metrics::TopProcesses> m_top;          // Rankings of every process, nullptr if not kept
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef RB_SELF_STATS
+#define RB_SELF_STATS
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace system_metrics
+{
+    // Parts of a sample cycle whose cost is measured separately
+    enum Collector
+    {
+        COLLECTOR_CPU,       // /proc/stat, per-process stat or taskstats
+        COLLECTOR_RAM,       // /proc/meminfo, per-process statm
+        COLLECTOR_NET,       // Interfaces, /proc/net/dev, per-process net/dev
+        COLLECTOR_IO,        // Block devices, per-process io
+        COLLECTOR_CGROUP,    // Cgroup targets
+        COLLECTOR_DISCOVERY, // Descendants of the process targets
+        COLLECTOR_TOP,       // Every process of the system, in top-N mode
+        COLLECTORS
+    };
+
+    // Returns the name of <collector> as used in labels, e.g. "cpu"
+    const char *CollectorName(Collector collector);
+
+    // Work done by the calling thread, counted where files are opened and read and processes spawned
+    struct WorkCounters
+    {
+        uint64_t files_opened = 0;      // Files and directories opened
+        uint64_t bytes_read = 0;        // Bytes read to be parsed
+        uint64_t processes_spawned = 0; // Processes forked, e.g. by popen(3) or system(3)
+    };
+
+    // Returns the counters of the calling thread
+    inline WorkCounters &ThreadWork()
+    {
+        static thread_local WorkCounters counters;
+        return counters;
+    }
+
+    // Returns the cpu time of the calling thread in nanoseconds
+    uint64_t ThreadCpuNs();
+
+    // Returns the cpu time worker threads spent on work the calling thread waited for, in nanoseconds
+    inline uint64_t &ThreadWorkerCpuNs()
+    {
+        static thread_local uint64_t ns = 0;
+        return ns;
+    }
+
+    // What running a collector once cost the monitor itself
+    struct CollectorCost
+    {
+        uint64_t wall_ns = 0; // Wall time
+        uint64_t cpu_ns = 0;  // Cpu time of the sampling thread and of the workers it waited for
+        WorkCounters work;    // Files opened, bytes read and processes spawned
+    };
+
+    typedef std::array<CollectorCost, COLLECTORS> CollectorCosts;
+
+    // Adds the cost of the calling thread from construction to destruction to <cost>
+    class CollectorTimer
+    {
+    public:
+        explicit CollectorTimer(CollectorCost &cost);
+        ~CollectorTimer();
+
+        CollectorTimer(const CollectorTimer &) = delete;
+        CollectorTimer &operator=(const CollectorTimer &) = delete;
+
+    private:
+        CollectorCost &m_cost; // Cost added to
+        uint64_t m_wall_ns;    // CLOCK_MONOTONIC at construction
+        uint64_t m_cpu_ns;     // CLOCK_THREAD_CPUTIME_ID at construction, plus the workers' cpu time so far
+        WorkCounters m_work;   // Counters of the thread at construction
+    };
+
+    // Histogram of values in power of two buckets: bucket i counts the values up to 2^i, the last one
+    // every larger value. Adding a value is a few instructions and never allocates
+    class Histogram
+    {
+    public:
+        static const size_t kBuckets = 40;
+
+        void Add(uint64_t value);
+
+        // Returns the number of values which fell into <bucket>, not cumulative
+        uint64_t Bucket(size_t bucket) const { return m_buckets[bucket]; }
+
+        // Returns the inclusive upper bound of <bucket>
+        static uint64_t UpperBound(size_t bucket) { return uint64_t(1) << bucket; }
+
+        uint64_t Count() const { return m_count; }
+        uint64_t Sum() const { return m_sum; }
+
+    private:
+        std::array<uint64_t, kBuckets> m_buckets{}; // Values per bucket
+        uint64_t m_count = 0;                       // Values added
+        uint64_t m_sum = 0;                         // Sum of the values added
+    };
+
+    // The monitor's own overhead: distributions of the wall and cpu time of every collector per tick,
+    // and the totals of its work. Written and read by the sampling thread
+    class SelfStats
+    {
+    public:
+        // Adds the costs of one tick
+        void Record(const CollectorCosts &costs);
+
+        // Returns the distribution of the wall and cpu time of <collector> per tick, in nanoseconds
+        const Histogram &Wall(Collector collector) const { return m_wall[collector]; }
+        const Histogram &Cpu(Collector collector) const { return m_cpu[collector]; }
+
+        // Returns the work of <collector> over every tick so far
+        const WorkCounters &Work(Collector collector) const { return m_work[collector]; }
+
+        // Returns the number of ticks recorded
+        uint64_t Ticks() const { return m_ticks; }
+
+    private:
+        std::array<Histogram, COLLECTORS> m_wall;    // Wall time per tick of every collector
+        std::array<Histogram, COLLECTORS> m_cpu;     // Cpu time per tick of every collector
+        std::array<WorkCounters, COLLECTORS> m_work; // Work of every collector so far
+        uint64_t m_ticks = 0;                        // Ticks recorded
+    };
+}
+
+#endif
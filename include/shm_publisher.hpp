@@ -0,0 +1,40 @@
+#ifndef RB_SHM_PUBLISHER
+#define RB_SHM_PUBLISHER
+
+#include <memory>
+#include <string>
+
+#include "sampler.hpp"
+#include "shm_snapshot.hpp"
+
+namespace system_metrics
+{
+    // Publishes the metrics of every tick into a named shared memory segment, see shm_snapshot.hpp for
+    // the layout, so that any number of local consumers share a single collection
+    class SharedSnapshotPublisher
+    {
+    public:
+        // Creates, or takes over, the POSIX shared memory object <name>, e.g. "/rb_metrics", readable by every user.
+        // The object is locked while published: it cannot be opened if another publisher holds it
+        explicit SharedSnapshotPublisher(const std::string &name);
+
+        // Unlinks the object: readers which have it mapped keep the last metrics
+        ~SharedSnapshotPublisher();
+
+        SharedSnapshotPublisher(const SharedSnapshotPublisher &) = delete;
+        SharedSnapshotPublisher &operator=(const SharedSnapshotPublisher &) = delete;
+
+        // Copies <metrics> into the segment under the seqlock
+        void Publish(const Metrics &metrics);
+
+        bool IsOpen() const { return m_segment != nullptr; }
+
+    private:
+        std::string m_name;                            // Name of the object
+        int m_fd;                                      // Object, kept open for its lock, -1 if not held
+        shm::SharedSegment *m_segment;                 // Mapped segment, nullptr if it could not be created
+        std::unique_ptr<shm::SharedMetrics> m_staging; // Filled first, so the seqlock is held for a copy only
+    };
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef RB_SHM_SNAPSHOT
+#define RB_SHM_SNAPSHOT
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+Shared memory layout of the metrics published every tick, native byte order, version 2:
+
+    SharedSegment   u32 magic "RBSH" u32 version u32 size u32 reserved
+                    u64 sequence, on a cache line of its own
+                    SharedMetrics
+
+The sequence is a seqlock: the publisher makes it odd, copies the metrics in and makes it even again, so
+a reader which sees the same even sequence before and after its copy has a consistent view. Readers only
+map the segment and copy: no system call, no lock, and nothing they do can hold the publisher up.
+Sequence 0 means nothing was published yet. Every array has a fixed capacity; what does not fit is left
+out and the count is clamped
+*/
+namespace system_metrics
+{
+    namespace shm
+    {
+        const uint32_t kMagic = 0x48534252; // "RBSH"
+        const uint32_t kVersion = 2;
+        const size_t kMaxCores = 256;
+        const size_t kMaxDisks = 32;
+        const size_t kMaxNamespaces = 16;
+        const size_t kMaxTargets = 64;
+        const size_t kNameSize = 32;    // Disk names, '\0'-terminated
+        const size_t kCgroupSize = 128; // Cgroup paths, '\0'-terminated, truncated if longer
+
+        // Metrics of a block device
+        struct SharedDisk
+        {
+            char name[kNameSize];
+            uint64_t read_kbps;
+            uint64_t write_kbps;
+            uint64_t read_iops;
+            uint64_t write_iops;
+            double read_latency_ms;
+            double write_latency_ms;
+            double queue_depth;
+            double utilization; // %
+        };
+
+        // Metrics of a network namespace of the monitored processes
+        struct SharedNamespace
+        {
+            uint64_t inode; // Inode of /proc/[pid]/ns/net
+            uint32_t own;   // 1 for the namespace of the sampler
+            uint32_t reserved;
+            uint64_t net_read_kbps;
+            uint64_t net_write_kbps;
+        };
+
+        // Metrics of a monitored target
+        struct SharedTarget
+        {
+            uint32_t pid;   // Root process, 0 for a cgroup
+            uint32_t cpu;   // %
+            uint32_t ram;   // %
+            uint32_t ram_m; // Megabytes
+            uint64_t net_read_kbps;
+            uint64_t net_write_kbps;
+            uint64_t io_read_kbps;
+            uint64_t io_write_kbps;
+            uint64_t forks;
+            uint64_t exits;
+            uint64_t rss_kb;
+            uint64_t pss_kb;
+            uint64_t uss_kb;
+            uint64_t anon_kb;
+            uint64_t file_kb;
+            uint64_t swap_kb;
+            char cgroup[kCgroupSize]; // Empty for a process
+        };
+
+        // Metrics of a tick
+        struct SharedMetrics
+        {
+            uint64_t timestamp_ns; // CLOCK_MONOTONIC time of publication, for readers to tell how fresh it is
+            uint64_t elapsed_ns;   // Measured time between the snapshots
+            uint64_t collect_ns;   // Time the sample took to collect
+            uint64_t missed;       // Periods skipped before the sample
+            uint32_t cpu;          // System-wide cpu usage, %
+            uint32_t ram;          // System-wide ram usage, %
+            uint32_t ram_m;        // System-wide ram in use, megabytes
+            uint32_t cores;        // Entries of core_busy
+            uint64_t net_read_kbps;
+            uint64_t net_write_kbps;
+            uint64_t io_read_kbps;
+            uint64_t io_write_kbps;
+            float core_busy[kMaxCores]; // Usage of every online core, %
+            uint32_t disks;             // Entries of disk
+            uint32_t namespaces;        // Entries of netns
+            uint32_t targets;           // Entries of target
+            uint32_t reserved;
+            SharedDisk disk[kMaxDisks];
+            SharedNamespace netns[kMaxNamespaces];
+            SharedTarget target[kMaxTargets];
+        };
+
+        struct SharedSegment
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t size; // sizeof(SharedSegment) of the publisher
+            uint32_t reserved;
+            alignas(64) std::atomic<uint64_t> sequence;
+            alignas(64) SharedMetrics metrics;
+        };
+
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the sequence must be lock-free to be shared between processes");
+    }
+
+    // Maps the metrics published by a SharedSnapshotPublisher of another process. Reading copies them out
+    // under the seqlock, with no system call and no lock. Any number of readers cost the publisher nothing
+    class SharedSnapshotReader
+    {
+    public:
+        // Maps the POSIX shared memory object <name>, e.g. "/rb_metrics", read-only
+        explicit SharedSnapshotReader(const std::string &name);
+        ~SharedSnapshotReader();
+
+        SharedSnapshotReader(const SharedSnapshotReader &) = delete;
+        SharedSnapshotReader &operator=(const SharedSnapshotReader &) = delete;
+
+        // Returns true if the segment is mapped and its layout is the one of this reader
+        bool IsOpen() const { return m_segment != nullptr; }
+
+        // Copies the metrics published last into <metrics>. Returns false if nothing was published yet, or if
+        // no consistent copy could be made in <attempts> tries: the publisher died within a publication.
+        // Only a reader which finds a publication in progress for long yields the cpu, a system call
+        bool Read(shm::SharedMetrics &metrics, unsigned attempts = 1000) const;
+
+        // Returns the number of publications so far
+        uint64_t Publications() const;
+
+    private:
+        const shm::SharedSegment *m_segment; // Mapped segment, nullptr if it could not be mapped
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef RB_SOCK_DIAG
+#define RB_SOCK_DIAG
+
+#include <vector>
+#include <cstdint>
+
+namespace system_metrics
+{
+    // Byte counters of a TCP socket, out of struct tcp_info
+    struct SocketBytes
+    {
+        uint64_t inode = 0;    // Inode of the socket, as in the socket:[inode] links of /proc/[pid]/fd
+        uint64_t received = 0; // Bytes received, tcpi_bytes_received
+        uint64_t sent = 0;     // Bytes sent and acknowledged by the peer, tcpi_bytes_acked
+    };
+
+    // Dumps the TCP sockets of the network namespace over NETLINK_SOCK_DIAG: one batched dump per
+    // address family returns the tcp_info of every socket, however many there are.
+    // Byte counters need Linux 4.1, UDP sockets have none and are not dumped
+    class SockDiagClient
+    {
+    public:
+        SockDiagClient();
+        ~SockDiagClient();
+
+        SockDiagClient(const SockDiagClient &) = delete;
+        SockDiagClient &operator=(const SockDiagClient &) = delete;
+
+        // Dumps every IPv4 and IPv6 TCP socket with data into <sockets>, sorted by inode.
+        // Returns false if a dump failed
+        bool Dump(std::vector<SocketBytes> &sockets);
+
+        // Returns true if the sock_diag socket is open and dumps may be made
+        bool IsOpen() const { return m_fd >= 0; }
+
+    private:
+        // Appends the TCP sockets of <family> to <sockets>
+        bool dump(uint8_t family, std::vector<SocketBytes> &sockets);
+
+        int m_fd;                   // NETLINK_SOCK_DIAG socket, -1 if it cannot be opened
+        uint32_t m_sequence;        // Sequence number of the last request
+        std::vector<char> m_buffer; // Reply buffer, reused
+    };
+
+    // Appends to <inodes> the sockets open by the process <pid>, out of the links of /proc/[pid]/fd.
+    // Returns false if the descriptors cannot be listed: the process is gone or belongs to another user
+    bool ReadSocketInodes(uint32_t pid, std::vector<uint64_t> &inodes);
+
+    // Returns the number of descriptors open by the process <pid>, from the size of /proc/[pid]/fd.
+    // Kernels before 6.2 report no size: 0 then, as for a process which cannot be read
+    uint32_t CountDescriptors(uint32_t pid);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef RB_SYSTEM_METRICS
+#define RB_SYSTEM_METRICS
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <utility>
+
+// Common functions
+namespace system_metrics
+{
+    // Returns the list of system's active network interfaces
+    std::vector<std::string> GetActiveNetInterfaces();
+
+    // Returns current total CPU times
+    uint32_t GetCpuSnapshot(unsigned int pid = 0);
+
+    // Returns system-wide cpu times (busy, total)
+    std::pair<uint64_t, uint64_t> GetCpuTimes();
+
+    // Returns total amount of RAM
+    uint32_t GetRamTotal();
+
+    // Returns amount of available RAM
+    unsigned long long GetRamAvailable();
+
+    // Returns amount occupied of RAM
+    uint32_t GetRamOccupied(unsigned int pid = 0);
+
+    // Returns network using satistics (read, write) in kb
+    std::pair<uint64_t, uint64_t> ParseNetData(unsigned int pid = 0);
+
+    // Returns block devices using satistics (read, write) in kb
+    std::pair<uint64_t, uint64_t> ParseIoStats(unsigned int pid = 0);
+
+    // Returns block device's sector size
+    uint32_t GetBlockDeviceSectorSize(std::string block_device);
+
+    // Returns all direct children of the provided pid
+    std::vector<uint32_t> GetChildren(uint32_t pid);
+
+    // Returns current CLOCK_MONOTONIC time in nanoseconds
+    uint64_t MonotonicNs();
+}
+
+#endif
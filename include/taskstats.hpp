@@ -0,0 +1,65 @@
+#ifndef RB_TASKSTATS
+#define RB_TASKSTATS
+
+#include <vector>
+#include <cstdint>
+
+namespace system_metrics
+{
+    // Accounting of a task or a thread group, out of struct taskstats
+    struct TaskCounters
+    {
+        uint64_t cpu_us = 0;      // User + system cpu time, in microseconds
+        uint64_t coremem = 0;     // Integral of RSS over cpu time, in megabyte-microseconds
+        uint64_t hiwater_rss = 0; // Peak RSS, in kilobytes
+        uint64_t read_char = 0;   // Characters read
+        uint64_t write_char = 0;  // Characters written
+        uint64_t read_bytes = 0;  // Bytes read from storage
+        uint64_t write_bytes = 0; // Bytes written to storage
+    };
+
+    // Queries the kernel taskstats interface over generic netlink: one request and one binary reply
+    // per process instead of reading and parsing /proc/[pid]/stat and /proc/[pid]/io.
+    // TASKSTATS_CMD_GET needs CAP_NET_ADMIN and a kernel built with CONFIG_TASKSTATS.
+    class TaskstatsClient
+    {
+    public:
+        // Which id a query is made by
+        enum Mode
+        {
+            PER_TGID, // The whole thread group: live and exited threads of the process
+            PER_PID   // A single thread
+        };
+
+        explicit TaskstatsClient(Mode mode = PER_TGID);
+        ~TaskstatsClient();
+
+        TaskstatsClient(const TaskstatsClient &) = delete;
+        TaskstatsClient &operator=(const TaskstatsClient &) = delete;
+
+        // Reads the accounting of <pid>. Returns false if the process is gone or the query failed
+        bool Query(uint32_t pid, TaskCounters &counters);
+
+        // Returns true if the taskstats family was resolved and queries may be made
+        bool IsOpen() const { return m_fd >= 0; }
+
+        Mode GetMode() const { return m_mode; }
+
+    private:
+        // Opens the generic netlink socket and resolves the id of the TASKSTATS family
+        bool open();
+
+        // Sends the <size> bytes of m_request and receives the reply into m_buffer.
+        // Returns the size of the reply, -1 on error
+        int exchange(uint32_t size);
+
+        int m_fd;                    // Generic netlink socket, -1 if taskstats is not available
+        uint16_t m_family;           // Id of the TASKSTATS family
+        Mode m_mode;                 // Query by tgid or by pid
+        uint32_t m_sequence;         // Sequence number of the last request
+        std::vector<char> m_request; // Request buffer, reused
+        std::vector<char> m_buffer;  // Reply buffer, reused
+    };
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef RB_TOP_PROCESSES
+#define RB_TOP_PROCESSES
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <dirent.h>
+#include <sys/types.h>
+
+#include "process_table.hpp"
+
+namespace system_metrics
+{
+    // Metrics processes are ranked by
+    enum TopMetric
+    {
+        TOP_CPU, // Cpu time within the period
+        TOP_RSS, // Resident set size
+        TOP_IO,  // Characters read and written within the period
+        TOP_METRICS
+    };
+
+    // Returns the name of <metric> as used in labels, e.g. "cpu"
+    const char *TopMetricName(TopMetric metric);
+
+    // A process of a ranking
+    struct TopProcess
+    {
+        uint32_t pid = 0;
+        char comm[16] = {};                     // Name of the executable, '\0'-terminated
+        double cpu = 0;                         // % of one cpu, as top(1) shows it
+        uint64_t rss = 0;                       // Kilobytes
+        std::pair<uint64_t, uint64_t> io{0, 0}; // Kilobytes per second (read, write)
+    };
+
+    // Ranks every process of the system by cpu, RSS and io. Each Update() walks /proc once, reading the
+    // stat and io of every process, keeps their counters in a ProcessTable for the deltas of the next one
+    // and selects the top N of every metric without sorting the rest. A walk costs time linear in the
+    // number of processes and allocates nothing once the table has room for them
+    class TopProcesses
+    {
+    public:
+        // Ranks the <count> processes at the top of every metric
+        explicit TopProcesses(size_t count);
+        ~TopProcesses();
+
+        TopProcesses(const TopProcesses &) = delete;
+        TopProcesses &operator=(const TopProcesses &) = delete;
+
+        // Walks /proc and ranks the processes by what they did since the previous walk.
+        // Processes seen for the first time have no rates yet
+        void Update();
+
+        // Returns the processes at the top of <metric>, highest first, as of the last Update()
+        const std::vector<TopProcess> &Top(TopMetric metric) const { return m_top[metric]; }
+
+        // Returns the number of processes the last Update() saw
+        size_t Processes() const { return m_table.Size(); }
+
+        // Returns the number of processes at the top of every metric
+        size_t Count() const { return m_count; }
+
+        // Returns the time the last Update() measured since the one before
+        uint64_t ElapsedNs() const { return m_elapsed_ns; }
+
+    private:
+        // Reads the stat and io of <pid> into the table. Returns false if the process is gone
+        bool readProcess(uint32_t pid);
+
+        // Reads /proc/<pid>/<name> into m_buffer with a single pread. Returns the size read, -1 on error
+        ssize_t readFile(uint32_t pid, const char *name);
+
+        // Selects the top of <metric> out of m_order into m_top
+        void rank(TopMetric metric);
+
+        size_t m_count;                                       // Processes at the top of every metric
+        DIR *m_proc;                                          // /proc, rewound for every walk, nullptr if it cannot be opened
+        ProcessTable m_table;                                 // Every process seen by the last walk
+        uint64_t m_generation;                                // Walks so far
+        uint64_t m_last_ns;                                   // CLOCK_MONOTONIC time of the last walk
+        uint64_t m_elapsed_ns;                                // Time between the last two walks
+        std::vector<char> m_buffer;                           // Read buffer, reused
+        std::vector<const ProcessState *> m_order;            // Every process of the table, partially ordered by rank()
+        std::array<std::vector<TopProcess>, TOP_METRICS> m_top; // Top of every metric
+    };
+}
+
+#endif
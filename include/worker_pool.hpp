@@ -0,0 +1,121 @@
+#ifndef RB_WORKER_POOL
+#define RB_WORKER_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "self_stats.hpp"
+
+namespace system_metrics
+{
+    // Fixed set of threads which run a loop over an index range together. The range is split evenly
+    // between the workers; a worker takes small chunks off the front of its own part and, once it is
+    // done, steals the back half of the busiest-looking other part, so that slow items (a process with
+    // thousands of descriptors, a large smaps_rollup) do not hold the others up.
+    // The calling thread is worker 0, a pool of one worker has no thread at all. Running a loop does
+    // not allocate
+    class WorkerPool
+    {
+    public:
+        // Starts <workers> - 1 threads, at least one worker is kept
+        explicit WorkerPool(size_t workers);
+
+        // Stops and joins the threads
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        // Returns the number of workers, the calling thread included
+        size_t Workers() const { return m_ranges.size(); }
+
+        // Calls <func>(worker, begin, end) for disjoint [begin, end) ranges covering [0, <count>) and
+        // returns once every index is done. <worker> is below Workers(): per-worker buffers may be indexed
+        // by it without locking. The work counters of the threads are added to those of the caller
+        template <typename Func>
+        void ForEach(size_t count, Func &func)
+        {
+            run(count, &call<Func>, &func);
+        }
+
+    private:
+        typedef void (*Task)(void *context, size_t worker, size_t begin, size_t end);
+
+        template <typename Func>
+        static void call(void *context, size_t worker, size_t begin, size_t end)
+        {
+            (*static_cast<Func *>(context))(worker, begin, end);
+        }
+
+        // Part of the range left to a worker, [begin, end) packed as begin << 32 | end, on a cache line of its own
+        struct alignas(64) Range
+        {
+            std::atomic<uint64_t> bounds{0};
+            WorkCounters work;   // Work of the worker's thread during the last loop
+            uint64_t cpu_ns = 0; // Cpu time of the worker's thread during the last loop
+        };
+
+        // Allocator which honours the alignment of T: the operator new of C++14 ignores any above 16 bytes
+        template <typename T>
+        struct AlignedAllocator
+        {
+            typedef T value_type;
+
+            AlignedAllocator() = default;
+            template <typename U>
+            AlignedAllocator(const AlignedAllocator<U> &) {}
+
+            T *allocate(size_t count)
+            {
+                void *memory = nullptr;
+                if (posix_memalign(&memory, alignof(T), count * sizeof(T)) != 0)
+                    throw std::bad_alloc();
+                return static_cast<T *>(memory);
+            }
+
+            void deallocate(T *memory, size_t) { free(memory); }
+
+            template <typename U>
+            bool operator==(const AlignedAllocator<U> &) const { return true; }
+            template <typename U>
+            bool operator!=(const AlignedAllocator<U> &) const { return false; }
+        };
+
+        // Splits [0, <count>) between the workers, wakes the threads and works as worker 0
+        void run(size_t count, Task task, void *context);
+
+        // Runs chunks of the own range of <worker>, then of the others' until none is left
+        void work(size_t worker);
+
+        // Takes a chunk off the front of the range of <worker> into [<begin>, <end>). Returns false if it is empty
+        bool take(size_t worker, uint64_t &begin, uint64_t &end);
+
+        // Moves the back half of the largest range of another worker to the range of <worker>.
+        // Returns false if every range is empty
+        bool steal(size_t worker);
+
+        // Body of the thread of <worker>
+        void loop(size_t worker);
+
+        std::vector<Range, AlignedAllocator<Range>> m_ranges; // Range of every worker
+        std::vector<std::thread> m_threads;                   // Threads of workers 1 and up
+
+        std::mutex m_mutex;             // Guards everything below
+        std::condition_variable m_wake; // Signalled when a loop starts or the pool stops
+        std::condition_variable m_done; // Signalled when the last thread is done with a loop
+        uint64_t m_generation;          // Loops started so far
+        size_t m_pending;               // Threads still running the current loop
+        bool m_stop;                    // True once the pool is being destroyed
+        Task m_task;                    // Function of the current loop
+        void *m_context;                // Its argument
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "block_devices.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+    // Major numbers of devices with no I/O of their own (Documentation/admin-guide/devices.txt)
+    const uint32_t kRamMajor = 1;
+    const uint32_t kLoopMajor = 7;
+
+    // Returns true if <name> starts with <prefix>
+    bool HasPrefix(const char *name, size_t size, const char *prefix)
+    {
+        size_t prefix_size = strlen(prefix);
+        return size >= prefix_size && memcmp(name, prefix, prefix_size) == 0;
+    }
+}
+
+namespace system_metrics
+{
+    BlockDevices::BlockDevices() : m_diskstats("/proc/diskstats", 8192)
+    {
+    }
+
+    bool BlockDevices::counted(uint32_t major, uint32_t minor, const char *name, size_t size)
+    {
+        auto less = [](const Device &device, std::pair<uint32_t, uint32_t> number)
+        { return std::make_pair(device.major, device.minor) < number; };
+        auto number = std::make_pair(major, minor);
+        auto it = std::lower_bound(m_devices.begin(), m_devices.end(), number, less);
+        if (it != m_devices.end() && it->major == major && it->minor == minor)
+        {
+            return it->counted;
+        }
+
+        // zram has a dynamic major number: ram-backed devices are recognized by name as well
+        bool counted = major != kRamMajor && major != kLoopMajor && !HasPrefix(name, size, "loop") &&
+                       !HasPrefix(name, size, "ram") && !HasPrefix(name, size, "zram");
+        if (counted)
+        {
+            // The I/O of a partition is counted by its disk too
+            std::string path = "/sys/dev/block/" + std::to_string(major) + ":" + std::to_string(minor) + "/partition";
+            counted = access(path.c_str(), F_OK) != 0;
+        }
+        m_devices.insert(it, Device{major, minor, counted});
+        return counted;
+    }
+
+    bool BlockDevices::Read(std::vector<DiskSnapshot> &disks)
+    {
+        disks.clear();
+        if (!m_diskstats.Read())
+        {
+            return false;
+        }
+
+        proc_parser::ForEachDiskstat(
+            m_diskstats.Data(), m_diskstats.Size(),
+            [&](const char *name, size_t size, const proc_parser::DiskCounters &counters)
+            {
+                if (!counted(counters.major, counters.minor, name, size))
+                    return;
+                disks.emplace_back();
+                disks.back().name.assign(name, size);
+                disks.back().counters = counters;
+            });
+        return true;
+    }
+}
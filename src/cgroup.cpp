@@ -0,0 +1,205 @@
+#include "cgroup.hpp"
+#include "proc_parser.hpp"
+
+#include <cstring>
+
+namespace
+{
+    using system_metrics::proc_parser::NextLine;
+    using system_metrics::proc_parser::ParseU64;
+    using system_metrics::proc_parser::SkipSpaces;
+
+    // Key of a flat keyed cgroup file ("key value" lines) and the counter it is parsed into
+    struct Key
+    {
+        const char *name; // Key with its trailing space, so "anon " does not match "anon_thp"
+        size_t size;
+        uint64_t system_metrics::CgroupCounters::*field;
+    };
+
+    // Parses the <keys> of a flat keyed file into <counters>
+    template <size_t N>
+    void ParseFlatKeyed(const char *data, size_t size, const Key (&keys)[N], system_metrics::CgroupCounters &counters)
+    {
+        const char *p = data;
+        const char *end = data + size;
+        size_t found = 0;
+        while (p < end && found < N)
+        {
+            for (const auto &key : keys)
+            {
+                if (static_cast<size_t>(end - p) >= key.size && memcmp(p, key.name, key.size) == 0)
+                {
+                    p += key.size;
+                    counters.*key.field = ParseU64(p, end);
+                    ++found;
+                    break;
+                }
+            }
+            p = NextLine(p, end);
+        }
+    }
+
+    // Parses io.stat, summing the bytes of every device
+    void ParseIoStat(const char *data, size_t size, system_metrics::CgroupCounters &counters)
+    {
+        /*
+        io.stat
+            8:16 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0
+            8:0 rbytes=90430464 wbytes=299008000 rios=8950 wios=1252 dbytes=50331648 dios=3021
+        */
+        const char *p = data;
+        const char *end = data + size;
+        while (p < end)
+        {
+            // Skip the device number
+            while (p < end && *p != ' ' && *p != '\n')
+                ++p;
+            while (p < end && *p != '\n')
+            {
+                p = SkipSpaces(p, end);
+                if (end - p > 7 && memcmp(p, "rbytes=", 7) == 0)
+                {
+                    p += 7;
+                    counters.rbytes += ParseU64(p, end);
+                }
+                else if (end - p > 7 && memcmp(p, "wbytes=", 7) == 0)
+                {
+                    p += 7;
+                    counters.wbytes += ParseU64(p, end);
+                }
+                else
+                {
+                    while (p < end && *p != ' ' && *p != '\n')
+                        ++p;
+                }
+            }
+            p = NextLine(p, end);
+        }
+    }
+
+    // Returns the cgroup2 mount point out of /proc/self/mountinfo
+    std::string FindMountPoint()
+    {
+        /*
+        /proc/self/mountinfo
+            30 24 0:26 / /sys/fs/cgroup rw,nosuid,nodev,noexec,relatime shared:4 - cgroup2 cgroup2 rw,nsdelegate
+
+        On hybrid hierarchies it is usually /sys/fs/cgroup/unified
+        */
+        system_metrics::ProcFile file("/proc/self/mountinfo", 16384);
+        if (file.Read())
+        {
+            const char *p = file.Data();
+            const char *end = p + file.Size();
+            while (p < end)
+            {
+                const char *line_end = NextLine(p, end);
+                const char *type = static_cast<const char *>(memmem(p, line_end - p, " - cgroup2 ", 11));
+                if (type != nullptr)
+                {
+                    // The mount point is the fifth field
+                    const char *point = system_metrics::proc_parser::SkipFields(p, type, 4);
+                    point = SkipSpaces(point, type);
+                    const char *point_end = point;
+                    while (point_end < type && *point_end != ' ')
+                        ++point_end;
+                    return std::string(point, point_end);
+                }
+                p = line_end;
+            }
+        }
+        return "/sys/fs/cgroup";
+    }
+}
+
+namespace system_metrics
+{
+    const std::string &CgroupMountPoint()
+    {
+        static const std::string mount_point = FindMountPoint();
+        return mount_point;
+    }
+
+    std::string CgroupDirectory(const std::string &path)
+    {
+        const std::string &mount_point = CgroupMountPoint();
+        if (path.compare(0, mount_point.size(), mount_point) == 0 &&
+            (path.size() == mount_point.size() || path[mount_point.size()] == '/'))
+        {
+            return path;
+        }
+        // "/system.slice/ssh.service" as in /proc/[pid]/cgroup, or "system.slice/ssh.service"
+        size_t start = path.find_first_not_of('/');
+        if (start == std::string::npos)
+        {
+            return mount_point;
+        }
+        return mount_point + "/" + path.substr(start);
+    }
+
+    CgroupReader::CgroupReader(const std::string &path)
+        : m_path(CgroupDirectory(path)),
+          m_cpu(m_path + "/cpu.stat", 1024),
+          m_current(m_path + "/memory.current", 64),
+          m_memory(m_path + "/memory.stat", 4096),
+          m_io(m_path + "/io.stat", 1024)
+    {
+    }
+
+    bool CgroupReader::Read(CgroupCounters &counters)
+    {
+        counters = CgroupCounters();
+
+        // cpu.stat exists in every cgroup, whatever controllers are enabled
+        if (!m_cpu.Read())
+        {
+            return false;
+        }
+
+        /*
+        cpu.stat
+            usage_usec 92297568
+            user_usec 77650671
+            system_usec 14646896
+                ...
+        */
+        static const Key cpu_keys[] = {
+            {"usage_usec ", 11, &CgroupCounters::usage_usec},
+            {"user_usec ", 10, &CgroupCounters::user_usec},
+            {"system_usec ", 12, &CgroupCounters::system_usec},
+        };
+        ParseFlatKeyed(m_cpu.Data(), m_cpu.Size(), cpu_keys, counters);
+
+        if (m_current.Read())
+        {
+            const char *p = m_current.Data();
+            counters.memory_current = proc_parser::ParseU64(p, p + m_current.Size());
+        }
+
+        /*
+        memory.stat
+            anon 1230848000
+            file 3011891200
+            kernel 125362176
+                ...
+            file_mapped 411172864
+                ...
+        */
+        static const Key memory_keys[] = {
+            {"anon ", 5, &CgroupCounters::anon},
+            {"file ", 5, &CgroupCounters::file},
+            {"file_mapped ", 12, &CgroupCounters::file_mapped},
+        };
+        if (m_memory.Read())
+        {
+            ParseFlatKeyed(m_memory.Data(), m_memory.Size(), memory_keys, counters);
+        }
+
+        if (m_io.Read())
+        {
+            ParseIoStat(m_io.Data(), m_io.Size(), counters);
+        }
+        return true;
+    }
+}
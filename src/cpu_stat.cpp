@@ -0,0 +1,126 @@
+#include "cpu_stat.hpp"
+#include "proc_parser.hpp"
+
+#include <cstring>
+
+namespace system_metrics
+{
+    bool CpuStatMatrix::Parse(const char *data, size_t size)
+    {
+        /*
+        /proc/stat
+            cpu  10132153 290696 3084719 46828483 16683 0 25195 0 175628 0
+            cpu0 1393280 32966 572056 13343292 6130 0 17875 0 23933 0
+            cpu1 ...
+            intr ...
+
+        The cpu lines come first; offline cpus have no line, so the numbers may have gaps.
+        Kernels older than 2.6.33 have fewer columns, the missing ones are 0.
+        */
+        m_counters.clear();
+        m_ids.clear();
+
+        const char *p = data;
+        const char *end = data + size;
+        while (end - p > 3 && memcmp(p, "cpu", 3) == 0)
+        {
+            p += 3;
+            int id = -1;
+            if (p < end && *p >= '0' && *p <= '9')
+            {
+                id = static_cast<int>(proc_parser::ParseU64(p, end));
+            }
+            else if (!m_ids.empty())
+            {
+                break;
+            }
+
+            m_ids.push_back(id);
+            for (int state = 0; state < CPU_STATES; state++)
+            {
+                m_counters.push_back(proc_parser::ParseU64(p, end));
+            }
+            p = proc_parser::NextLine(p, end);
+        }
+        return !m_ids.empty() && m_ids[0] == -1;
+    }
+
+    void CpuStatMatrix::Resize(size_t rows)
+    {
+        m_counters.resize(rows * CPU_STATES, 0);
+        m_ids.resize(rows, -1);
+    }
+
+    uint64_t CpuStatMatrix::Busy(size_t row) const
+    {
+        return Total(row) - At(row, CPU_IDLE) - At(row, CPU_IOWAIT);
+    }
+
+    uint64_t CpuStatMatrix::Total(size_t row) const
+    {
+        const uint64_t *counters = &m_counters[row * CPU_STATES];
+        uint64_t result = 0;
+        for (int state = 0; state < CPU_GUEST; state++)
+        {
+            result += counters[state];
+        }
+        return result;
+    }
+
+    void CpuUsage::Compute(const CpuStatMatrix &prev, const CpuStatMatrix &curr)
+    {
+        const size_t rows = curr.Rows();
+        const size_t cells = rows * CPU_STATES;
+        m_ids.resize(rows);
+        m_percent.assign(cells, 0.0f);
+        m_busy.assign(rows, 0.0f);
+        m_scale.assign(rows, 0.0f);
+        for (size_t row = 0; row < rows; row++)
+        {
+            m_ids[row] = curr.Id(row);
+        }
+
+        bool same_cores = prev.Rows() == rows;
+        for (size_t row = 0; same_cores && row < rows; row++)
+        {
+            same_cores = prev.Id(row) == curr.Id(row);
+        }
+        if (!same_cores)
+        {
+            return;
+        }
+
+        // Deltas of the whole matrix: a plain loop over contiguous memory the compiler can vectorize.
+        // A counter going backwards (e.g. a core back online) counts as 0
+        const uint64_t *before = prev.Data();
+        const uint64_t *after = curr.Data();
+        float *percent = m_percent.data();
+        for (size_t i = 0; i < cells; i++)
+        {
+            percent[i] = after[i] >= before[i] ? static_cast<float>(after[i] - before[i]) : 0.0f;
+        }
+
+        // Guest time is already a part of user and nice time
+        for (size_t row = 0; row < rows; row++)
+        {
+            const float *delta = percent + row * CPU_STATES;
+            float total = 0.0f;
+            for (int state = 0; state < CPU_GUEST; state++)
+            {
+                total += delta[state];
+            }
+            m_scale[row] = total > 0.0f ? 100.0f / total : 0.0f;
+        }
+
+        for (size_t row = 0; row < rows; row++)
+        {
+            float *shares = percent + row * CPU_STATES;
+            const float scale = m_scale[row];
+            for (int state = 0; state < CPU_STATES; state++)
+            {
+                shares[state] *= scale;
+            }
+            m_busy[row] = scale > 0.0f ? 100.0f - shares[CPU_IDLE] - shares[CPU_IOWAIT] : 0.0f;
+        }
+    }
+}
@@ -0,0 +1,232 @@
+#include "event_loop.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace
+{
+    // epoll data of the wake up eventfd and of the signalfd; subscriptions start from 1
+    const uint64_t kWakeUp = 0;
+    const uint64_t kSignal = UINT64_MAX;
+}
+
+namespace system_metrics
+{
+    EventLoop::EventLoop() : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+                             m_wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                             m_signal_fd(-1),
+                             m_stop(false),
+                             m_next(0)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = kWakeUp;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &event);
+    }
+
+    EventLoop::~EventLoop()
+    {
+        Stop();
+        for (auto &entry : m_monitors)
+        {
+            close(entry.second.timer_fd);
+        }
+        if (m_signal_fd >= 0)
+            close(m_signal_fd);
+        close(m_wake_fd);
+        close(m_epoll_fd);
+    }
+
+    void EventLoop::post(std::function<void()> command)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_commands.push_back(std::move(command));
+        }
+        uint64_t one = 1;
+        write(m_wake_fd, &one, sizeof(one));
+    }
+
+    void EventLoop::runCommands()
+    {
+        uint64_t count;
+        read(m_wake_fd, &count, sizeof(count));
+
+        std::vector<std::function<void()>> commands;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            commands.swap(m_commands);
+        }
+        for (auto &command : commands)
+        {
+            command();
+        }
+    }
+
+    EventLoop::Subscription EventLoop::Subscribe(std::shared_ptr<Rb_sampler> sampler, Callback callback)
+    {
+        Subscription subscription = ++m_next;
+        auto period = sampler->Period();
+        post([this, subscription, sampler, callback, period]()
+             {
+                 int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                 if (fd < 0)
+                     return;
+
+                 // The timer is periodic: the kernel keeps the phase, collection time never accumulates
+                 itimerspec spec{};
+                 spec.it_interval.tv_sec = period.count() / 1000;
+                 spec.it_interval.tv_nsec = period.count() % 1000 * 1000000;
+                 spec.it_value = spec.it_interval;
+                 timerfd_settime(fd, 0, &spec, nullptr);
+
+                 epoll_event event{};
+                 event.events = EPOLLIN;
+                 event.data.u64 = subscription;
+                 epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+                 m_monitors[subscription] = Monitor{sampler, callback, fd, {}};
+             });
+        return subscription;
+    }
+
+    std::future<Metrics> EventLoop::Next(Subscription subscription)
+    {
+        auto promise = std::make_shared<std::promise<Metrics>>();
+        auto future = promise->get_future();
+        // An unknown subscription drops the promise, which breaks the future
+        post([this, subscription, promise]()
+             {
+                 auto it = m_monitors.find(subscription);
+                 if (it != m_monitors.end())
+                     it->second.waiting.push_back(promise);
+             });
+        return future;
+    }
+
+    void EventLoop::Unsubscribe(Subscription subscription)
+    {
+        post([this, subscription]()
+             {
+                 auto it = m_monitors.find(subscription);
+                 if (it == m_monitors.end())
+                     return;
+                 epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, it->second.timer_fd, nullptr);
+                 close(it->second.timer_fd);
+                 m_monitors.erase(it);
+             });
+    }
+
+    void EventLoop::tick(Subscription subscription)
+    {
+        auto it = m_monitors.find(subscription);
+        if (it == m_monitors.end())
+        {
+            return;
+        }
+
+        // Periods which expired while the loop was busy are merged into one sample and reported as missed
+        uint64_t expirations;
+        if (read(it->second.timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            return;
+        }
+
+        Metrics metrics = it->second.sampler->Collect(expirations - 1);
+        // The callback may unsubscribe: take what is needed out of the monitor first
+        auto waiting = std::move(it->second.waiting);
+        it->second.waiting.clear();
+        Callback callback = it->second.callback;
+        if (callback)
+        {
+            callback(metrics);
+        }
+        for (auto &promise : waiting)
+        {
+            promise->set_value(metrics);
+        }
+    }
+
+    void EventLoop::stopOnSignal()
+    {
+        signalfd_siginfo info;
+        if (read(m_signal_fd, &info, sizeof(info)) == sizeof(info))
+        {
+            m_stop = true;
+        }
+    }
+
+    void EventLoop::Run()
+    {
+        epoll_event events[16];
+        while (!m_stop)
+        {
+            int count = epoll_wait(m_epoll_fd, events, 16, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (events[i].data.u64 == kWakeUp)
+                    runCommands();
+                else if (events[i].data.u64 == kSignal)
+                    stopOnSignal();
+                else
+                    tick(events[i].data.u64);
+            }
+        }
+    }
+
+    void EventLoop::Start()
+    {
+        if (!m_thread.joinable())
+        {
+            m_stop = false;
+            m_thread = std::thread(&EventLoop::Run, this);
+        }
+    }
+
+    void EventLoop::Stop()
+    {
+        m_stop = true;
+        uint64_t one = 1;
+        write(m_wake_fd, &one, sizeof(one));
+        if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        {
+            m_thread.join();
+        }
+    }
+
+    bool EventLoop::StopOnSignals(std::initializer_list<int> signals)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (int signal : signals)
+        {
+            sigaddset(&mask, signal);
+        }
+        // A blocked signal stays pending until the signalfd reads it instead of running its default action
+        if (m_signal_fd >= 0 || pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0)
+        {
+            return false;
+        }
+        m_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (m_signal_fd < 0)
+        {
+            return false;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = kSignal;
+        return epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_signal_fd, &event) == 0;
+    }
+}
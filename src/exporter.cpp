@@ -0,0 +1,549 @@
+#include "exporter.hpp"
+#include "system_metrics.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t kMaxClients = 64;
+    const size_t kMaxRequest = 4096;
+    const uint64_t kClientTimeoutNs = 5000000000ull; // Time a connection has to send its request and read the response
+
+    const char kNotFound[] = "HTTP/1.1 404 Not Found\r\n"
+                             "Content-Type: text/plain\r\n"
+                             "Content-Length: 10\r\n"
+                             "Connection: close\r\n"
+                             "\r\n"
+                             "Not Found\n";
+
+    const char kNotReady[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                             "Content-Type: text/plain\r\n"
+                             "Content-Length: 19\r\n"
+                             "Connection: close\r\n"
+                             "\r\n"
+                             "No sample taken yet\n";
+
+    void AppendUint(std::string &out, uint64_t value)
+    {
+        char digits[20];
+        size_t size = 0;
+        do
+        {
+            digits[size++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (size > 0)
+            out.push_back(digits[--size]);
+    }
+
+    // Appends <value>, which is not negative, with three decimals
+    void AppendFixed(std::string &out, double value)
+    {
+        uint64_t thousandths = static_cast<uint64_t>(value * 1000 + 0.5);
+        AppendUint(out, thousandths / 1000);
+        out.push_back('.');
+        uint64_t fraction = thousandths % 1000;
+        out.push_back(static_cast<char>('0' + fraction / 100));
+        out.push_back(static_cast<char>('0' + fraction / 10 % 10));
+        out.push_back(static_cast<char>('0' + fraction % 10));
+    }
+
+    void AppendValue(std::string &out, uint64_t value) { AppendUint(out, value); }
+    void AppendValue(std::string &out, double value) { AppendFixed(out, value); }
+
+    // Appends <value> as an OpenMetrics label value: backslash, quote and newline are escaped
+    void AppendLabelValue(std::string &out, const std::string &value)
+    {
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (c == '\n')
+            {
+                out.append("\\n");
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+    }
+
+    void AppendFamily(std::string &out, const char *name, const char *help, const char *type = "gauge")
+    {
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    }
+
+    // Appends the labels of <target>, without braces
+    void AppendTargetLabels(std::string &out, const system_metrics::TargetMetrics &target)
+    {
+        if (target.cgroup.empty())
+        {
+            out.append("pid=\"");
+            AppendUint(out, target.pid);
+        }
+        else
+        {
+            out.append("cgroup=\"");
+            AppendLabelValue(out, target.cgroup);
+        }
+        out.push_back('"');
+    }
+
+    // Appends a histogram per collector of the <histogram> of <self>. The buckets are 1 us to 1 s
+    // by factors of 4, so the set of samples stays the same from scrape to scrape
+    void AppendHistograms(std::string &out, const char *name, const system_metrics::SelfStats &self,
+                          const system_metrics::Histogram &(system_metrics::SelfStats::*histogram)(system_metrics::Collector) const)
+    {
+        using system_metrics::Histogram;
+        for (size_t i = 0; i < system_metrics::COLLECTORS; i++)
+        {
+            auto collector = static_cast<system_metrics::Collector>(i);
+            const Histogram &values = (self.*histogram)(collector);
+            uint64_t cumulative = 0;
+            size_t bucket = 0;
+            for (size_t bound = 10; bound <= 30; bound += 2)
+            {
+                for (; bucket <= bound; bucket++)
+                    cumulative += values.Bucket(bucket);
+                out.append(name).append("_bucket{collector=\"").append(system_metrics::CollectorName(collector));
+                out.append("\",le=\"");
+                AppendUint(out, Histogram::UpperBound(bound));
+                out.append("\"} ");
+                AppendUint(out, cumulative);
+                out.push_back('\n');
+            }
+            out.append(name).append("_bucket{collector=\"").append(system_metrics::CollectorName(collector));
+            out.append("\",le=\"+Inf\"} ");
+            AppendUint(out, values.Count());
+            out.append("\n").append(name).append("_count{collector=\"").append(system_metrics::CollectorName(collector));
+            out.append("\"} ");
+            AppendUint(out, values.Count());
+            out.append("\n").append(name).append("_sum{collector=\"").append(system_metrics::CollectorName(collector));
+            out.append("\"} ");
+            AppendUint(out, values.Sum());
+            out.push_back('\n');
+        }
+    }
+
+    // Appends a counter sample per collector of the work of <self>
+    template <typename Value>
+    void AppendWork(std::string &out, const char *name, const system_metrics::SelfStats &self, Value value)
+    {
+        for (size_t i = 0; i < system_metrics::COLLECTORS; i++)
+        {
+            auto collector = static_cast<system_metrics::Collector>(i);
+            out.append(name).append("_total{collector=\"").append(system_metrics::CollectorName(collector));
+            out.append("\"} ");
+            AppendUint(out, value(self.Work(collector)));
+            out.push_back('\n');
+        }
+    }
+
+    // Appends a sample of a family per target
+    template <typename Value>
+    void AppendTargets(std::string &out, const char *name, const char *extra_labels,
+                       const system_metrics::Metrics &metrics, Value value)
+    {
+        for (const auto &target : metrics.targets)
+        {
+            out.append(name).push_back('{');
+            AppendTargetLabels(out, target);
+            out.append(extra_labels).append("} ");
+            AppendUint(out, value(target));
+            out.push_back('\n');
+        }
+    }
+
+    // Appends a sample of a family per block device
+    template <typename Value>
+    void AppendDisks(std::string &out, const char *name, const char *extra_labels,
+                     const system_metrics::Metrics &metrics, Value value)
+    {
+        for (const auto &disk : metrics.disks)
+        {
+            out.append(name).append("{device=\"");
+            AppendLabelValue(out, disk.name);
+            out.push_back('"');
+            out.append(extra_labels).append("} ");
+            AppendValue(out, value(disk));
+            out.push_back('\n');
+        }
+    }
+}
+
+namespace system_metrics
+{
+    MetricsExporter::MetricsExporter(uint16_t port, const std::string &address)
+        : m_listen_fd(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)),
+          m_wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          m_back(std::make_shared<std::string>()),
+          m_front(std::make_shared<std::string>(kNotReady))
+    {
+        if (m_listen_fd < 0 || m_wake_fd < 0)
+        {
+            if (m_listen_fd >= 0)
+                close(m_listen_fd);
+            m_listen_fd = -1;
+            return;
+        }
+
+        int reuse = 1;
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 ||
+            bind(m_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(m_listen_fd, 16) != 0)
+        {
+            close(m_listen_fd);
+            m_listen_fd = -1;
+            return;
+        }
+        m_thread = std::thread(&MetricsExporter::serve, this);
+    }
+
+    MetricsExporter::~MetricsExporter()
+    {
+        if (m_thread.joinable())
+        {
+            uint64_t one = 1;
+            write(m_wake_fd, &one, sizeof(one));
+            m_thread.join();
+        }
+        if (m_listen_fd >= 0)
+            close(m_listen_fd);
+        if (m_wake_fd >= 0)
+            close(m_wake_fd);
+    }
+
+    void MetricsExporter::render(const Metrics &metrics, const SelfStats *self)
+    {
+        std::string &out = m_body;
+        out.clear();
+
+        AppendFamily(out, "rb_sampler_collect_microseconds", "Time the last sample took to collect.");
+        out.append("rb_sampler_collect_microseconds ");
+        AppendUint(out, metrics.collect_ns / 1000);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_sampler_missed_periods", "Sampling deadlines skipped before the last sample because collection overran.");
+        out.append("rb_sampler_missed_periods ");
+        AppendUint(out, metrics.missed);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_system_cpu_usage_percent", "System-wide cpu usage over the last period.");
+        out.append("rb_system_cpu_usage_percent ");
+        AppendUint(out, metrics.general_cpu);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_system_cpu_core_usage_percent", "Cpu usage of every online core over the last period.");
+        for (size_t row = 1; row < metrics.cpus.Rows(); row++)
+        {
+            out.append("rb_system_cpu_core_usage_percent{cpu=\"");
+            AppendUint(out, metrics.cpus.Id(row));
+            out.append("\"} ");
+            AppendUint(out, static_cast<uint64_t>(metrics.cpus.Busy(row) + 0.5f));
+            out.push_back('\n');
+        }
+
+        AppendFamily(out, "rb_system_ram_usage_percent", "System-wide ram usage.");
+        out.append("rb_system_ram_usage_percent ");
+        AppendUint(out, metrics.general_ram);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_system_ram_used_megabytes", "System-wide ram in use.");
+        out.append("rb_system_ram_used_megabytes ");
+        AppendUint(out, metrics.general_ram_m);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_system_net_kilobytes_per_second", "Traffic of the active network interfaces.");
+        out.append("rb_system_net_kilobytes_per_second{direction=\"read\"} ");
+        AppendUint(out, metrics.general_net.first);
+        out.append("\nrb_system_net_kilobytes_per_second{direction=\"write\"} ");
+        AppendUint(out, metrics.general_net.second);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_netns_kilobytes_per_second", "Traffic of a network namespace monitored processes live in, loopback left out.");
+        for (const auto &ns : metrics.namespaces)
+        {
+            out.append("rb_netns_kilobytes_per_second{netns=\"");
+            AppendUint(out, ns.inode);
+            out.append("\",direction=\"read\"} ");
+            AppendUint(out, ns.net.first);
+            out.append("\nrb_netns_kilobytes_per_second{netns=\"");
+            AppendUint(out, ns.inode);
+            out.append("\",direction=\"write\"} ");
+            AppendUint(out, ns.net.second);
+            out.push_back('\n');
+        }
+
+        AppendFamily(out, "rb_system_io_kilobytes_per_second", "Traffic of the block devices.");
+        out.append("rb_system_io_kilobytes_per_second{direction=\"read\"} ");
+        AppendUint(out, metrics.general_io.first);
+        out.append("\nrb_system_io_kilobytes_per_second{direction=\"write\"} ");
+        AppendUint(out, metrics.general_io.second);
+        out.push_back('\n');
+
+        AppendFamily(out, "rb_disk_kilobytes_per_second", "Traffic of a block device.");
+        AppendDisks(out, "rb_disk_kilobytes_per_second", ",direction=\"read\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.kbps.first; });
+        AppendDisks(out, "rb_disk_kilobytes_per_second", ",direction=\"write\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.kbps.second; });
+
+        AppendFamily(out, "rb_disk_operations_per_second", "Completed I/Os of a block device.");
+        AppendDisks(out, "rb_disk_operations_per_second", ",direction=\"read\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.iops.first; });
+        AppendDisks(out, "rb_disk_operations_per_second", ",direction=\"write\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.iops.second; });
+
+        AppendFamily(out, "rb_disk_latency_milliseconds", "Average time an I/O of a block device took over the last period.");
+        AppendDisks(out, "rb_disk_latency_milliseconds", ",direction=\"read\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.latency_ms.first; });
+        AppendDisks(out, "rb_disk_latency_milliseconds", ",direction=\"write\"", metrics,
+                    [](const DiskMetrics &disk) { return disk.latency_ms.second; });
+
+        AppendFamily(out, "rb_disk_queue_depth", "Average number of I/Os in progress on a block device.");
+        AppendDisks(out, "rb_disk_queue_depth", "", metrics,
+                    [](const DiskMetrics &disk) { return disk.queue_depth; });
+
+        AppendFamily(out, "rb_disk_utilization_percent", "Time a block device had I/O in progress over the last period.");
+        AppendDisks(out, "rb_disk_utilization_percent", "", metrics,
+                    [](const DiskMetrics &disk) { return disk.utilization; });
+
+        AppendFamily(out, "rb_target_cpu_usage_percent", "Cpu usage of a monitored target over the last period.");
+        AppendTargets(out, "rb_target_cpu_usage_percent", "", metrics,
+                      [](const TargetMetrics &target) { return target.cpu; });
+
+        AppendFamily(out, "rb_target_ram_usage_percent", "Ram usage of a monitored target.");
+        AppendTargets(out, "rb_target_ram_usage_percent", "", metrics,
+                      [](const TargetMetrics &target) { return target.ram; });
+
+        AppendFamily(out, "rb_target_ram_used_megabytes", "Ram in use by a monitored target.");
+        AppendTargets(out, "rb_target_ram_used_megabytes", "", metrics,
+                      [](const TargetMetrics &target) { return target.ram_m; });
+
+        AppendFamily(out, "rb_target_memory_kilobytes", "Memory of a monitored target by kind: rss, pss, uss, anon, file and swap.");
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"rss\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.rss; });
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"pss\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.pss; });
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"uss\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.uss; });
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"anon\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.anon; });
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"file\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.file; });
+        AppendTargets(out, "rb_target_memory_kilobytes", ",kind=\"swap\"", metrics,
+                      [](const TargetMetrics &target) { return target.memory.swap; });
+
+        AppendFamily(out, "rb_target_net_kilobytes_per_second", "Network traffic of a monitored target.");
+        AppendTargets(out, "rb_target_net_kilobytes_per_second", ",direction=\"read\"", metrics,
+                      [](const TargetMetrics &target) { return target.net.first; });
+        AppendTargets(out, "rb_target_net_kilobytes_per_second", ",direction=\"write\"", metrics,
+                      [](const TargetMetrics &target) { return target.net.second; });
+
+        AppendFamily(out, "rb_target_io_kilobytes_per_second", "Io traffic of a monitored target.");
+        AppendTargets(out, "rb_target_io_kilobytes_per_second", ",direction=\"read\"", metrics,
+                      [](const TargetMetrics &target) { return target.io.first; });
+        AppendTargets(out, "rb_target_io_kilobytes_per_second", ",direction=\"write\"", metrics,
+                      [](const TargetMetrics &target) { return target.io.second; });
+
+        AppendFamily(out, "rb_target_forks", "Processes which joined the tree of a monitored target over the last period.");
+        AppendTargets(out, "rb_target_forks", "", metrics,
+                      [](const TargetMetrics &target) { return target.forks; });
+
+        AppendFamily(out, "rb_target_exits", "Processes which left the tree of a monitored target over the last period.");
+        AppendTargets(out, "rb_target_exits", "", metrics,
+                      [](const TargetMetrics &target) { return target.exits; });
+
+        if (self)
+        {
+            AppendFamily(out, "rb_self_collector_wall_nanoseconds", "Wall time a collector of the monitor takes per tick.", "histogram");
+            AppendHistograms(out, "rb_self_collector_wall_nanoseconds", *self, &SelfStats::Wall);
+
+            AppendFamily(out, "rb_self_collector_cpu_nanoseconds", "Cpu time a collector of the monitor takes per tick.", "histogram");
+            AppendHistograms(out, "rb_self_collector_cpu_nanoseconds", *self, &SelfStats::Cpu);
+
+            AppendFamily(out, "rb_self_files_opened", "Files and directories a collector of the monitor has opened.", "counter");
+            AppendWork(out, "rb_self_files_opened", *self,
+                       [](const WorkCounters &work) { return work.files_opened; });
+
+            AppendFamily(out, "rb_self_bytes_read", "Bytes a collector of the monitor has read to parse.", "counter");
+            AppendWork(out, "rb_self_bytes_read", *self,
+                       [](const WorkCounters &work) { return work.bytes_read; });
+
+            AppendFamily(out, "rb_self_processes_spawned", "Processes a collector of the monitor has spawned.", "counter");
+            AppendWork(out, "rb_self_processes_spawned", *self,
+                       [](const WorkCounters &work) { return work.processes_spawned; });
+        }
+
+        out.append("# EOF\n");
+    }
+
+    void MetricsExporter::Publish(const Metrics &metrics, const SelfStats *self)
+    {
+        render(metrics, self);
+
+        // The back buffer is reused unless a slow scraper still sends it
+        if (m_back.use_count() != 1)
+            m_back = std::make_shared<std::string>();
+        std::string &response = *m_back;
+        response.clear();
+        response.append("HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                        "Content-Length: ");
+        AppendUint(response, m_body.size());
+        response.append("\r\nConnection: close\r\n\r\n");
+        response.append(m_body);
+
+        std::shared_ptr<std::string> previous;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            previous = std::const_pointer_cast<std::string>(m_front);
+            m_front = m_back;
+        }
+        m_back = std::move(previous);
+    }
+
+    bool MetricsExporter::receive(Client &client)
+    {
+        char buffer[1024];
+        while (true)
+        {
+            ssize_t size = recv(client.fd, buffer, sizeof(buffer), 0);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            if (size == 0)
+                return false;
+            client.request.append(buffer, size);
+            if (client.request.find("\r\n\r\n") != std::string::npos || client.request.size() >= kMaxRequest)
+                break;
+        }
+
+        if (client.request.compare(0, 13, "GET /metrics ") == 0 || client.request.compare(0, 13, "GET /metrics?") == 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            client.response = m_front;
+        }
+        else
+        {
+            static const Response not_found = std::make_shared<std::string>(kNotFound);
+            client.response = not_found;
+        }
+        client.sent = 0;
+        return send(client);
+    }
+
+    bool MetricsExporter::send(Client &client)
+    {
+        const std::string &response = *client.response;
+        while (client.sent < response.size())
+        {
+            ssize_t size = ::send(client.fd, response.data() + client.sent, response.size() - client.sent, MSG_NOSIGNAL);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            client.sent += size;
+        }
+        return false;
+    }
+
+    void MetricsExporter::serve()
+    {
+        std::vector<Client> clients;
+        std::vector<pollfd> fds;
+        while (true)
+        {
+            fds.clear();
+            fds.push_back({m_wake_fd, POLLIN, 0});
+            fds.push_back({m_listen_fd, static_cast<short>(clients.size() < kMaxClients ? POLLIN : 0), 0});
+            // Clients are kept in accept order: the first one expires first
+            int timeout = -1;
+            if (!clients.empty())
+            {
+                uint64_t deadline = clients.front().accepted_ns + kClientTimeoutNs;
+                uint64_t now = MonotonicNs();
+                timeout = deadline > now ? static_cast<int>((deadline - now + 999999) / 1000000) : 0;
+            }
+            for (const auto &client : clients)
+            {
+                fds.push_back({client.fd, static_cast<short>(client.response ? POLLOUT : POLLIN), 0});
+            }
+
+            if (poll(fds.data(), fds.size(), timeout) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (fds[0].revents != 0)
+                break;
+            uint64_t now = MonotonicNs();
+
+            // Serve the connections first: the indexes of <fds> match <clients> until new ones are accepted
+            size_t kept = 0;
+            for (size_t i = 0; i < clients.size(); i++)
+            {
+                auto &client = clients[i];
+                short events = fds[i + 2].revents;
+                bool open = true;
+                if (now - client.accepted_ns >= kClientTimeoutNs)
+                    open = false;
+                else if (events & (POLLERR | POLLHUP | POLLNVAL))
+                    open = client.response && (events & POLLOUT) ? send(client) : false;
+                else if (events & POLLOUT)
+                    open = send(client);
+                else if (events & POLLIN)
+                    open = receive(client);
+
+                if (open)
+                {
+                    if (kept != i)
+                        clients[kept] = std::move(client);
+                    ++kept;
+                }
+                else
+                {
+                    close(client.fd);
+                }
+            }
+            clients.erase(clients.begin() + kept, clients.end());
+
+            if (fds[1].revents & POLLIN)
+            {
+                while (clients.size() < kMaxClients)
+                {
+                    int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0)
+                        break;
+                    clients.push_back({fd, std::string(), nullptr, 0, now});
+                }
+            }
+        }
+
+        for (const auto &client : clients)
+        {
+            close(client.fd);
+        }
+    }
+}
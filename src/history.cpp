@@ -0,0 +1,262 @@
+#include "history.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    uint64_t ToBits(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    double FromBits(uint64_t bits)
+    {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+}
+
+namespace system_metrics
+{
+    MetricSeries::MetricSeries(size_t capacity, size_t window)
+        : m_capacity(std::max<size_t>(capacity, 1)),
+          m_window(std::min(std::max<size_t>(window, 1), m_capacity)),
+          m_slots(new Slot[m_capacity]),
+          m_head(0),
+          m_sum(0),
+          m_aggregates_sequence(0),
+          m_count(0),
+          m_min_value(0),
+          m_max_value(0),
+          m_mean_value(0),
+          m_rate_value(0)
+    {
+        m_min.items.resize(m_window);
+        m_max.items.resize(m_window);
+    }
+
+    bool MetricSeries::readSlot(uint64_t n, Sample &sample) const
+    {
+        const Slot &slot = m_slots[n % m_capacity];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * n + 2)
+        {
+            return false;
+        }
+        sample.timestamp_ns = slot.timestamp_ns.load(std::memory_order_relaxed);
+        sample.value = FromBits(slot.value.load(std::memory_order_relaxed));
+        // The producer may have started to overwrite the slot while it was read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    template <typename Dominates>
+    void MetricSeries::enqueue(MonotonicQueue &queue, uint64_t n, double value, Dominates dominates)
+    {
+        while (queue.size > 0)
+        {
+            size_t back = (queue.first + queue.size - 1) % m_window;
+            if (!dominates(value, queue.items[back].second))
+                break;
+            --queue.size;
+        }
+        queue.items[(queue.first + queue.size) % m_window] = std::make_pair(n, value);
+        ++queue.size;
+    }
+
+    void MetricSeries::expire(MonotonicQueue &queue, uint64_t n)
+    {
+        while (queue.size > 0 && queue.items[queue.first].first + m_window <= n)
+        {
+            queue.first = (queue.first + 1) % m_window;
+            --queue.size;
+        }
+    }
+
+    void MetricSeries::Push(uint64_t timestamp_ns, double value)
+    {
+        // Only the producer writes m_head
+        const uint64_t n = m_head.load(std::memory_order_relaxed);
+
+        // The sample leaving the window may share the slot of the new one: take it out first
+        if (n >= m_window)
+        {
+            Sample evicted;
+            readSlot(n - m_window, evicted);
+            m_sum -= evicted.value;
+        }
+        m_sum += value;
+        expire(m_min, n);
+        expire(m_max, n);
+
+        Slot &slot = m_slots[n % m_capacity];
+        slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp_ns.store(timestamp_ns, std::memory_order_relaxed);
+        slot.value.store(ToBits(value), std::memory_order_relaxed);
+        slot.sequence.store(2 * n + 2, std::memory_order_release);
+        m_head.store(n + 1, std::memory_order_release);
+
+        enqueue(m_min, n, value, [](double added, double back) { return added <= back; });
+        enqueue(m_max, n, value, [](double added, double back) { return added >= back; });
+        publish(n);
+    }
+
+    void MetricSeries::publish(uint64_t n)
+    {
+        const uint64_t count = std::min<uint64_t>(n + 1, m_window);
+
+        Sample oldest;
+        Sample newest;
+        readSlot(n + 1 - count, oldest);
+        readSlot(n, newest);
+        double rate = 0;
+        if (newest.timestamp_ns > oldest.timestamp_ns)
+        {
+            rate = (newest.value - oldest.value) * 1e9 / (newest.timestamp_ns - oldest.timestamp_ns);
+        }
+
+        const uint64_t sequence = m_aggregates_sequence.load(std::memory_order_relaxed);
+        m_aggregates_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_count.store(count, std::memory_order_relaxed);
+        m_min_value.store(ToBits(m_min.items[m_min.first].second), std::memory_order_relaxed);
+        m_max_value.store(ToBits(m_max.items[m_max.first].second), std::memory_order_relaxed);
+        m_mean_value.store(ToBits(m_sum / count), std::memory_order_relaxed);
+        m_rate_value.store(ToBits(rate), std::memory_order_relaxed);
+        m_aggregates_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    MetricSeries::Window MetricSeries::Aggregates() const
+    {
+        Window result;
+        while (true)
+        {
+            uint64_t sequence = m_aggregates_sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                continue;
+            result.count = m_count.load(std::memory_order_relaxed);
+            result.min = FromBits(m_min_value.load(std::memory_order_relaxed));
+            result.max = FromBits(m_max_value.load(std::memory_order_relaxed));
+            result.mean = FromBits(m_mean_value.load(std::memory_order_relaxed));
+            result.rate = FromBits(m_rate_value.load(std::memory_order_relaxed));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_aggregates_sequence.load(std::memory_order_relaxed) == sequence)
+                return result;
+        }
+    }
+
+    bool MetricSeries::Latest(Sample &sample) const
+    {
+        while (true)
+        {
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            if (head == 0)
+                return false;
+            // Fails only if the producer has lapped the whole ring meanwhile
+            if (readSlot(head - 1, sample))
+                return true;
+        }
+    }
+
+    size_t MetricSeries::Read(Sample *out, size_t max) const
+    {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t count = std::min<uint64_t>(std::min<uint64_t>(head, m_capacity), max);
+        size_t result = 0;
+        for (uint64_t n = head - count; n < head; n++)
+        {
+            if (readSlot(n, out[result]))
+                ++result;
+        }
+        return result;
+    }
+
+    MetricHistory::MetricHistory(size_t retention, size_t window) : m_retention(retention),
+                                                                    m_window(window),
+                                                                    m_general(makeSeries()),
+                                                                    m_targets(std::make_shared<Targets>())
+    {
+    }
+
+    MetricHistory::SeriesSet MetricHistory::makeSeries() const
+    {
+        SeriesSet result(HISTORY_METRICS);
+        for (auto &series : result)
+        {
+            series = std::make_shared<MetricSeries>(m_retention, m_window);
+        }
+        return result;
+    }
+
+    const MetricHistory::SeriesSet &MetricHistory::seriesOf(size_t index, const TargetMetrics &target, bool &changed)
+    {
+        // Targets mostly come in the same order every tick: the map is only searched for the others
+        if (index < m_recent.size() && m_recent[index].first.first == target.pid &&
+            m_recent[index].first.second == target.cgroup)
+        {
+            return m_recent[index].second;
+        }
+
+        changed = true;
+        Key key(target.pid, target.cgroup);
+        auto it = m_targets->find(key);
+        SeriesSet series = it != m_targets->end() ? it->second : makeSeries();
+        if (index >= m_recent.size())
+            m_recent.resize(index + 1);
+        m_recent[index] = std::make_pair(std::move(key), std::move(series));
+        return m_recent[index].second;
+    }
+
+    void MetricHistory::Record(uint64_t timestamp_ns, const Metrics &metrics)
+    {
+        m_general[HISTORY_CPU]->Push(timestamp_ns, metrics.general_cpu);
+        m_general[HISTORY_RAM]->Push(timestamp_ns, metrics.general_ram);
+        m_general[HISTORY_RAM_M]->Push(timestamp_ns, metrics.general_ram_m);
+        m_general[HISTORY_NET_READ]->Push(timestamp_ns, metrics.general_net.first);
+        m_general[HISTORY_NET_WRITE]->Push(timestamp_ns, metrics.general_net.second);
+        m_general[HISTORY_IO_READ]->Push(timestamp_ns, metrics.general_io.first);
+        m_general[HISTORY_IO_WRITE]->Push(timestamp_ns, metrics.general_io.second);
+
+        bool changed = metrics.targets.size() != m_recent.size();
+        for (size_t i = 0; i < metrics.targets.size(); i++)
+        {
+            const auto &target = metrics.targets[i];
+            const auto &series = seriesOf(i, target, changed);
+            series[HISTORY_CPU]->Push(timestamp_ns, target.cpu);
+            series[HISTORY_RAM]->Push(timestamp_ns, target.ram);
+            series[HISTORY_RAM_M]->Push(timestamp_ns, target.ram_m);
+            series[HISTORY_NET_READ]->Push(timestamp_ns, target.net.first);
+            series[HISTORY_NET_WRITE]->Push(timestamp_ns, target.net.second);
+            series[HISTORY_IO_READ]->Push(timestamp_ns, target.io.first);
+            series[HISTORY_IO_WRITE]->Push(timestamp_ns, target.io.second);
+        }
+
+        // Publishes the targets of this record: removed targets lose their series
+        if (changed)
+        {
+            m_recent.resize(metrics.targets.size());
+            auto targets = std::make_shared<Targets>(m_recent.begin(), m_recent.end());
+            std::atomic_store(&m_targets, std::shared_ptr<const Targets>(std::move(targets)));
+        }
+    }
+
+    std::shared_ptr<const MetricSeries> MetricHistory::General(HistoryMetric metric) const
+    {
+        return m_general[metric];
+    }
+
+    std::shared_ptr<const MetricSeries> MetricHistory::Target(uint32_t pid, HistoryMetric metric,
+                                                              const std::string &cgroup) const
+    {
+        auto targets = std::atomic_load(&m_targets);
+        auto it = targets->find(Key(pid, cgroup));
+        if (it == targets->end())
+            return nullptr;
+        return it->second[metric];
+    }
+}
@@ -1,84 +1,231 @@
 #include "rb_metrics.hpp"
+#include "sampler.hpp"
+#include "exporter.hpp"
+#include "ndjson.hpp"
+#include "shm_publisher.hpp"
+#include "event_loop.hpp"
 
-int main()
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+// Usage: rb_metrics [-i milliseconds] [-w workers] [-t count] [-r recording] [-p port [-a address]] [-j output] [-s name] [pid | cgroup...]
+// Monitors the trees of the given pids and the given cgroup v2 paths along with system-wide metrics,
+// every second or every period given by -i.
+// With -w the files of the processes are read on that many threads, on the sampling one alone by default.
+// With -t the processes of the whole system with the highest cpu, RSS and io are listed, that many of each.
+// With -r every snapshot is also appended to the binary recording file.
+// With -p the metrics are served at http://address:port/metrics, on loopback unless -a is given.
+// With -j one JSON object per tick is written to the output file or FIFO, "-" replaces the screen with stdout.
+// With -s every tick is published to the shared memory object <name>, e.g. /rb_metrics, see shm_snapshot.hpp
+int main(int argc, char *argv[])
 {
-    while (1)
+    std::vector<uint32_t> pids;
+    std::vector<std::string> cgroups;
+    std::string recording;
+    uint16_t port = 0;
+    std::string address = "127.0.0.1";
+    std::string json;
+    std::string shared;
+    std::chrono::milliseconds period(1000);
+    size_t workers = 1;
+    size_t top = 0;
+    for (int i = 1; i < argc; i++)
     {
-        Rb_metrics meter(25528, 1);
-        double cpuGen = 0, cpu = 0, ramGen = 0, ram = 0;
-        uint64_t ramMbGen = 0, ramMb = 0, netGenr = 0, netGenw = 0, netr = 0, netw = 0,
-                           ioGenw = 0, ioGenr = 0, ior = 0, iow = 0;
-
-        std::thread th1([&cpuGen, &meter]()
-                        { cpuGen = meter.GetGeneralCpuUsage(); });
-
-        std::thread th2([&cpu, &meter]()
-                        { cpu = meter.GetCpuUsage(); });
-
-        std::thread th3([&ramGen, &meter]()
-                        { ramGen = meter.GetGeneralRamUsage(); });
-
-        std::thread th4([&ram, &meter]()
-                        { ram = meter.GetRamUsage(); });
-
-        std::thread th5([&ramMbGen, &meter]
-                        { ramMbGen = meter.GetGeneralRamUsage_m(); });
-
-        std::thread th6([&ramMb, &meter]()
-                        { ramMb = meter.GetRamUsage_m(); });
-
-        std::thread th7([&netGenr, &netGenw, &meter]()
-                        {
-            auto data = meter.GetGeneralNetUsage();
-            netGenr = data.first;
-            netGenw = data.second; });
-
-        std::thread th8([&netr, &netw, &meter]
-                        {
-            auto data = meter.GetNetUsage();
-            netr = data.first;
-            netw = data.second; });
-
-        std::thread th9([&meter, &ioGenr, &ioGenw]()
-                        {
-            auto data = meter.GetGeneralIoStats();
-            ioGenr = data.first;
-            ioGenw = data.second; });
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+        {
+            period = std::chrono::milliseconds(strtoul(argv[++i], nullptr, 10));
+            continue;
+        }
+        if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            workers = strtoul(argv[++i], nullptr, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            top = strtoul(argv[++i], nullptr, 10);
+            continue;
+        }
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            recording = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            port = static_cast<uint16_t>(strtoul(argv[++i], nullptr, 10));
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            json = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            shared = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+        {
+            address = argv[++i];
+            continue;
+        }
+        char *end = nullptr;
+        unsigned long pid = strtoul(argv[i], &end, 10);
+        if (end != argv[i] && *end == '\0')
+            pids.push_back(pid);
+        else
+            cgroups.push_back(argv[i]);
+    }
 
-        std::thread th10([&meter, &ior, &iow]
-                         {
-          auto data = meter.GetIoStats();
-          ior = data.first;
-          iow = data.second; });
+    // SIGINT and SIGTERM stop the loop so main returns and every output is closed cleanly: the recording gets its
+    // index, the shared memory object is unlinked. They are blocked before any thread starts so all inherit it
+    system_metrics::EventLoop loop;
+    if (!loop.StopOnSignals({SIGINT, SIGTERM}))
+    {
+        std::cerr << "Cannot wait for signals\n";
+        return 1;
+    }
 
-            th1.detach();
-            th2.detach();
-            th3.detach();
-            th4.detach();
-            th5.detach();
-            th6.detach();
-            th7.detach();
-            th8.detach();
-            th9.detach();
-            th10.detach();
+    // One sampler reads every source once per period for all targets, no per-metric threads are needed
+    auto sampler = std::make_shared<Rb_sampler>(pids, period, true);
+    sampler->SetWorkers(workers);
+    if (top != 0)
+        sampler->KeepTop(top);
+    for (const auto &cgroup : cgroups)
+    {
+        sampler->AddCgroup(cgroup);
+    }
+    if (!recording.empty() && !sampler->RecordTo(recording))
+    {
+        std::cerr << "Cannot create " << recording << "\n";
+        return 1;
+    }
+    std::unique_ptr<system_metrics::MetricsExporter> exporter;
+    if (port != 0)
+    {
+        exporter.reset(new system_metrics::MetricsExporter(port, address));
+        if (!exporter->IsListening())
+        {
+            std::cerr << "Cannot listen on " << address << ":" << port << "\n";
+            return 1;
+        }
+    }
+    std::unique_ptr<system_metrics::NdjsonWriter> ndjson;
+    if (!json.empty())
+    {
+        ndjson.reset(new system_metrics::NdjsonWriter(json));
+        if (!ndjson->IsOpen())
+        {
+            std::cerr << "Cannot open " << json << "\n";
+            return 1;
+        }
+    }
+    std::unique_ptr<system_metrics::SharedSnapshotPublisher> publisher;
+    if (!shared.empty())
+    {
+        publisher.reset(new system_metrics::SharedSnapshotPublisher(shared));
+        if (!publisher->IsOpen())
+        {
+            std::cerr << "Cannot create " << shared << "\n";
+            return 1;
+        }
+    }
 
+    auto output = [&](const system_metrics::Metrics &metrics)
+    {
+        if (publisher)
+            publisher->Publish(metrics);
+        if (exporter)
+            exporter->Publish(metrics, &sampler->Self());
+        if (ndjson)
+        {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            ndjson->Write(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), metrics);
+            if (json == "-")
+                return;
+        }
 
-            std::this_thread::sleep_for(std::chrono::seconds(2));
-            system("clear");
-            std::cout << "Current pid: 25528\n"
+        // Homes the cursor and erases the screen, as clear(1) would without a process per tick
+        std::cout << "\x1b[H\x1b[2J"
+                  << "System\n"
+                  << "\t\r"
+                  << "Cpu: " << metrics.general_cpu << "%\n"
+                  << "\t\r"
+                  << "Cores:";
+        for (size_t row = 1; row < metrics.cpus.Rows(); row++)
+        {
+            std::cout << " " << static_cast<uint32_t>(metrics.cpus.Busy(row)) << "%";
+        }
+        std::cout << "\n\t\r"
+                  << "Ram: " << metrics.general_ram << "%\n"
+                  << "\t\r"
+                  << "Ram(mb): " << metrics.general_ram_m << "\n\t\r"
+                  << "Net: " << metrics.general_net.first << " kb/s " << metrics.general_net.second << "kb/s"
+                  << "\n\t\r"
+                  << "IO: " << metrics.general_io.first << "kb/s " << metrics.general_io.second << "kb/s"
+                  << "\n\t\r"
+                  << "Sample: " << metrics.collect_ns / 1000 << "us, missed " << metrics.missed << "\n";
+        for (const auto &ns : metrics.namespaces)
+        {
+            std::cout << "\t\r"
+                      << "Netns " << ns.inode << (ns.own ? " (own)" : "") << ": " << ns.net.first << "kb/s "
+                      << ns.net.second << "kb/s\n";
+        }
+        for (const auto &disk : metrics.disks)
+        {
+            std::cout << "\t\r"
+                      << "Disk " << disk.name << ": " << disk.kbps.first << "kb/s " << disk.kbps.second << "kb/s, "
+                      << disk.iops.first + disk.iops.second << " iops, " << disk.latency_ms.first << "/"
+                      << disk.latency_ms.second << " ms, queue " << disk.queue_depth << ", busy "
+                      << static_cast<uint32_t>(disk.utilization) << "%\n";
+        }
+        for (const auto &target : metrics.targets)
+        {
+            if (target.cgroup.empty())
+                std::cout << "Pid: " << target.pid << "\n";
+            else
+                std::cout << "Cgroup: " << target.cgroup << "\n";
+            std::cout << "\t\r"
+                      << "Cpu: " << target.cpu << "%\n"
                       << "\t\r"
-                      << "Cpu: " << cpuGen << "% " << cpu << "%\n"
+                      << "Ram: " << target.ram << "%\n"
                       << "\t\r"
-                      << "Ram: " << ramGen << "% " << ram << "%\n"
-                      << "\t\r"
-                      << "Ram(mb): " << ramMbGen << " " << ramMb << "\n\t\r"
-                      << "Net: " << netGenr << " kb/s " << netGenw << "kb/s"
-                      << "\n\t\r" << netr << "kb/s " << netw << "kb/s"
+                      << "Ram(mb): " << target.ram_m << "\n\t\r"
+                      << "Memory(mb): rss " << target.memory.rss / 1024 << " pss " << target.memory.pss / 1024
+                      << " uss " << target.memory.uss / 1024 << " swap " << target.memory.swap / 1024
+                      << "\n\t\r"
+                      << "Net: " << target.net.first << "kb/s " << target.net.second << "kb/s"
                       << "\n\t\r"
-                      << "IO: " << ioGenr << "kb/s " << ioGenw << "kb/s"
-                      << "\n\t\r" << ior << "kb/s " << iow << "kb/s "
+                      << "IO: " << target.io.first << "kb/s " << target.io.second << "kb/s "
+                      << "\n\t\r"
+                      << "Procs: +" << target.forks << " -" << target.exits
                       << "\n\t\r";
-    }
+        }
+        if (const auto *ranking = sampler->Top())
+        {
+            for (size_t metric = 0; metric < system_metrics::TOP_METRICS; metric++)
+            {
+                auto which = static_cast<system_metrics::TopMetric>(metric);
+                std::cout << "Top " << system_metrics::TopMetricName(which) << " of " << ranking->Processes() << "\n";
+                for (const auto &process : ranking->Top(which))
+                {
+                    std::cout << "\t\r" << process.pid << " " << process.comm << ": cpu "
+                              << static_cast<uint32_t>(process.cpu) << "%, rss(mb) " << process.rss / 1024
+                              << ", io " << process.io.first << "kb/s " << process.io.second << "kb/s\n";
+                }
+            }
+        }
+        std::cout.flush();
+    };
+
+    // The loop drives the sampler from its timer on this thread, no thread sleeps waiting for a period
+    loop.Subscribe(sampler, output);
+    loop.Run();
+    return 0;
 }
 
 // hpp - rb_include
@@ -0,0 +1,235 @@
+#include "ndjson.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Returns [read, write] as a JSON array in <value>
+    void EmplacePair(boost::json::value &value, const std::pair<uint64_t, uint64_t> &pair)
+    {
+        auto &array = value.emplace_array();
+        array.push_back(pair.first);
+        array.push_back(pair.second);
+    }
+
+    // Opens <path> for non-blocking writes, "-" being stdout, whose flags are left alone
+    int OpenOutput(const std::string &path)
+    {
+        if (path == "-")
+        {
+            return STDOUT_FILENO;
+        }
+        // Opening a FIFO write-only fails with ENXIO while it has no reader
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode))
+        {
+            return open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        }
+        return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0644);
+    }
+}
+
+namespace system_metrics
+{
+    NdjsonWriter::NdjsonWriter(const std::string &path, FlushPolicy policy, size_t max_pending)
+        : m_fd(OpenOutput(path)),
+          m_owned(path != "-"),
+          m_policy(policy),
+          m_max_pending(max_pending),
+          m_offset(0),
+          m_ticks(0),
+          m_dropped(0),
+          m_arena(64 * 1024),
+          m_resource(m_arena.data(), m_arena.size()),
+          m_document(boost::json::storage_ptr(&m_resource))
+    {
+        m_output.reserve(m_policy.max_bytes + 4096);
+    }
+
+    NdjsonWriter::~NdjsonWriter()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        Flush();
+        if (m_owned)
+            close(m_fd);
+    }
+
+    void NdjsonWriter::build(uint64_t timestamp_ns, const Metrics &metrics)
+    {
+        // Nothing may hold memory of the resource when it is released
+        m_document.emplace_null();
+        m_resource.release();
+
+        /*
+        {"timestamp_ns":..,"elapsed_ns":..,"collect_ns":..,"missed":..,"dropped":..,
+         "system":{"cpu":..,"cores":[..],"ram":..,"ram_mb":..,"net_kbps":[read,write],"io_kbps":[read,write]},
+         "namespaces":[{"netns":..,"own":..,"net_kbps":[read,write]}],
+         "disks":[{"device":..,"kbps":[read,write],"iops":[read,write],"latency_ms":[read,write],
+                   "queue_depth":..,"utilization":..}],
+         "targets":[{"pid":..,"cgroup":..,"cpu":..,"ram":..,"ram_mb":..,"net_kbps":[..],"io_kbps":[..],
+                     "forks":..,"exits":..,"memory_kb":{"rss":..,"pss":..,"uss":..,"anon":..,"file":..,"swap":..}}],
+         "collectors":{"cpu":{"wall_ns":..,"cpu_ns":..,"files_opened":..,"bytes_read":..,"processes_spawned":..},..}}
+        */
+        auto &root = m_document.emplace_object();
+        root["timestamp_ns"] = timestamp_ns;
+        root["elapsed_ns"] = metrics.elapsed_ns;
+        root["collect_ns"] = metrics.collect_ns;
+        root["missed"] = metrics.missed;
+        root["dropped"] = m_dropped;
+
+        auto &system = root["system"].emplace_object();
+        system["cpu"] = metrics.general_cpu;
+        auto &cores = system["cores"].emplace_array();
+        for (size_t row = 1; row < metrics.cpus.Rows(); row++)
+        {
+            cores.push_back(metrics.cpus.Busy(row));
+        }
+        system["ram"] = metrics.general_ram;
+        system["ram_mb"] = metrics.general_ram_m;
+        EmplacePair(system["net_kbps"], metrics.general_net);
+        EmplacePair(system["io_kbps"], metrics.general_io);
+
+        auto &namespaces = root["namespaces"].emplace_array();
+        for (const auto &ns : metrics.namespaces)
+        {
+            auto &object = namespaces.emplace_back(nullptr).emplace_object();
+            object["netns"] = ns.inode;
+            object["own"] = ns.own;
+            EmplacePair(object["net_kbps"], ns.net);
+        }
+
+        auto &disks = root["disks"].emplace_array();
+        for (const auto &disk : metrics.disks)
+        {
+            auto &object = disks.emplace_back(nullptr).emplace_object();
+            object["device"].emplace_string().assign(disk.name.data(), disk.name.size());
+            EmplacePair(object["kbps"], disk.kbps);
+            EmplacePair(object["iops"], disk.iops);
+            auto &latency = object["latency_ms"].emplace_array();
+            latency.push_back(disk.latency_ms.first);
+            latency.push_back(disk.latency_ms.second);
+            object["queue_depth"] = disk.queue_depth;
+            object["utilization"] = disk.utilization;
+        }
+
+        auto &targets = root["targets"].emplace_array();
+        for (const auto &target : metrics.targets)
+        {
+            auto &object = targets.emplace_back(nullptr).emplace_object();
+            if (target.cgroup.empty())
+                object["pid"] = target.pid;
+            else
+                object["cgroup"].emplace_string().assign(target.cgroup.data(), target.cgroup.size());
+            object["cpu"] = target.cpu;
+            object["ram"] = target.ram;
+            object["ram_mb"] = target.ram_m;
+            EmplacePair(object["net_kbps"], target.net);
+            EmplacePair(object["io_kbps"], target.io);
+            object["forks"] = target.forks;
+            object["exits"] = target.exits;
+            auto &memory = object["memory_kb"].emplace_object();
+            memory["rss"] = target.memory.rss;
+            memory["pss"] = target.memory.pss;
+            memory["uss"] = target.memory.uss;
+            memory["anon"] = target.memory.anon;
+            memory["file"] = target.memory.file;
+            memory["swap"] = target.memory.swap;
+        }
+
+        auto &collectors = root["collectors"].emplace_object();
+        for (size_t i = 0; i < COLLECTORS; i++)
+        {
+            const auto &cost = metrics.costs[i];
+            auto &object = collectors[CollectorName(static_cast<Collector>(i))].emplace_object();
+            object["wall_ns"] = cost.wall_ns;
+            object["cpu_ns"] = cost.cpu_ns;
+            object["files_opened"] = cost.work.files_opened;
+            object["bytes_read"] = cost.work.bytes_read;
+            object["processes_spawned"] = cost.work.processes_spawned;
+        }
+    }
+
+    bool NdjsonWriter::Write(uint64_t timestamp_ns, const Metrics &metrics)
+    {
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        // The consumer is behind: drop the tick rather than wait or grow without bound
+        if (m_output.size() - m_offset > m_max_pending && !Flush() && m_output.size() - m_offset > m_max_pending)
+        {
+            ++m_dropped;
+            return false;
+        }
+
+        build(timestamp_ns, metrics);
+
+        // Serialize straight into the output buffer
+        m_serializer.reset(&m_document);
+        while (!m_serializer.done())
+        {
+            size_t size = m_output.size();
+            m_output.resize(size + 4096);
+            auto chunk = m_serializer.read(m_output.data() + size, 4096);
+            m_output.resize(size + chunk.size());
+        }
+        m_output.push_back('\n');
+
+        if (++m_ticks >= m_policy.max_ticks || m_output.size() - m_offset >= m_policy.max_bytes)
+        {
+            Flush();
+        }
+        return true;
+    }
+
+    bool NdjsonWriter::Flush()
+    {
+        m_ticks = 0;
+        while (m_offset < m_output.size())
+        {
+            size_t size = m_output.size() - m_offset;
+            if (!m_owned)
+            {
+                // stdout is shared with other processes, so it stays blocking: a write only goes out when
+                // the consumer has room, which for a pipe is at least PIPE_BUF bytes
+                pollfd ready{m_fd, POLLOUT, 0};
+                if (poll(&ready, 1, 0) <= 0 || !(ready.revents & POLLOUT))
+                    break;
+                size = std::min<size_t>(size, PIPE_BUF);
+            }
+            ssize_t count = write(m_fd, m_output.data() + m_offset, size);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                // EAGAIN: the consumer is slow, the rest is written on a later tick
+                break;
+            }
+            m_offset += count;
+        }
+
+        if (m_offset == m_output.size())
+        {
+            m_output.clear();
+            m_offset = 0;
+            return true;
+        }
+        // Keep the buffer from growing by the part already written
+        if (m_offset > m_output.size() / 2)
+        {
+            m_output.erase(m_output.begin(), m_output.begin() + m_offset);
+            m_offset = 0;
+        }
+        return false;
+    }
+}
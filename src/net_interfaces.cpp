@@ -0,0 +1,230 @@
+#include "net_interfaces.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace system_metrics
+{
+    NetInterfaceRegistry::NetInterfaceRegistry() : m_fd(-1),
+                                                   m_seq(0),
+                                                   m_buffer(32768)
+    {
+        m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+        if (m_fd >= 0)
+        {
+            // Subscribe to link events before the dump, so no change is lost in between
+            sockaddr_nl addr{};
+            addr.nl_family = AF_NETLINK;
+            addr.nl_groups = RTMGRP_LINK;
+            if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || !dump())
+            {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+        if (m_fd < 0)
+        {
+            pollIfaddrs();
+        }
+    }
+
+    NetInterfaceRegistry::~NetInterfaceRegistry()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    void NetInterfaceRegistry::Update()
+    {
+        if (m_fd < 0)
+        {
+            pollIfaddrs();
+            return;
+        }
+        if (!receive(false))
+        {
+            // Events were dropped (ENOBUFS): the cached view cannot be trusted, take it again
+            m_links.clear();
+            dump();
+        }
+    }
+
+    bool NetInterfaceRegistry::IsActive(const char *name, size_t size) const
+    {
+        for (const auto &link : m_links)
+        {
+            if (link.active && link.name.size() == size && link.name.compare(0, size, name, size) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::string> NetInterfaceRegistry::Active() const
+    {
+        std::vector<std::string> result;
+        for (const auto &link : m_links)
+        {
+            if (link.active)
+            {
+                result.push_back(link.name);
+            }
+        }
+        return result;
+    }
+
+    bool NetInterfaceRegistry::dump()
+    {
+        struct
+        {
+            nlmsghdr header;
+            ifinfomsg info;
+        } request{};
+        request.header.nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+        request.header.nlmsg_type = RTM_GETLINK;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++m_seq;
+        request.info.ifi_family = AF_UNSPEC;
+
+        sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        if (sendto(m_fd, &request, request.header.nlmsg_len, 0,
+                   reinterpret_cast<sockaddr *>(&kernel), sizeof(kernel)) < 0)
+        {
+            return false;
+        }
+        return receive(true);
+    }
+
+    bool NetInterfaceRegistry::receive(bool until_done)
+    {
+        while (true)
+        {
+            ssize_t size = recv(m_fd, m_buffer.data(), m_buffer.size(), 0);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (!until_done)
+                        return true;
+                    // The dump is not complete yet, wait for the rest of it
+                    fd_set fds;
+                    FD_ZERO(&fds);
+                    FD_SET(m_fd, &fds);
+                    timeval timeout{1, 0};
+                    if (select(m_fd + 1, &fds, nullptr, nullptr, &timeout) <= 0)
+                        return false;
+                    continue;
+                }
+                return false;
+            }
+
+            int length = static_cast<int>(size);
+            for (auto header = reinterpret_cast<nlmsghdr *>(m_buffer.data());
+                 NLMSG_OK(header, length);
+                 header = NLMSG_NEXT(header, length))
+            {
+                if (header->nlmsg_type == NLMSG_DONE && header->nlmsg_seq == m_seq)
+                {
+                    until_done = false;
+                }
+                else if (header->nlmsg_type == NLMSG_ERROR)
+                {
+                    return false;
+                }
+                else if (header->nlmsg_type == RTM_NEWLINK || header->nlmsg_type == RTM_DELLINK)
+                {
+                    apply(header);
+                }
+            }
+        }
+    }
+
+    void NetInterfaceRegistry::apply(const void *message)
+    {
+        auto header = static_cast<const nlmsghdr *>(message);
+        auto info = static_cast<const ifinfomsg *>(NLMSG_DATA(header));
+
+        auto it = m_links.begin();
+        while (it != m_links.end() && it->index != info->ifi_index)
+            ++it;
+
+        if (header->nlmsg_type == RTM_DELLINK)
+        {
+            if (it != m_links.end())
+                m_links.erase(it);
+            return;
+        }
+
+        // RTM_NEWLINK notifications always carry the name and the operational state
+        std::string name;
+        bool active = false;
+        int length = IFLA_PAYLOAD(header);
+        for (auto attr = IFLA_RTA(info); RTA_OK(attr, length); attr = RTA_NEXT(attr, length))
+        {
+            if (attr->rta_type == IFLA_IFNAME)
+            {
+                name = static_cast<const char *>(RTA_DATA(attr));
+            }
+            else if (attr->rta_type == IFLA_OPERSTATE)
+            {
+                active = *static_cast<const uint8_t *>(RTA_DATA(attr)) == IF_OPER_UP;
+            }
+        }
+
+        if (it == m_links.end())
+        {
+            m_links.push_back(Link{info->ifi_index, name, active});
+        }
+        else
+        {
+            it->name = name;
+            it->active = active;
+        }
+    }
+
+    void NetInterfaceRegistry::pollIfaddrs()
+    {
+        ifaddrs *addresses = nullptr;
+        if (getifaddrs(&addresses) != 0)
+        {
+            return;
+        }
+
+        // getifaddrs(3) reports no operational state: treat a running interface as up.
+        // Loopback's operational state is UNKNOWN, so it is never active.
+        m_links.clear();
+        for (auto address = addresses; address != nullptr; address = address->ifa_next)
+        {
+            bool active = (address->ifa_flags & IFF_UP) && (address->ifa_flags & IFF_RUNNING) &&
+                          !(address->ifa_flags & IFF_LOOPBACK);
+            bool known = false;
+            for (auto &link : m_links)
+            {
+                if (link.name == address->ifa_name)
+                {
+                    known = true;
+                    link.active = link.active || active;
+                }
+            }
+            if (!known)
+            {
+                m_links.push_back(Link{static_cast<int>(if_nametoindex(address->ifa_name)), address->ifa_name, active});
+            }
+        }
+        freeifaddrs(addresses);
+    }
+}
@@ -0,0 +1,267 @@
+#include "proc_connector.hpp"
+#include "proc_parser.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    // Sends a proc connector multicast operation (PROC_CN_MCAST_LISTEN/IGNORE)
+    bool SendOperation(int fd, proc_cn_mcast_op operation)
+    {
+        char buffer[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+        auto header = reinterpret_cast<nlmsghdr *>(buffer);
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        header->nlmsg_type = NLMSG_DONE;
+        header->nlmsg_pid = 0;
+
+        auto message = static_cast<cn_msg *>(NLMSG_DATA(header));
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(proc_cn_mcast_op);
+        memcpy(message->data, &operation, sizeof(operation));
+
+        return send(fd, buffer, header->nlmsg_len, 0) >= 0;
+    }
+
+    // Returns the parent of <pid>, 0 if the process is gone
+    uint32_t ReadParent(uint32_t pid)
+    {
+        system_metrics::ProcFile file("/proc/" + std::to_string(pid) + "/stat", 1024);
+        system_metrics::proc_parser::PidStat stat;
+        if (file.Read() && system_metrics::proc_parser::ParsePidStat(file.Data(), file.Size(), stat))
+        {
+            return stat.ppid;
+        }
+        return 0;
+    }
+}
+
+namespace system_metrics
+{
+    ProcEventTracker::ProcEventTracker(uint32_t root) : m_fd(-1),
+                                                        m_poller(root),
+                                                        m_buffer(16384),
+                                                        m_changed(false)
+    {
+        // Listen before reading the initial tree, so no fork is lost in between
+        if (subscribe())
+        {
+            resync();
+        }
+    }
+
+    ProcEventTracker::~ProcEventTracker()
+    {
+        if (m_fd >= 0)
+        {
+            SendOperation(m_fd, PROC_CN_MCAST_IGNORE);
+            close(m_fd);
+        }
+    }
+
+    bool ProcEventTracker::subscribe()
+    {
+        m_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        // Joining the CN_IDX_PROC group fails with EPERM without CAP_NET_ADMIN
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            !SendOperation(m_fd, PROC_CN_MCAST_LISTEN))
+        {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    const std::vector<uint32_t> &ProcEventTracker::Descendants() const
+    {
+        return IsEventDriven() ? m_descendants : m_poller.Descendants();
+    }
+
+    bool ProcEventTracker::inTree(uint32_t pid) const
+    {
+        return pid == Root() || m_parents.count(pid) != 0;
+    }
+
+    void ProcEventTracker::resync()
+    {
+        m_poller.Refresh();
+        m_parents.clear();
+        m_orphans.clear();
+        for (auto pid : m_poller.Descendants())
+        {
+            m_parents[pid] = ReadParent(pid);
+        }
+        // The tree is usable right away: a snapshot taken before the first refresh covers it already
+        m_descendants = m_poller.Descendants();
+        m_changed = true;
+
+        // Events keep the tree from now on, until the next resync
+        m_poller.Close();
+    }
+
+    bool ProcEventTracker::Refresh()
+    {
+        if (!IsEventDriven())
+        {
+            bool changed = m_poller.Refresh();
+            m_forks = m_poller.Forks();
+            m_exits = m_poller.Exits();
+            return changed;
+        }
+
+        while (true)
+        {
+            ssize_t size = recv(m_fd, m_buffer.data(), m_buffer.size(), MSG_DONTWAIT);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == ENOBUFS)
+                {
+                    // The socket overflowed and events were lost: the cached tree cannot be trusted
+                    resync();
+                    continue;
+                }
+                break;
+            }
+
+            int length = static_cast<int>(size);
+            for (auto header = reinterpret_cast<nlmsghdr *>(m_buffer.data());
+                 NLMSG_OK(header, length);
+                 header = NLMSG_NEXT(header, length))
+            {
+                if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+                    continue;
+                auto message = static_cast<const cn_msg *>(NLMSG_DATA(header));
+                if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+                    continue;
+                handle(message->data);
+            }
+        }
+        adoptOrphans();
+
+        if (!m_changed)
+        {
+            return false;
+        }
+        m_changed = false;
+        m_descendants.clear();
+        for (const auto &entry : m_parents)
+        {
+            m_descendants.push_back(entry.first);
+        }
+        std::sort(m_descendants.begin(), m_descendants.end());
+        return true;
+    }
+
+    void ProcEventTracker::handle(const void *data)
+    {
+        auto event = static_cast<const proc_event *>(data);
+        switch (event->what)
+        {
+        case proc_event::PROC_EVENT_FORK:
+        {
+            const auto &forked = event->event_data.fork;
+            // New threads are reported as forks as well
+            if (forked.child_pid != forked.child_tgid)
+                return;
+            if (inTree(forked.parent_tgid))
+            {
+                m_parents[forked.child_tgid] = forked.parent_tgid;
+                ++m_forks;
+                m_changed = true;
+            }
+            break;
+        }
+        case proc_event::PROC_EVENT_EXIT:
+        {
+            const auto &exited = event->event_data.exit;
+            if (exited.process_pid != exited.process_tgid || !inTree(exited.process_tgid))
+                return;
+
+            // The children are reparented after the event is sent: check where they went on refresh
+            uint32_t pid = exited.process_tgid;
+            for (const auto &entry : m_parents)
+            {
+                if (entry.second == pid)
+                    m_orphans.push_back(entry.first);
+            }
+            if (pid != Root())
+            {
+                m_parents.erase(pid);
+                ++m_exits;
+                m_changed = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void ProcEventTracker::removeSubtree(uint32_t pid)
+    {
+        if (m_parents.erase(pid) == 0)
+        {
+            return;
+        }
+        ++m_exits;
+        m_changed = true;
+
+        std::vector<uint32_t> children;
+        for (const auto &entry : m_parents)
+        {
+            if (entry.second == pid)
+                children.push_back(entry.first);
+        }
+        for (auto child : children)
+        {
+            removeSubtree(child);
+        }
+    }
+
+    void ProcEventTracker::adoptOrphans()
+    {
+        auto orphans = std::move(m_orphans);
+        m_orphans.clear();
+        for (auto pid : orphans)
+        {
+            auto it = m_parents.find(pid);
+            if (it == m_parents.end())
+                continue;
+
+            uint32_t parent = ReadParent(pid);
+            if (parent == it->second)
+            {
+                // Not reparented yet
+                m_orphans.push_back(pid);
+            }
+            else if (parent != 0 && inTree(parent))
+            {
+                // Adopted by a subreaper inside the tree
+                it->second = parent;
+            }
+            else
+            {
+                removeSubtree(pid);
+            }
+        }
+    }
+}
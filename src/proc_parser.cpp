@@ -0,0 +1,264 @@
+#include "proc_parser.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace system_metrics
+{
+    namespace proc_parser
+    {
+        namespace
+        {
+            // Returns true if the line at <p> starts with <key>
+            bool StartsWith(const char *p, const char *end, const char *key, size_t key_size)
+            {
+                return static_cast<size_t>(end - p) >= key_size && memcmp(p, key, key_size) == 0;
+            }
+        }
+
+        CpuTimes ParseCpuTimes(const char *data, size_t size)
+        {
+            /*
+            /proc/stat
+                cpu 10132153 290696 3084719 46828483 16683 0 25195 0 175628 0
+                    user nice system idle iowait irq softirq steal guest guest_nice
+            */
+            CpuTimes result;
+            const char *p = data;
+            const char *end = data + size;
+            if (!StartsWith(p, end, "cpu ", 4))
+                return result;
+            p += 4;
+
+            result.user = ParseU64(p, end);
+            result.nice = ParseU64(p, end);
+            result.system = ParseU64(p, end);
+            result.idle = ParseU64(p, end);
+            result.iowait = ParseU64(p, end);
+            result.irq = ParseU64(p, end);
+            result.softirq = ParseU64(p, end);
+            result.steal = ParseU64(p, end);
+            result.guest = ParseU64(p, end);
+            result.guest_nice = ParseU64(p, end);
+            return result;
+        }
+
+        bool ParsePidStat(const char *data, size_t size, PidStat &result)
+        {
+            /*
+            /proc/[pid]/stat
+                (1) pid  %d
+                (2) comm  %s   The filename of the executable, in parentheses.
+                               It may contain spaces and parentheses itself.
+                (3) state  %c
+                (4) ppid  %d
+                    ...
+                (14) utime  %lu
+                (15) stime  %lu
+                (16) cutime  %ld
+                (17) cstime  %ld
+                    ...
+                (20) num_threads  %ld
+                    ...
+                (22) starttime  %llu
+                (23) vsize  %lu
+                (24) rss  %ld
+            */
+            const char *end = data + size;
+            const char *p = end;
+            while (p > data && *(p - 1) != ')')
+                --p;
+            if (p == data)
+                return false;
+
+            p = SkipSpaces(p, end);
+            if (p >= end)
+                return false;
+            result.state = *p++;                                  // (3)
+            result.ppid = static_cast<uint32_t>(ParseU64(p, end)); // (4)
+            p = SkipFields(p, end, 9);                            // (5) - (13)
+            result.utime = ParseU64(p, end);                      // (14)
+            result.stime = ParseU64(p, end);                      // (15)
+            result.cutime = ParseU64(p, end);                     // (16)
+            result.cstime = ParseU64(p, end);                     // (17)
+            p = SkipFields(p, end, 2);                            // (18) - (19)
+            result.num_threads = ParseU64(p, end);                // (20)
+            p = SkipFields(p, end, 1);                            // (21)
+            result.starttime = ParseU64(p, end);                  // (22)
+            result.vsize = ParseU64(p, end);                      // (23)
+            result.rss = ParseU64(p, end);                        // (24)
+            return true;
+        }
+
+        bool ParsePidComm(const char *data, size_t size, char *comm, size_t capacity)
+        {
+            // "pid (comm) state ...": comm runs from the first '(' to the last ')'
+            const char *begin = static_cast<const char *>(memchr(data, '(', size));
+            const char *end = data + size;
+            while (end > data && *(end - 1) != ')')
+                --end;
+            if (begin == nullptr || end <= begin + 1 || capacity == 0)
+                return false;
+            size_t length = std::min(static_cast<size_t>(end - 1 - (begin + 1)), capacity - 1);
+            memcpy(comm, begin + 1, length);
+            comm[length] = '\0';
+            return true;
+        }
+
+        Meminfo ParseMeminfo(const char *data, size_t size)
+        {
+            /*
+            /proc/meminfo
+                MemTotal:       16316412 kB
+                MemFree:         1034148 kB
+                MemAvailable:    9530880 kB
+                Buffers:          611420 kB
+                Cached:          7693128 kB
+                    ...
+                SwapTotal:       2097148 kB
+                SwapFree:        2097148 kB
+            */
+            struct Key
+            {
+                const char *name;
+                size_t size;
+                uint64_t Meminfo::*field;
+            };
+            static const Key keys[] = {
+                {"MemTotal:", 9, &Meminfo::total},
+                {"MemFree:", 8, &Meminfo::free},
+                {"MemAvailable:", 13, &Meminfo::available},
+                {"Buffers:", 8, &Meminfo::buffers},
+                {"Cached:", 7, &Meminfo::cached},
+                {"SwapTotal:", 10, &Meminfo::swap_total},
+                {"SwapFree:", 9, &Meminfo::swap_free},
+            };
+            const size_t key_count = sizeof(keys) / sizeof(keys[0]);
+
+            Meminfo result;
+            const char *p = data;
+            const char *end = data + size;
+            size_t found = 0;
+            while (p < end && found < key_count)
+            {
+                for (const auto &key : keys)
+                {
+                    if (StartsWith(p, end, key.name, key.size))
+                    {
+                        p += key.size;
+                        result.*key.field = ParseU64(p, end);
+                        ++found;
+                        break;
+                    }
+                }
+                p = NextLine(p, end);
+            }
+            return result;
+        }
+
+        Statm ParseStatm(const char *data, size_t size)
+        {
+            /*
+            /proc/[pid]/statm
+                size       (1) total program size
+                resident   (2) resident set size
+                shared     (3) number of resident shared pages
+                    ...
+            */
+            Statm result;
+            const char *p = data;
+            const char *end = data + size;
+            result.size = ParseU64(p, end);
+            result.resident = ParseU64(p, end);
+            result.shared = ParseU64(p, end);
+            return result;
+        }
+
+        bool ParseSmapsRollup(const char *data, size_t size, SmapsRollup &result)
+        {
+            /*
+            /proc/[pid]/smaps_rollup (since Linux 4.14)
+                56551596f000-7ffccc7f1000 ---p 00000000 00:00 0                          [rollup]
+                Rss:                1252 kB
+                Pss:                 432 kB
+                    ...
+                Private_Clean:        52 kB
+                Private_Dirty:       100 kB
+                    ...
+                Anonymous:           100 kB
+                    ...
+                Swap:                  0 kB
+                SwapPss:               0 kB
+                Locked:                0 kB
+            */
+            struct Key
+            {
+                const char *name;
+                size_t size;
+                uint64_t SmapsRollup::*field;
+            };
+            static const Key keys[] = {
+                {"Rss:", 4, &SmapsRollup::rss},
+                {"Pss:", 4, &SmapsRollup::pss},
+                {"Private_Clean:", 14, &SmapsRollup::private_clean},
+                {"Private_Dirty:", 14, &SmapsRollup::private_dirty},
+                {"Anonymous:", 10, &SmapsRollup::anonymous},
+                {"Swap:", 5, &SmapsRollup::swap},
+                {"SwapPss:", 8, &SmapsRollup::swap_pss},
+            };
+            const size_t key_count = sizeof(keys) / sizeof(keys[0]);
+
+            result = SmapsRollup();
+            const char *end = data + size;
+            const char *p = NextLine(data, end); // The [rollup] header
+            size_t found = 0;
+            bool has_rss = false;
+            while (p < end && found < key_count)
+            {
+                for (const auto &key : keys)
+                {
+                    // Comparing the first character first rules out most keys cheaply
+                    if (*p == *key.name && StartsWith(p, end, key.name, key.size))
+                    {
+                        p += key.size;
+                        result.*key.field = ParseU64(p, end);
+                        has_rss |= key.field == &SmapsRollup::rss;
+                        ++found;
+                        break;
+                    }
+                }
+                p = NextLine(p, end);
+            }
+            return has_rss;
+        }
+
+        PidIo ParsePidIo(const char *data, size_t size)
+        {
+            /*
+            /proc/[pid]/io
+                rchar: 323934931
+                wchar: 323929600
+                syscr: 632687
+                syscw: 632675
+                read_bytes: 0
+                write_bytes: 323932160
+                cancelled_write_bytes: 0
+            */
+            PidIo result;
+            uint64_t *fields[] = {&result.rchar, &result.wchar, &result.syscr, &result.syscw,
+                                  &result.read_bytes, &result.write_bytes, &result.cancelled_write_bytes};
+            const char *p = data;
+            const char *end = data + size;
+            for (auto field : fields)
+            {
+                while (p < end && *p != ':')
+                    ++p;
+                if (p >= end)
+                    break;
+                ++p;
+                *field = ParseU64(p, end);
+            }
+            return result;
+        }
+    }
+}
@@ -0,0 +1,245 @@
+#include "proc_reader.hpp"
+#include "self_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace system_metrics
+{
+    ProcFile::ProcFile(std::string path, size_t capacity) : m_path(std::move(path)),
+                                                            m_fd(-1),
+                                                            m_error(0),
+                                                            m_buffer(capacity + 1, '\0'),
+                                                            m_size(0)
+    {
+    }
+
+    ProcFile::~ProcFile()
+    {
+        Close();
+    }
+
+    ProcFile::ProcFile(ProcFile &&other) noexcept : m_path(std::move(other.m_path)),
+                                                    m_fd(other.m_fd),
+                                                    m_error(other.m_error),
+                                                    m_buffer(std::move(other.m_buffer)),
+                                                    m_size(other.m_size)
+    {
+        other.m_fd = -1;
+        other.m_size = 0;
+    }
+
+    ProcFile &ProcFile::operator=(ProcFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            m_path = std::move(other.m_path);
+            m_fd = other.m_fd;
+            m_error = other.m_error;
+            m_buffer = std::move(other.m_buffer);
+            m_size = other.m_size;
+            other.m_fd = -1;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    bool ProcFile::open()
+    {
+        m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0)
+        {
+            m_error = errno;
+            return false;
+        }
+        ++ThreadWork().files_opened;
+        return true;
+    }
+
+    void ProcFile::Close()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    bool ProcFile::Read()
+    {
+        m_size = 0;
+        if (m_fd < 0 && !open())
+        {
+            return false;
+        }
+
+        // The last byte of the buffer is reserved for the terminating '\0'
+        size_t size = 0;
+        while (true)
+        {
+            size_t room = m_buffer.size() - 1 - size;
+            ssize_t count = pread(m_fd, m_buffer.data() + size, room, size);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                m_error = errno;
+                Close();
+                return false;
+            }
+            size += count;
+
+            // Procfs returns everything it has at once, so a short read means the end of file
+            if (static_cast<size_t>(count) < room)
+                break;
+
+            // The file did not fit: grow the buffer once and keep it for the next reads
+            m_buffer.resize(m_buffer.size() * 2);
+        }
+        m_buffer[size] = '\0';
+        m_size = size;
+        ThreadWork().bytes_read += size;
+        return true;
+    }
+
+    ProcReader::ProcReader() : m_stat("/proc/stat", 16384),
+                               m_meminfo("/proc/meminfo"),
+                               m_net_dev("/proc/net/dev"),
+                               m_has_rollup(access("/proc/self/smaps_rollup", F_OK) == 0),
+                               m_reserved(false)
+    {
+    }
+
+    const ProcFile *ProcReader::read(ProcFile &file)
+    {
+        return file.Read() ? &file : nullptr;
+    }
+
+    const ProcFile *ProcReader::Stat()
+    {
+        return read(m_stat);
+    }
+
+    const ProcFile *ProcReader::Meminfo()
+    {
+        return read(m_meminfo);
+    }
+
+    const ProcFile *ProcReader::NetDev()
+    {
+        return read(m_net_dev);
+    }
+
+    ProcReader::PidFiles ProcReader::pidFiles(uint32_t pid)
+    {
+        std::string path = "/proc/" + std::to_string(pid);
+        return PidFiles{ProcFile(path + "/stat", 1024),
+                        ProcFile(path + "/statm", 256),
+                        ProcFile(path + "/io", 512),
+                        ProcFile(path + "/net/dev"),
+                        ProcFile(path + "/smaps_rollup", 2048),
+                        false};
+    }
+
+    const ProcFile *ProcReader::readPid(uint32_t pid, ProcFile PidFiles::*member)
+    {
+        auto it = m_pids.find(pid);
+        if (it == m_pids.end())
+        {
+            // The map must not change while other threads look pids up
+            if (m_reserved)
+                return nullptr;
+            it = m_pids.emplace(pid, pidFiles(pid)).first;
+        }
+
+        ProcFile &file = it->second.*member;
+        if (!file.IsOpen() && file.Error() == EACCES)
+        {
+            // Permissions do not change while the process lives, do not retry open(2) every tick
+            return nullptr;
+        }
+        if (file.Read())
+        {
+            return &file;
+        }
+
+        // An open descriptor of an exited process fails with ESRCH, and a new open fails with ENOENT.
+        // Any other error (e.g. EACCES on /proc/[pid]/io) concerns only this file.
+        if (file.Error() == ESRCH || file.Error() == ENOENT)
+        {
+            if (m_reserved)
+                it->second.exited = true;
+            else
+                m_pids.erase(it);
+        }
+        return nullptr;
+    }
+
+    const ProcFile *ProcReader::PidStat(uint32_t pid)
+    {
+        return readPid(pid, &PidFiles::stat);
+    }
+
+    const ProcFile *ProcReader::PidStatm(uint32_t pid)
+    {
+        return readPid(pid, &PidFiles::statm);
+    }
+
+    const ProcFile *ProcReader::PidIo(uint32_t pid)
+    {
+        return readPid(pid, &PidFiles::io);
+    }
+
+    const ProcFile *ProcReader::PidNetDev(uint32_t pid)
+    {
+        return readPid(pid, &PidFiles::net_dev);
+    }
+
+    const ProcFile *ProcReader::PidSmapsRollup(uint32_t pid)
+    {
+        // Without the file every open would fail with ENOENT, as if the process had exited
+        return m_has_rollup ? readPid(pid, &PidFiles::smaps_rollup) : nullptr;
+    }
+
+    void ProcReader::Retain(const std::vector<uint32_t> &pids)
+    {
+        std::vector<uint32_t> sorted(pids);
+        std::sort(sorted.begin(), sorted.end());
+        for (auto it = m_pids.begin(); it != m_pids.end();)
+        {
+            if (!std::binary_search(sorted.begin(), sorted.end(), it->first))
+            {
+                it = m_pids.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    void ProcReader::Reserve(const std::vector<uint32_t> &pids)
+    {
+        for (auto pid : pids)
+        {
+            if (m_pids.find(pid) == m_pids.end())
+                m_pids.emplace(pid, pidFiles(pid));
+        }
+        m_reserved = true;
+    }
+
+    void ProcReader::Settle()
+    {
+        m_reserved = false;
+        for (auto it = m_pids.begin(); it != m_pids.end();)
+        {
+            if (it->second.exited)
+                it = m_pids.erase(it);
+            else
+                ++it;
+        }
+    }
+}
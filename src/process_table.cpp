@@ -0,0 +1,107 @@
+#include "process_table.hpp"
+
+namespace system_metrics
+{
+    ProcessTable::ProcessTable(size_t capacity) : m_mask(0),
+                                                  m_size(0)
+    {
+        size_t slots = 16;
+        while (slots < capacity)
+            slots *= 2;
+        m_slots.resize(slots);
+        m_mask = slots - 1;
+    }
+
+    size_t ProcessTable::home(uint32_t pid, uint64_t starttime) const
+    {
+        // Consecutive pids started at close times must not land on consecutive slots: mix every bit
+        uint64_t key = (static_cast<uint64_t>(pid) << 32) ^ starttime;
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return static_cast<size_t>(key) & m_mask;
+    }
+
+    ProcessState &ProcessTable::Insert(uint32_t pid, uint64_t starttime)
+    {
+        size_t slot = home(pid, starttime);
+        while (m_slots[slot].pid != 0)
+        {
+            if (m_slots[slot].pid == pid && m_slots[slot].starttime == starttime)
+                return m_slots[slot];
+            slot = (slot + 1) & m_mask;
+        }
+
+        // Linear probing degrades quickly past half full
+        if (2 * (m_size + 1) > m_slots.size())
+        {
+            grow();
+            return Insert(pid, starttime);
+        }
+        ++m_size;
+        m_slots[slot].pid = pid;
+        m_slots[slot].starttime = starttime;
+        return m_slots[slot];
+    }
+
+    const ProcessState *ProcessTable::Find(uint32_t pid, uint64_t starttime) const
+    {
+        for (size_t slot = home(pid, starttime); m_slots[slot].pid != 0; slot = (slot + 1) & m_mask)
+        {
+            if (m_slots[slot].pid == pid && m_slots[slot].starttime == starttime)
+                return &m_slots[slot];
+        }
+        return nullptr;
+    }
+
+    size_t ProcessTable::Evict(uint64_t generation)
+    {
+        size_t removed = 0;
+        for (size_t slot = 0; slot < m_slots.size(); slot++)
+        {
+            // A live entry of the probe sequence may move into the slot: look at it again
+            while (m_slots[slot].pid != 0 && m_slots[slot].generation != generation)
+            {
+                erase(slot);
+                ++removed;
+            }
+        }
+        return removed;
+    }
+
+    void ProcessTable::erase(size_t slot)
+    {
+        /*
+        Backward shift deletion: an entry further down the probe sequence moves into the hole unless its
+        home lies cyclically within (hole, entry], where it would be found without passing the hole.
+        Entries only ever move back along their own sequence; when the sequence wraps past the end
+        of the slots, what moves to the front was already visited by Evict() and is alive
+        */
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & m_mask; m_slots[next].pid != 0; next = (next + 1) & m_mask)
+        {
+            size_t from = home(m_slots[next].pid, m_slots[next].starttime);
+            bool reachable = hole <= next ? (hole < from && from <= next) : (hole < from || from <= next);
+            if (reachable)
+                continue;
+            m_slots[hole] = m_slots[next];
+            hole = next;
+        }
+        m_slots[hole] = ProcessState();
+        --m_size;
+    }
+
+    void ProcessTable::grow()
+    {
+        std::vector<ProcessState> slots(m_slots.size() * 2);
+        slots.swap(m_slots);
+        m_mask = m_slots.size() - 1;
+        m_size = 0;
+        for (const auto &state : slots)
+        {
+            if (state.pid == 0)
+                continue;
+            Insert(state.pid, state.starttime) = state;
+        }
+    }
+}
@@ -0,0 +1,252 @@
+#include "process_tree.hpp"
+#include "proc_parser.hpp"
+#include "self_stats.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/range/iterator_range.hpp>
+
+namespace
+{
+    // Returns true if <name> consists of digits only
+    bool IsPidName(const std::string &name)
+    {
+        return !name.empty() && std::all_of(name.begin(), name.end(), [](char c)
+                                            { return c >= '0' && c <= '9'; });
+    }
+
+    // Returns true if <file> holds a /proc/[pid]/stat that can be parsed
+    bool ReadPidStat(system_metrics::ProcFile &file, system_metrics::proc_parser::PidStat &stat)
+    {
+        return file.Read() && system_metrics::proc_parser::ParsePidStat(file.Data(), file.Size(), stat);
+    }
+}
+
+namespace system_metrics
+{
+    DescendantTracker::DescendantTracker(uint32_t root, WorkerPool *pool) : m_root(root),
+                                                                           m_fallback(false),
+                                                                           m_pool(pool)
+    {
+        /*
+        /proc/[pid]/task/[tid]/children (since Linux 3.5)
+              A space-separated list of child tasks of this task.
+              This file is provided if the kernel is built with
+              CONFIG_PROC_CHILDREN.
+        */
+        std::string self = std::to_string(getpid());
+        boost::system::error_code error;
+        m_fallback = !boost::filesystem::exists("/proc/" + self + "/task/" + self + "/children", error);
+        Refresh();
+
+        // Processes found by the first refresh were already there
+        m_forks = 0;
+    }
+
+    DescendantTracker::Node *DescendantTracker::addNode(uint32_t pid)
+    {
+        Node node;
+        node.stat = ProcFile("/proc/" + std::to_string(pid) + "/stat", 1024);
+        if (!node.stat.Read())
+        {
+            return nullptr;
+        }
+        return &m_nodes.emplace(pid, std::move(node)).first->second;
+    }
+
+    void DescendantTracker::updateThreads(uint32_t pid, Node &node, uint64_t num_threads)
+    {
+        if (node.threads.size() == num_threads)
+        {
+            return;
+        }
+
+        node.threads.clear();
+        std::string path = "/proc/" + std::to_string(pid) + "/task";
+        boost::system::error_code error;
+        ++ThreadWork().files_opened;
+        for (auto &entry : boost::make_iterator_range(boost::filesystem::directory_iterator(path, error), {}))
+        {
+            node.threads.emplace_back(entry.path().string() + "/children", 256);
+        }
+    }
+
+    bool DescendantTracker::readChildren(uint32_t pid, Node &node)
+    {
+        proc_parser::PidStat stat;
+        if (!ReadPidStat(node.stat, stat))
+        {
+            return false;
+        }
+        updateThreads(pid, node, stat.num_threads);
+
+        node.children.clear();
+        bool stale = false;
+        for (auto &file : node.threads)
+        {
+            if (!file.Read())
+            {
+                // The thread has exited, maybe replaced by a new one: list the threads again next time
+                stale = true;
+                continue;
+            }
+            const char *p = file.Data();
+            const char *end = p + file.Size();
+            while (true)
+            {
+                p = proc_parser::SkipSpaces(p, end);
+                if (p >= end || *p < '0' || *p > '9')
+                    break;
+                node.children.push_back(static_cast<uint32_t>(proc_parser::ParseU64(p, end)));
+            }
+        }
+        if (stale)
+        {
+            node.threads.clear();
+        }
+        return true;
+    }
+
+    bool DescendantTracker::Refresh()
+    {
+        if (m_fallback)
+        {
+            return refreshByScan();
+        }
+
+        // Breadth-first walk over the subtree. Exited processes are marked with 0
+        auto &queue = m_scratch;
+        queue.clear();
+        queue.push_back(m_root);
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            uint32_t pid = queue[i];
+            auto it = m_nodes.find(pid);
+            Node *node = it != m_nodes.end() ? &it->second : addNode(pid);
+            if (node == nullptr || !readChildren(pid, *node))
+            {
+                m_nodes.erase(pid);
+                queue[i] = 0;
+                continue;
+            }
+            queue.insert(queue.end(), node->children.begin(), node->children.end());
+        }
+
+        std::vector<uint32_t> descendants;
+        descendants.reserve(queue.size());
+        for (size_t i = 1; i < queue.size(); i++)
+        {
+            if (queue[i] != 0)
+                descendants.push_back(queue[i]);
+        }
+        std::sort(descendants.begin(), descendants.end());
+
+        // Forget the nodes which left the subtree (exited, or reparented after their parent exited)
+        for (auto it = m_nodes.begin(); it != m_nodes.end();)
+        {
+            if (it->first != m_root && !std::binary_search(descendants.begin(), descendants.end(), it->first))
+                it = m_nodes.erase(it);
+            else
+                ++it;
+        }
+
+        return update(descendants);
+    }
+
+    bool DescendantTracker::refreshByScan()
+    {
+        // Every process of the system, then its parent, stat by stat on the workers
+        auto &pids = m_scratch;
+        pids.clear();
+        boost::system::error_code error;
+        ++ThreadWork().files_opened;
+        for (auto &entry : boost::make_iterator_range(boost::filesystem::directory_iterator("/proc", error), {}))
+        {
+            std::string name = entry.path().filename().string();
+            if (IsPidName(name))
+                pids.push_back(static_cast<uint32_t>(std::stoul(name)));
+        }
+
+        m_parents.resize(m_pool != nullptr ? m_pool->Workers() : 1);
+        for (auto &found : m_parents)
+        {
+            found.clear();
+        }
+        auto read = [this, &pids](size_t worker, size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                ProcFile file("/proc/" + std::to_string(pids[i]) + "/stat", 1024);
+                proc_parser::PidStat stat;
+                if (ReadPidStat(file, stat))
+                    m_parents[worker].emplace_back(stat.ppid, pids[i]);
+            }
+        };
+        if (m_pool != nullptr)
+            m_pool->ForEach(pids.size(), read);
+        else
+            read(0, 0, pids.size());
+
+        // (ppid, pid) of every process of the system
+        std::vector<std::pair<uint32_t, uint32_t>> parents;
+        for (const auto &found : m_parents)
+        {
+            parents.insert(parents.end(), found.begin(), found.end());
+        }
+        std::sort(parents.begin(), parents.end());
+
+        std::vector<uint32_t> descendants;
+        auto &queue = m_scratch;
+        queue.clear();
+        queue.push_back(m_root);
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            auto range = std::equal_range(parents.begin(), parents.end(), std::make_pair(queue[i], 0u),
+                                          [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b)
+                                          { return a.first < b.first; });
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                queue.push_back(it->second);
+                descendants.push_back(it->second);
+            }
+        }
+        std::sort(descendants.begin(), descendants.end());
+
+        return update(descendants);
+    }
+
+    bool DescendantTracker::update(std::vector<uint32_t> &descendants)
+    {
+        if (descendants == m_descendants)
+        {
+            return false;
+        }
+
+        // Both are sorted: count the pids present in only one of them
+        auto old_it = m_descendants.begin();
+        auto new_it = descendants.begin();
+        while (old_it != m_descendants.end() || new_it != descendants.end())
+        {
+            if (new_it == descendants.end() || (old_it != m_descendants.end() && *old_it < *new_it))
+            {
+                ++m_exits;
+                ++old_it;
+            }
+            else if (old_it == m_descendants.end() || *new_it < *old_it)
+            {
+                ++m_forks;
+                ++new_it;
+            }
+            else
+            {
+                ++old_it;
+                ++new_it;
+            }
+        }
+        m_descendants.swap(descendants);
+        return true;
+    }
+}
@@ -1,6 +1,15 @@
 #include "rb_metrics.hpp"
+#include "system_metrics.hpp"
+#include "sampler.hpp"
+#include "proc_parser.hpp"
+#include "net_interfaces.hpp"
+#include "process_tree.hpp"
+#include "self_stats.hpp"
+#include "block_devices.hpp"
+#include <time.h>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <fstream>
 #include <sys/types.h>
@@ -14,83 +23,96 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/trim_all.hpp>
-#include <boost/algorithm/algorithm.hpp>
 
 uint32_t Rb_metrics::GetGeneralCpuUsage()
 {
-    return getCpuUsage();
+    return measure().general_cpu;
 }
 
 uint32_t Rb_metrics::GetCpuUsage()
 {
-    return getCpuUsage(m_pid);
+    return measure().targets[0].cpu;
 }
 
 uint32_t Rb_metrics::GetGeneralRamUsage()
 {
-    return getRamUsage();
+    return measure().general_ram;
 }
 
 uint32_t Rb_metrics::GetRamUsage()
 {
-    return getRamUsage(m_pid);
+    return measure().targets[0].ram;
 }
 
 uint32_t Rb_metrics::GetGeneralRamUsage_m()
 {
-    return getRamUsage_m();
+    return measure().general_ram_m;
 }
 
 uint32_t Rb_metrics::GetRamUsage_m()
 {
-    return getRamUsage_m(m_pid);
+    return measure().targets[0].ram_m;
+}
+
+system_metrics::MemoryUsage Rb_metrics::GetMemoryUsage()
+{
+    return measure().targets[0].memory;
 }
 
 std::pair<uint64_t, uint64_t> Rb_metrics::GetGeneralNetUsage()
 {
-    return getNetUsage();
+    return measure().general_net;
 }
 
 std::pair<uint64_t, uint64_t> Rb_metrics::GetNetUsage()
 {
-    return getNetUsage(m_pid);
+    return measure().targets[0].net;
 }
 
 std::pair<uint64_t, uint64_t> Rb_metrics::GetGeneralIoStats()
 {
-    return getIoStats();
+    return measure().general_io;
 }
 
 std::pair<uint64_t, uint64_t> Rb_metrics::GetIoStats()
 {
-    return getIoStats(m_pid);
+    return measure().targets[0].io;
 }
 
-// Common functions
-namespace system_metrics
+bool Rb_metrics::UseTaskstats(system_metrics::TaskstatsClient::Mode mode)
 {
-    // Returns the list of system's active network interfaces
-    std::vector<std::string> GetActiveNetInterfaces();
-
-    // Returns current total CPU times
-    uint32_t GetCpuSnapshot(unsigned int pid = 0);
-
-    // Returns total amount of RAM
-    uint32_t GetRamTotal();
-
-    // Returns amount occupied of RAM
-    uint32_t GetRamOccupied(unsigned int pid = 0);
+    std::unique_ptr<system_metrics::TaskstatsClient> taskstats(new system_metrics::TaskstatsClient(mode));
+    if (!taskstats->IsOpen())
+        return false;
+    m_sources.taskstats = std::move(taskstats);
+    return true;
+}
 
-    // Returns network using satistics (read, write) in kb
-    std::pair<uint64_t, uint64_t> ParseNetData(unsigned int pid = 0);
+system_metrics::Metrics Rb_metrics::measure()
+{
+    std::vector<system_metrics::TargetProcesses> targets{{m_pid, &m_children_pids, 0, 0, m_cgroup.get(), m_cgroup ? nullptr : &m_accounting}};
+    auto first = system_metrics::TakeSnapshot(m_sources, targets);
+    std::this_thread::sleep_for(std::chrono::seconds(m_period));
+    auto second = system_metrics::TakeSnapshot(m_sources, targets);
+    m_self.Record(first.costs);
+    m_self.Record(second.costs);
+    return system_metrics::ComputeMetrics(first, second);
+}
 
-    // Returns block devices using satistics (read, write) in kb
-    std::pair<uint64_t, uint64_t> ParseIoStats(unsigned int pid = 0);
+void Rb_metrics::SetWorkers(size_t workers)
+{
+    if (workers > 1)
+        m_sources.pool.reset(new system_metrics::WorkerPool(workers));
+    else
+        m_sources.pool.reset();
+    if (!m_cgroup)
+        m_children_pids = getAllChildren(m_pid, m_sources.pool.get());
+}
 
-    // Returns block device's sector size
-    uint32_t GetBlockDeviceSectorSize(std::string block_device);
+std::vector<uint32_t> Rb_metrics::getAllChildren(uint32_t pid, system_metrics::WorkerPool *pool)
+{
+    system_metrics::DescendantTracker tree(pid, pool);
+    return tree.Descendants();
 }
 
 // Returns parent process id of the provided parent process
@@ -111,12 +133,14 @@ uint32_t GetPpid(uint32_t pid)
     std::ifstream fin("/proc/" + std::to_string(pid) + "/stat");
     if (fin.is_open())
     {
-        std::string tmp;
-        for (int i = 0; i < 3; i++)
+        // (2) comm may contain spaces, so the line cannot be split into tokens
+        std::string line;
+        std::getline(fin, line);
+        system_metrics::proc_parser::PidStat stat;
+        if (system_metrics::proc_parser::ParsePidStat(line.data(), line.size(), stat))
         {
-            fin >> tmp;
+            result = stat.ppid;
         }
-        fin >> result;
         fin.close();
     }
     return result;
@@ -131,23 +155,6 @@ bool IsNumber(const std::string &data)
     return !data.empty() && it == data.end();
 }
 
-// Executes terminal command and returns the result.
-std::string ExecCommandWithResult(const char *cmd)
-{
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-    if (!pipe)
-    {
-        return result;
-    }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
-    {
-        result += buffer.data();
-    }
-    return result;
-}
-
 namespace system_metrics
 {
     uint32_t GetCpuSnapshot(uint32_t pid)
@@ -254,18 +261,17 @@ namespace system_metrics
                             .
                             .
                 */
-                std::string tmp;
-                for (int i = 0; i < 13; i++)
+                // (2) comm may contain spaces, so the line cannot be split into tokens
+                std::string line;
+                std::getline(fin, line);
+                proc_parser::PidStat stat;
+                if (proc_parser::ParsePidStat(line.data(), line.size(), stat))
                 {
-                    fin >> tmp;
+                    totalUser = stat.utime;
+                    totalUserLow = stat.stime;
+                    totalSys = stat.cutime;
+                    totalIdle = stat.cstime;
                 }
-                fin >> totalUser; // utime
-
-                fin >> totalUserLow; // stime
-
-                fin >> totalSys; // cutime
-
-                fin >> totalIdle; // cstime
             }
             fin.close();
         }
@@ -273,6 +279,27 @@ namespace system_metrics
         return total;
     }
 
+    std::pair<uint64_t, uint64_t> GetCpuTimes()
+    {
+        // Same as GetCpuSnapshot(), but keeps the idle time apart to get the busy time out of one read
+        std::pair<uint64_t, uint64_t> result{0, 0};
+        uint64_t totalUser = 0, totalUserLow = 0, totalSys = 0, totalIdle = 0;
+        std::ifstream fin("/proc/stat");
+        if (fin.is_open())
+        {
+            std::string tmp;
+            fin >> tmp; // cpu
+            fin >> totalUser;
+            fin >> totalUserLow;
+            fin >> totalSys;
+            fin >> totalIdle;
+            fin.close();
+        }
+        result.first = totalUser + totalUserLow + totalSys;
+        result.second = result.first + totalIdle;
+        return result;
+    }
+
     uint32_t GetRamTotal()
     {
         /*
@@ -393,7 +420,7 @@ namespace system_metrics
                      shared memory, mappings from tmpfs(5), and shared
                      anonymous mappings)
             */
-            uint32_t ramOccupied;
+            uint32_t ramOccupied = 0;
             std::ifstream fin("/proc/" + std::to_string(pid) + "/status");
             if (fin.is_open())
             {
@@ -416,13 +443,10 @@ namespace system_metrics
 
     std::vector<std::string> GetActiveNetInterfaces()
     {
-        std::vector<std::string> result;
-        std::string cmd = "ip addr | awk '/state UP/ {print $2}' | sed 's/.$//'";
-        std::string data = ExecCommandWithResult(cmd.c_str());
-        boost::replace_all(data, "\n", " ");
-        boost::trim_all(data);
-        boost::algorithm::split(result, data, boost::algorithm::is_any_of(" "), boost::token_compress_on);
-        return result;
+        // Interfaces are cached and kept up to date by netlink events, nothing is forked
+        static NetInterfaceRegistry registry;
+        registry.Update();
+        return registry.Active();
     }
 
     std::pair<uint64_t, uint64_t> ParseNetData(uint32_t pid)
@@ -459,6 +483,7 @@ namespace system_metrics
         std::ifstream fin(path);
         if (fin.is_open())
         {
+            auto active_interfaces = system_metrics::GetActiveNetInterfaces();
             std::string tmp;
             while (fin >> tmp)
             {
@@ -468,7 +493,7 @@ namespace system_metrics
                     tmp.erase(tmp.length() - 1, 1);
 
                     bool is_found = false;
-                    for (auto net_if : system_metrics::GetActiveNetInterfaces())
+                    for (const auto &net_if : active_interfaces)
                     {
                         if (tmp == net_if)
                         {
@@ -503,86 +528,25 @@ namespace system_metrics
         // Get general stats
         if (pid == 0)
         {
-            /* In order to get info about general number of IO operations,
-               we have to parse this data in /sys/block/[block_device_name]/stat
-               for each active block device in the system
-
-            This file documents the contents of the /sys/block/<dev>/stat file.
-
-            The stat file provides several statistics about the state of block
-            device <dev>.
-            Name            units         description
-            ----            -----         -----------
-            read I/Os       requests      number of read I/Os processed
-            read merges     requests      number of read I/Os merged with in-queue I/O
-        *---read sectors    sectors       number of sectors read
-            read ticks      milliseconds  total wait time for read requests
-            write I/Os      requests      number of write I/Os processed
-            write merges    requests      number of write I/Os merged with in-queue I/O
-        *---write sectors   sectors       number of sectors written
-            write ticks     milliseconds  total wait time for write requests
-            in_flight       requests      number of I/Os currently in flight
-            io_ticks        milliseconds  total time this block device has been active
-            time_in_queue   milliseconds  total wait time for all requests
-            discard I/Os    requests      number of discard I/Os processed
-            discard merges  requests      number of discard I/Os merged with in-queue I/O
-            discard sectors sectors       number of sectors discarded
-            discard ticks   milliseconds  total wait time for discard requests
-            */
-
-            boost::filesystem::path path("/sys/block/");
-            std::vector<std::string> block_devices;
-            for (auto &entry : boost::make_iterator_range(boost::filesystem::directory_iterator(path), {}))
+            /* Every block device is in a single read of /proc/diskstats, see BlockDevices for the
+               devices counted. Its sectors are 512 bytes whatever the sector size of the device */
+            static std::mutex mutex;
+            static BlockDevices devices;
+            static std::vector<DiskSnapshot> disks;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (devices.Read(disks))
             {
-                // Skip every block device that contains 'loop' in its name
-                if (entry.path().filename().string().find("loop") != std::string::npos)
+                for (const auto &disk : disks)
                 {
-                    continue;
+                    result.first += disk.counters.sectors_read;
+                    result.second += disk.counters.sectors_written;
                 }
-                block_devices.push_back(entry.path().filename().string());
             }
 
-            // Iterate over each block device and collect its data
-            for (auto &block_device : block_devices)
-            {
-                boost::filesystem::path tmp_path(path.string() + "/" + block_device + "/stat");
-                if (boost::filesystem::is_regular_file(tmp_path))
-                {
-                    std::ifstream fin(tmp_path.string());
-                    if (fin.is_open())
-                    {
-
-                        std::string tmp;
-                        uint64_t readed = 0, written = 0;
-                        for (int i = 0; i < 2; i++)
-                        {
-                            fin >> tmp;
-                        }
-
-                        // field 3 - read sectors
-                        fin >> readed;
-
-                        for (int i = 0; i < 3; i++)
-                        {
-                            fin >> tmp;
-                        }
-
-                        // field 7 - write sectors
-                        fin >> written;
-
-                        fin.close();
-
-                        // Sector may be differ for each block device, so we collect only byte amount in result
-                        auto sector_size = system_metrics::GetBlockDeviceSectorSize(block_device);
-                        result.first += (readed * sector_size);
-                        result.second += (written * sector_size);
-                    }
-                }
-            }
-
-            // Result now is in bytes. We need it in kilobytes
-            result.second /= 1024;
-            result.first /= 1024;
+            // Result now is in sectors. We need it in kilobytes
+            result.second /= 2;
+            result.first /= 2;
         }
 
         else
@@ -669,214 +633,39 @@ namespace system_metrics
         std::ifstream fin("/sys/block/" + block_device + "/queue/hw_sector_size");
         if (fin.is_open())
         {
+            ++ThreadWork().files_opened;
             fin >> size;
             fin.close();
         }
         return size;
     }
-}
 
-uint32_t Rb_metrics::getCpuUsage(unsigned int pid) // = 0
-{
-    uint32_t result = 0.00;
-    if (pid == 0)
+    std::vector<uint32_t> GetChildren(uint32_t pid)
     {
-        uint32_t last_totalUser, last_totalUserLow, last_totalSys, last_totalIdle, last_total;
-        std::ifstream fin("/proc/stat");
-        if (fin.is_open())
-        {
-            std::string tmp;
-            fin >> tmp; // cpu
-            fin >> last_totalUser;
-            fin >> last_totalUserLow;
-            fin >> last_totalSys;
-            fin >> last_totalIdle;
-            fin.close();
-        }
-
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-
-        uint32_t totalUser, totalUserLow, totalSys, totalIdle, total;
-        fin.open("/proc/stat");
-        if (fin.is_open())
+        std::vector<unsigned int> result;
+        if (boost::filesystem::is_directory("/proc"))
         {
-            std::string tmp;
-            fin >> tmp;
-            fin >> totalUser;
-            fin >> totalUserLow;
-            fin >> totalSys;
-            fin >> totalIdle;
-            fin.close();
-        }
-
-        if (totalUser < last_totalUser || totalUserLow < last_totalUserLow ||
-            totalSys < last_totalSys || totalIdle < last_totalIdle)
-        {
-            // Overflow detection. Just skip this value.
-            result = 0;
-            return result;
-        }
-        total = (totalUser - last_totalUser) + (totalUserLow - last_totalUserLow) +
-                (totalSys - last_totalSys);
-        result = total;
-
-        // We cannot use GetCpuSnapshot() because of this line
-        total += (totalIdle - last_totalIdle);
-        result *= 100;
-        result /= total;
-    }
-
-    else
-    {
-        auto totalTime1 = system_metrics::GetCpuSnapshot();
-        auto procTime1 = system_metrics::GetCpuSnapshot(pid);
-        // plus kid times
-
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-
-        auto totalTime2 = system_metrics::GetCpuSnapshot();
-        auto procTime2 = system_metrics::GetCpuSnapshot(pid);
-        // plus kid times
-
-        result += 100 * (procTime2 - procTime1);
-        result /= (totalTime2 - totalTime1);
-    }
-    return result;
-}
-
-uint32_t Rb_metrics::getRamUsage(unsigned int pid) // = 0
-{
-    uint32_t result = 0;
-    auto totalRam = system_metrics::GetRamTotal();
-    unsigned long long occRam = 0;
-    occRam = system_metrics::GetRamOccupied(pid);
-    if (pid != 0)
-    {
-        for (auto child : m_children_pids)
-        {
-            occRam += system_metrics::GetRamOccupied(child);
-        }
-    }
-    result += (occRam * 100);
-    result /= totalRam;
-    return result;
-}
-
-uint32_t Rb_metrics::getRamUsage_m(uint32_t pid) // = 0
-{
-    uint32_t result = 0;
-    result = system_metrics::GetRamOccupied(pid);
-    if (pid != 0)
-    {
-        for (auto child : m_children_pids)
-        {
-            result += system_metrics::GetRamOccupied(child);
-        }
-    }
-    // Result is in kilobytes. Return in megabytes.
-    result /= 1024;
-    return result;
-}
-
-std::pair<uint64_t, uint64_t> Rb_metrics::getNetUsage(uint32_t pid) // = 0
-{
-    std::pair<uint64_t, uint64_t> result{0, 0};
-    if (pid == 0)
-    {
-        auto tmp = system_metrics::ParseNetData();
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-        result = system_metrics::ParseNetData();
-        result.first -= tmp.first;
-        result.second -= tmp.second;
-    }
-    else
-    {
-        auto tmp = system_metrics::ParseNetData(pid);
-        // Collect children data
-        for (auto kid : m_children_pids)
-        {
-            auto inner_tmp = system_metrics::ParseNetData(kid);
-            tmp.first += inner_tmp.first;
-            tmp.second += inner_tmp.second;
-        }
-
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-
-        result = system_metrics::ParseNetData(pid);
-        for (auto kid : m_children_pids)
-        {
-            auto inner_tmp = system_metrics::ParseNetData(kid);
-            result.first += inner_tmp.first;
-            result.second += inner_tmp.second;
-        }
-
-        result.first -= tmp.first;
-        result.second -= tmp.second;
-    }
-    // Parsed data is in bytes/sec. We need kb/sec.
-    result.first /= 1024;
-    result.second /= 1024;
-    return result;
-}
-
-std::pair<uint64_t, uint64_t> Rb_metrics::getIoStats(uint32_t pid) // = 0
-{
-    std::pair<uint64_t, uint64_t> result{0, 0};
-    if (pid == 0)
-    {
-        auto tmp = system_metrics::ParseIoStats();
-
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-
-        result = system_metrics::ParseIoStats();
-        result.first -= tmp.first;
-        result.second -= tmp.second;
-    }
-    else
-    {
-        auto tmp = system_metrics::ParseIoStats(pid);
-        for (auto kid : m_children_pids)
-        {
-            auto inner_tmp = system_metrics::ParseIoStats(kid);
-            tmp.first += inner_tmp.first;
-            tmp.second += inner_tmp.second;
-        }
-
-        std::this_thread::sleep_for(std::chrono::seconds(m_period));
-        result = system_metrics::ParseIoStats(pid);
-        for (auto kid : m_children_pids)
-        {
-            auto inner_tmp = system_metrics::ParseIoStats(kid);
-            result.first += inner_tmp.first;
-            result.second += inner_tmp.second;
-        }
-
-        result.first -= tmp.first;
-        result.second -= tmp.second;
-    }
-
-    return result;
-}
-
-std::vector<uint32_t> Rb_metrics::getAllChildren(uint32_t pid)
-{
-    std::vector<unsigned int> result;
-    unsigned proc_count = 0;
-    if (boost::filesystem::is_directory("/proc"))
-    {
-        for (auto &entry : boost::make_iterator_range(boost::filesystem::directory_iterator("/proc"), {}))
-        {
-            boost::filesystem::path tmp(entry);
-            if (IsNumber(tmp.filename().string()))
+            for (auto &entry : boost::make_iterator_range(boost::filesystem::directory_iterator("/proc"), {}))
             {
-                uint32_t curr_pid = atoi(tmp.filename().string().c_str());
-                uint32_t ppid = GetPpid(curr_pid);
-                if (ppid == pid)
+                boost::filesystem::path tmp(entry);
+                if (IsNumber(tmp.filename().string()))
                 {
-                    result.push_back(curr_pid);
+                    uint32_t curr_pid = atoi(tmp.filename().string().c_str());
+                    uint32_t ppid = GetPpid(curr_pid);
+                    if (ppid == pid)
+                    {
+                        result.push_back(curr_pid);
+                    }
                 }
             }
         }
+        return result;
     }
-    return result;
-}
\ No newline at end of file
+
+    uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+}
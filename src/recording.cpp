@@ -0,0 +1,656 @@
+#include "recording.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char kFileMagic[8] = {'R', 'B', 'R', 'E', 'C', '0', '0', '1'};
+    const char kIndexMagic[8] = {'R', 'B', 'I', 'N', 'D', 'E', 'X', '1'};
+    const uint32_t kChunkMagic = 0x4b434252; // "RBCK"
+    const uint32_t kVersion = 3;
+    const size_t kFileHeaderSize = 16;
+    const size_t kChunkHeaderSize = 32;
+    const size_t kTrailerSize = 24;
+
+    uint64_t ZigZag(int64_t value)
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    int64_t UnZigZag(uint64_t value)
+    {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    void PutVarint(std::vector<char> &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Counters wrap around 2^64, so the change of any counter fits a signed 64-bit delta
+    void PutDelta(std::vector<char> &out, uint64_t prev, uint64_t curr)
+    {
+        PutVarint(out, ZigZag(static_cast<int64_t>(curr - prev)));
+    }
+
+    // Bounded read position within a chunk; any read past the end marks it failed
+    struct Cursor
+    {
+        const unsigned char *p;
+        const unsigned char *end;
+        bool ok;
+
+        uint64_t Varint()
+        {
+            uint64_t result = 0;
+            for (int shift = 0; shift < 64 && p < end; shift += 7)
+            {
+                unsigned char byte = *p++;
+                result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (byte < 0x80)
+                    return result;
+            }
+            ok = false;
+            return 0;
+        }
+
+        uint64_t Delta(uint64_t prev)
+        {
+            return prev + static_cast<uint64_t>(UnZigZag(Varint()));
+        }
+    };
+
+    template <typename T>
+    void Store(char *to, T value)
+    {
+        memcpy(to, &value, sizeof(value));
+    }
+
+    template <typename T>
+    T Load(const char *from)
+    {
+        T value;
+        memcpy(&value, from, sizeof(value));
+        return value;
+    }
+
+    // Calls <f(a counter of prev, the same counter of curr)> for every system-wide counter
+    template <typename Prev, typename Curr, typename F>
+    void ZipCounters(Prev &prev, Curr &curr, F f)
+    {
+        f(prev.cpu_busy, curr.cpu_busy);
+        f(prev.cpu_total, curr.cpu_total);
+        f(prev.ram_total, curr.ram_total);
+        f(prev.ram_occupied, curr.ram_occupied);
+        f(prev.net.first, curr.net.first);
+        f(prev.net.second, curr.net.second);
+        f(prev.io.first, curr.io.first);
+        f(prev.io.second, curr.io.second);
+    }
+
+    // Calls <f(a counter of prev, the same counter of curr)> for every counter of a target
+    template <typename Prev, typename Curr, typename F>
+    void ZipTargetCounters(Prev &prev, Curr &curr, F f)
+    {
+        f(prev.counters.cpu, curr.counters.cpu);
+        f(prev.counters.ram, curr.counters.ram);
+        f(prev.counters.net.first, curr.counters.net.first);
+        f(prev.counters.net.second, curr.counters.net.second);
+        f(prev.counters.io.first, curr.counters.io.first);
+        f(prev.counters.io.second, curr.counters.io.second);
+        f(prev.counters.memory.rss, curr.counters.memory.rss);
+        f(prev.counters.memory.pss, curr.counters.memory.pss);
+        f(prev.counters.memory.uss, curr.counters.memory.uss);
+        f(prev.counters.memory.anon, curr.counters.memory.anon);
+        f(prev.counters.memory.file, curr.counters.memory.file);
+        f(prev.counters.memory.swap, curr.counters.memory.swap);
+        f(prev.forks, curr.forks);
+        f(prev.exits, curr.exits);
+    }
+
+    // Calls <f(a counter of prev, the same counter of curr)> for every counter of a block device
+    template <typename Prev, typename Curr, typename F>
+    void ZipDiskCounters(Prev &prev, Curr &curr, F f)
+    {
+        f(prev.reads, curr.reads);
+        f(prev.sectors_read, curr.sectors_read);
+        f(prev.read_ms, curr.read_ms);
+        f(prev.writes, curr.writes);
+        f(prev.sectors_written, curr.sectors_written);
+        f(prev.write_ms, curr.write_ms);
+        f(prev.in_flight, curr.in_flight);
+        f(prev.io_ms, curr.io_ms);
+        f(prev.queue_ms, curr.queue_ms);
+    }
+
+    bool SameTarget(const system_metrics::TargetSnapshot &a, const system_metrics::TargetSnapshot &b)
+    {
+        return a.pid == b.pid && a.cgroup == b.cgroup;
+    }
+
+    // Encodes <curr> against <prev>: a core is written in full (its number) only when it differs from the one
+    // at the same position, its counters as deltas
+    void PutCpus(std::vector<char> &out, const system_metrics::CpuStatMatrix &prev,
+                 const system_metrics::CpuStatMatrix &curr)
+    {
+        PutVarint(out, curr.Rows());
+        for (size_t row = 0; row < curr.Rows(); row++)
+        {
+            bool same = row < prev.Rows() && prev.Id(row) == curr.Id(row);
+            if (same)
+            {
+                PutVarint(out, 0);
+            }
+            else
+            {
+                PutVarint(out, 1);
+                PutVarint(out, ZigZag(curr.Id(row)));
+            }
+            for (int state = 0; state < system_metrics::CPU_STATES; state++)
+            {
+                auto cpu_state = static_cast<system_metrics::CpuState>(state);
+                PutDelta(out, same ? prev.At(row, cpu_state) : 0, curr.At(row, cpu_state));
+            }
+        }
+    }
+
+    // Encodes <curr> against <prev>: a namespace is written in full only when it differs from the one at the
+    // same position, its bytes as deltas
+    void PutNamespaces(std::vector<char> &out, const std::vector<system_metrics::NetNamespaceSnapshot> &prev,
+                       const std::vector<system_metrics::NetNamespaceSnapshot> &curr)
+    {
+        static const system_metrics::NetNamespaceSnapshot zero;
+        PutVarint(out, curr.size());
+        for (size_t i = 0; i < curr.size(); i++)
+        {
+            const auto &ns = curr[i];
+            const system_metrics::NetNamespaceSnapshot *base = &zero;
+            if (i < prev.size() && prev[i].inode == ns.inode && prev[i].own == ns.own)
+            {
+                base = &prev[i];
+                PutVarint(out, 0);
+            }
+            else
+            {
+                PutVarint(out, 1);
+                PutVarint(out, ns.inode);
+                PutVarint(out, ns.own);
+            }
+            PutDelta(out, base->net.first, ns.net.first);
+            PutDelta(out, base->net.second, ns.net.second);
+        }
+    }
+
+    // Encodes <curr> against <prev>: a device is written in full (name and numbers) only when it differs from
+    // the one at the same position, its counters as deltas
+    void PutDisks(std::vector<char> &out, const std::vector<system_metrics::DiskSnapshot> &prev,
+                  const std::vector<system_metrics::DiskSnapshot> &curr)
+    {
+        static const system_metrics::proc_parser::DiskCounters zero;
+        PutVarint(out, curr.size());
+        for (size_t i = 0; i < curr.size(); i++)
+        {
+            const auto &disk = curr[i];
+            const system_metrics::proc_parser::DiskCounters *base = &zero;
+            if (i < prev.size() && prev[i].name == disk.name && prev[i].counters.major == disk.counters.major &&
+                prev[i].counters.minor == disk.counters.minor)
+            {
+                base = &prev[i].counters;
+                PutVarint(out, 0);
+            }
+            else
+            {
+                PutVarint(out, 1);
+                PutVarint(out, disk.name.size());
+                out.insert(out.end(), disk.name.begin(), disk.name.end());
+                PutVarint(out, disk.counters.major);
+                PutVarint(out, disk.counters.minor);
+            }
+            ZipDiskCounters(*base, disk.counters, [&](uint64_t prev, uint64_t curr) { PutDelta(out, prev, curr); });
+        }
+    }
+
+    // Decodes the devices written by PutDisks() over <state>. Returns false if the chunk is malformed
+    bool DecodeDisks(Cursor &cursor, std::vector<system_metrics::DiskSnapshot> &state)
+    {
+        uint64_t count = cursor.Varint();
+        if (!cursor.ok || count > static_cast<uint64_t>(cursor.end - cursor.p))
+            return false;
+        size_t prev_count = state.size();
+        state.resize(count);
+        for (size_t i = 0; i < count && cursor.ok; i++)
+        {
+            auto &disk = state[i];
+            if (cursor.Varint() != 0)
+            {
+                // A new device: its counters start from 0
+                disk.counters = system_metrics::proc_parser::DiskCounters();
+                uint64_t size = cursor.Varint();
+                if (!cursor.ok || size > static_cast<uint64_t>(cursor.end - cursor.p))
+                    return false;
+                disk.name.assign(reinterpret_cast<const char *>(cursor.p), size);
+                cursor.p += size;
+                disk.counters.major = static_cast<uint32_t>(cursor.Varint());
+                disk.counters.minor = static_cast<uint32_t>(cursor.Varint());
+            }
+            else if (i >= prev_count)
+            {
+                return false;
+            }
+            ZipDiskCounters(disk.counters, disk.counters,
+                            [&](uint64_t &, uint64_t &value) { value = cursor.Delta(value); });
+        }
+        return cursor.ok;
+    }
+
+    // Decodes the cores written by PutCpus() over <state>. Returns false if the chunk is malformed
+    bool DecodeCpus(Cursor &cursor, system_metrics::CpuStatMatrix &cpus)
+    {
+        uint64_t count = cursor.Varint();
+        if (!cursor.ok || count > static_cast<uint64_t>(cursor.end - cursor.p))
+            return false;
+        size_t prev_count = cpus.Rows();
+        cpus.Resize(count);
+        for (size_t row = 0; row < count && cursor.ok; row++)
+        {
+            bool same = cursor.Varint() == 0;
+            if (!same)
+            {
+                cpus.SetId(row, static_cast<int>(UnZigZag(cursor.Varint())));
+            }
+            else if (row >= prev_count)
+            {
+                return false;
+            }
+            for (int state = 0; state < system_metrics::CPU_STATES; state++)
+            {
+                uint64_t &value = cpus.At(row, static_cast<system_metrics::CpuState>(state));
+                value = cursor.Delta(same ? value : 0);
+            }
+        }
+        return cursor.ok;
+    }
+
+    // Decodes the namespaces written by PutNamespaces() over <state>. Returns false if the chunk is malformed
+    bool DecodeNamespaces(Cursor &cursor, std::vector<system_metrics::NetNamespaceSnapshot> &state)
+    {
+        uint64_t count = cursor.Varint();
+        if (!cursor.ok || count > static_cast<uint64_t>(cursor.end - cursor.p))
+            return false;
+        size_t prev_count = state.size();
+        state.resize(count);
+        for (size_t i = 0; i < count && cursor.ok; i++)
+        {
+            auto &ns = state[i];
+            if (cursor.Varint() != 0)
+            {
+                ns = system_metrics::NetNamespaceSnapshot();
+                ns.inode = cursor.Varint();
+                ns.own = cursor.Varint() != 0;
+            }
+            else if (i >= prev_count)
+            {
+                return false;
+            }
+            ns.net.first = cursor.Delta(ns.net.first);
+            ns.net.second = cursor.Delta(ns.net.second);
+        }
+        return cursor.ok;
+    }
+
+    // Resets <state> to the zero state a chunk starts from, keeping its memory
+    void Reset(system_metrics::Snapshot &state)
+    {
+        state.timestamp_ns = 0;
+        ZipCounters(state, state, [](uint64_t &, uint64_t &value) { value = 0; });
+        state.cpus.Resize(0);
+        state.namespaces.clear();
+        state.disks.clear();
+        state.targets.clear();
+    }
+
+    // Decodes the next record of a chunk into <state>. Returns false if the chunk is malformed
+    bool DecodeRecord(Cursor &cursor, system_metrics::Snapshot &state, int64_t &prev_interval)
+    {
+        int64_t interval = prev_interval + UnZigZag(cursor.Varint());
+        state.timestamp_ns += static_cast<uint64_t>(interval);
+        prev_interval = interval;
+
+        ZipCounters(state, state, [&](uint64_t &, uint64_t &value) { value = cursor.Delta(value); });
+        if (!DecodeCpus(cursor, state.cpus) || !DecodeNamespaces(cursor, state.namespaces) ||
+            !DecodeDisks(cursor, state.disks))
+            return false;
+
+        uint64_t count = cursor.Varint();
+        if (!cursor.ok || count > static_cast<uint64_t>(cursor.end - cursor.p))
+            return false;
+        size_t prev_count = state.targets.size();
+        state.targets.resize(count);
+        for (size_t i = 0; i < count && cursor.ok; i++)
+        {
+            auto &target = state.targets[i];
+            if (cursor.Varint() != 0)
+            {
+                // A new target: its counters start from 0
+                target = system_metrics::TargetSnapshot();
+                target.pid = static_cast<uint32_t>(cursor.Varint());
+                uint64_t size = cursor.Varint();
+                if (!cursor.ok || size > static_cast<uint64_t>(cursor.end - cursor.p))
+                    return false;
+                target.cgroup.assign(reinterpret_cast<const char *>(cursor.p), size);
+                cursor.p += size;
+            }
+            else if (i >= prev_count)
+            {
+                return false;
+            }
+            ZipTargetCounters(target, target, [&](uint64_t &, uint64_t &value) { value = cursor.Delta(value); });
+            if (!DecodeNamespaces(cursor, target.namespaces))
+                return false;
+        }
+        return cursor.ok;
+    }
+}
+
+namespace system_metrics
+{
+    RecordingWriter::RecordingWriter(const std::string &path, size_t keyframe_interval,
+                                     std::chrono::milliseconds chunk_duration)
+        : m_fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+          m_keyframe_interval(std::max<size_t>(keyframe_interval, 1)),
+          m_chunk_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(chunk_duration).count()),
+          m_offset(0),
+          m_records(0),
+          m_first_timestamp(0),
+          m_prev_interval(0)
+    {
+        char header[kFileHeaderSize] = {};
+        memcpy(header, kFileMagic, sizeof(kFileMagic));
+        Store(header + 8, kVersion);
+        if (m_fd >= 0 && !write(header, sizeof(header)))
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    RecordingWriter::~RecordingWriter()
+    {
+        Close();
+    }
+
+    bool RecordingWriter::write(const void *data, size_t size)
+    {
+        auto p = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t count = ::write(m_fd, p, size);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += count;
+            size -= count;
+            m_offset += count;
+        }
+        return true;
+    }
+
+    bool RecordingWriter::Append(const Snapshot &snapshot)
+    {
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        if (m_records == 0)
+        {
+            // A new chunk: deltas start from the zero state, which makes its first record a keyframe
+            m_chunk.assign(kChunkHeaderSize, 0);
+            Reset(m_prev);
+            m_prev_interval = 0;
+            m_first_timestamp = snapshot.timestamp_ns;
+        }
+
+        int64_t interval = static_cast<int64_t>(snapshot.timestamp_ns - m_prev.timestamp_ns);
+        PutVarint(m_chunk, ZigZag(interval - m_prev_interval));
+        m_prev_interval = interval;
+
+        ZipCounters(m_prev, snapshot, [&](uint64_t prev, uint64_t curr) { PutDelta(m_chunk, prev, curr); });
+        PutCpus(m_chunk, m_prev.cpus, snapshot.cpus);
+        PutNamespaces(m_chunk, m_prev.namespaces, snapshot.namespaces);
+        PutDisks(m_chunk, m_prev.disks, snapshot.disks);
+
+        static const TargetSnapshot zero;
+        PutVarint(m_chunk, snapshot.targets.size());
+        for (size_t i = 0; i < snapshot.targets.size(); i++)
+        {
+            const auto &target = snapshot.targets[i];
+            const TargetSnapshot *base = &zero;
+            if (i < m_prev.targets.size() && SameTarget(m_prev.targets[i], target))
+            {
+                base = &m_prev.targets[i];
+                PutVarint(m_chunk, 0);
+            }
+            else
+            {
+                PutVarint(m_chunk, 1);
+                PutVarint(m_chunk, target.pid);
+                PutVarint(m_chunk, target.cgroup.size());
+                m_chunk.insert(m_chunk.end(), target.cgroup.begin(), target.cgroup.end());
+            }
+            ZipTargetCounters(*base, target, [&](uint64_t prev, uint64_t curr) { PutDelta(m_chunk, prev, curr); });
+            PutNamespaces(m_chunk, base->namespaces, target.namespaces);
+        }
+
+        // Assignment keeps the memory of the previous record
+        m_prev.timestamp_ns = snapshot.timestamp_ns;
+        ZipCounters(m_prev, snapshot, [](uint64_t &prev, uint64_t curr) { prev = curr; });
+        m_prev.cpus = snapshot.cpus;
+        m_prev.namespaces = snapshot.namespaces;
+        m_prev.disks = snapshot.disks;
+        m_prev.targets = snapshot.targets;
+
+        if (++m_records >= m_keyframe_interval || snapshot.timestamp_ns - m_first_timestamp >= m_chunk_ns)
+        {
+            return Flush();
+        }
+        return true;
+    }
+
+    bool RecordingWriter::Flush()
+    {
+        if (m_fd < 0 || m_records == 0)
+        {
+            return m_fd >= 0;
+        }
+
+        char *header = m_chunk.data();
+        Store(header, kChunkMagic);
+        Store(header + 4, static_cast<uint32_t>(m_chunk.size() - kChunkHeaderSize));
+        Store(header + 8, m_records);
+        Store(header + 16, m_first_timestamp);
+        Store(header + 24, m_prev.timestamp_ns);
+
+        RecordingChunk chunk{m_offset, m_first_timestamp, m_prev.timestamp_ns};
+        m_records = 0;
+        if (!write(m_chunk.data(), m_chunk.size()))
+        {
+            return false;
+        }
+        m_index.push_back(chunk);
+        return true;
+    }
+
+    void RecordingWriter::Close()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+
+        if (Flush())
+        {
+            std::vector<char> index(m_index.size() * 24 + kTrailerSize);
+            char *p = index.data();
+            for (const auto &chunk : m_index)
+            {
+                Store(p, chunk.offset);
+                Store(p + 8, chunk.first_timestamp);
+                Store(p + 16, chunk.last_timestamp);
+                p += 24;
+            }
+            Store(p, static_cast<uint64_t>(m_index.size()));
+            Store(p + 8, m_offset);
+            memcpy(p + 16, kIndexMagic, sizeof(kIndexMagic));
+            write(index.data(), index.size());
+        }
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    RecordingReader::RecordingReader(const std::string &path) : m_data(nullptr),
+                                                                m_size(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= kFileHeaderSize)
+        {
+            void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const char *>(data);
+                m_size = info.st_size;
+            }
+        }
+        close(fd);
+
+        if (m_data == nullptr)
+        {
+            return;
+        }
+        if (memcmp(m_data, kFileMagic, sizeof(kFileMagic)) != 0 || Load<uint32_t>(m_data + 8) != kVersion)
+        {
+            munmap(const_cast<char *>(m_data), m_size);
+            m_data = nullptr;
+            m_size = 0;
+            return;
+        }
+        if (!readIndex())
+        {
+            scanChunks();
+        }
+    }
+
+    RecordingReader::~RecordingReader()
+    {
+        if (m_data != nullptr)
+        {
+            munmap(const_cast<char *>(m_data), m_size);
+        }
+    }
+
+    bool RecordingReader::readIndex()
+    {
+        if (m_size < kFileHeaderSize + kTrailerSize)
+        {
+            return false;
+        }
+        const char *trailer = m_data + m_size - kTrailerSize;
+        if (memcmp(trailer + 16, kIndexMagic, sizeof(kIndexMagic)) != 0)
+        {
+            return false;
+        }
+        uint64_t count = Load<uint64_t>(trailer);
+        uint64_t offset = Load<uint64_t>(trailer + 8);
+        if (offset < kFileHeaderSize || offset > m_size - kTrailerSize ||
+            count != (m_size - kTrailerSize - offset) / 24)
+        {
+            return false;
+        }
+
+        m_index.resize(count);
+        const char *p = m_data + offset;
+        for (auto &chunk : m_index)
+        {
+            chunk.offset = Load<uint64_t>(p);
+            chunk.first_timestamp = Load<uint64_t>(p + 8);
+            chunk.last_timestamp = Load<uint64_t>(p + 16);
+            if (chunk.offset + kChunkHeaderSize > offset)
+            {
+                m_index.clear();
+                return false;
+            }
+            p += 24;
+        }
+        return true;
+    }
+
+    void RecordingReader::scanChunks()
+    {
+        // The last chunk may be cut short if the recorder was killed while writing it
+        uint64_t offset = kFileHeaderSize;
+        while (offset + kChunkHeaderSize <= m_size)
+        {
+            const char *header = m_data + offset;
+            uint32_t size = Load<uint32_t>(header + 4);
+            if (Load<uint32_t>(header) != kChunkMagic || offset + kChunkHeaderSize + size > m_size)
+                break;
+            m_index.push_back({offset, Load<uint64_t>(header + 16), Load<uint64_t>(header + 24)});
+            offset += kChunkHeaderSize + size;
+        }
+    }
+
+    size_t RecordingReader::Replay(uint64_t from_ns, uint64_t to_ns,
+                                   const std::function<void(const Snapshot &)> &callback) const
+    {
+        // The first chunk which ends within the range
+        auto chunk = std::lower_bound(m_index.begin(), m_index.end(), from_ns,
+                                      [](const RecordingChunk &entry, uint64_t time)
+                                      { return entry.last_timestamp < time; });
+
+        size_t result = 0;
+        Snapshot state;
+        for (; chunk != m_index.end() && chunk->first_timestamp <= to_ns; ++chunk)
+        {
+            const char *header = m_data + chunk->offset;
+            uint32_t size = Load<uint32_t>(header + 4);
+            uint32_t records = Load<uint32_t>(header + 8);
+            if (chunk->offset + kChunkHeaderSize + size > m_size)
+                break;
+
+            Cursor cursor{reinterpret_cast<const unsigned char *>(header + kChunkHeaderSize),
+                          reinterpret_cast<const unsigned char *>(header + kChunkHeaderSize + size), true};
+            Reset(state);
+            int64_t prev_interval = 0;
+            for (uint32_t i = 0; i < records; i++)
+            {
+                if (!DecodeRecord(cursor, state, prev_interval) || state.timestamp_ns > to_ns)
+                    break;
+                if (state.timestamp_ns >= from_ns)
+                {
+                    callback(state);
+                    ++result;
+                }
+            }
+        }
+        return result;
+    }
+}
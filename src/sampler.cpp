@@ -0,0 +1,1061 @@
+#include "sampler.hpp"
+#include "system_metrics.hpp"
+#include "proc_parser.hpp"
+#include "proc_connector.hpp"
+#include "history.hpp"
+#include "recording.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Returns <curr> - <prev>, or 0 if the counter went backwards (overflow or a process exited)
+    uint64_t Delta(uint64_t prev, uint64_t curr)
+    {
+        return curr >= prev ? curr - prev : 0;
+    }
+
+    // Returns the per second rate of <delta> accumulated within <elapsed_ns>
+    uint64_t Rate(uint64_t delta, uint64_t elapsed_ns)
+    {
+        if (elapsed_ns == 0)
+            return 0;
+        return delta * 1000000000ull / elapsed_ns;
+    }
+
+    void AddPair(std::pair<uint64_t, uint64_t> &to, const std::pair<uint64_t, uint64_t> &from)
+    {
+        to.first += from.first;
+        to.second += from.second;
+    }
+
+    // Returns (received, transmitted) bytes of the <active> interfaces out of /proc/net/dev
+    std::pair<uint64_t, uint64_t> NetDevBytes(const system_metrics::ProcFile &file,
+                                              const system_metrics::NetInterfaceRegistry &active)
+    {
+        std::pair<uint64_t, uint64_t> result{0, 0};
+        system_metrics::proc_parser::ForEachNetDev(
+            file.Data(), file.Size(),
+            [&](const char *name, size_t size, const system_metrics::proc_parser::NetDevCounters &counters)
+            {
+                if (active.IsActive(name, size))
+                {
+                    result.first += counters.rx_bytes;
+                    result.second += counters.tx_bytes;
+                }
+            });
+        return result;
+    }
+
+    // Returns (received, transmitted) bytes of every interface but loopback out of /proc/[pid]/net/dev.
+    // The registry only knows the interfaces of the sampler's own network namespace
+    std::pair<uint64_t, uint64_t> NamespaceBytes(const system_metrics::ProcFile &file)
+    {
+        std::pair<uint64_t, uint64_t> result{0, 0};
+        system_metrics::proc_parser::ForEachNetDev(
+            file.Data(), file.Size(),
+            [&](const char *name, size_t size, const system_metrics::proc_parser::NetDevCounters &counters)
+            {
+                if (size != 2 || memcmp(name, "lo", 2) != 0)
+                {
+                    result.first += counters.rx_bytes;
+                    result.second += counters.tx_bytes;
+                }
+            });
+        return result;
+    }
+
+    // Returns the inode of the network namespace of <pid>, of the sampler for 0. Returns 0 if it cannot be read
+    uint64_t NetNamespace(uint32_t pid)
+    {
+        char path[32];
+        if (pid == 0)
+            snprintf(path, sizeof(path), "/proc/self/ns/net");
+        else
+            snprintf(path, sizeof(path), "/proc/%u/ns/net", pid);
+        struct stat st;
+        return stat(path, &st) == 0 ? st.st_ino : 0;
+    }
+}
+
+namespace system_metrics
+{
+    namespace
+    {
+        // Reads cpu and io counters of the process <pid> with a single taskstats query.
+        // Returns false if the query failed
+        bool QueryProcess(TaskstatsClient &taskstats, uint32_t pid, ProcessCounters &counters)
+        {
+            static const uint64_t ticks_per_second = sysconf(_SC_CLK_TCK);
+
+            TaskCounters task;
+            if (!taskstats.Query(pid, task))
+                return false;
+            counters.cpu = task.cpu_us * ticks_per_second / 1000000;
+            counters.io.first = task.read_char / 1024;
+            counters.io.second = task.write_char / 1024;
+            return true;
+        }
+
+        // Returns the number of workers the pids of <sources> are read by
+        size_t Workers(const Sources &sources)
+        {
+            return sources.pool ? sources.pool->Workers() : 1;
+        }
+
+        // Calls <func>(worker, i) for every index of the pids of <sources>, on the workers of the pool.
+        // A pid is read by a single worker, which is the only one to touch the entries of index i
+        template <typename Func>
+        void ForEachPid(Sources &sources, Func func)
+        {
+            auto range = [&func](size_t worker, size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    func(worker, i);
+                }
+            };
+            if (sources.pool)
+                sources.pool->ForEach(sources.pids.size(), range);
+            else
+                range(0, 0, sources.pids.size());
+        }
+
+        // Opens a taskstats socket for every worker but the first, which queries by <sources.taskstats>:
+        // a netlink socket carries one request at a time
+        void PrepareTaskstats(Sources &sources)
+        {
+            auto &clients = sources.worker_taskstats;
+            if (!sources.taskstats)
+            {
+                clients.clear();
+                return;
+            }
+            clients.resize(Workers(sources) - 1);
+            for (auto &client : clients)
+            {
+                if (!client || client->GetMode() != sources.taskstats->GetMode())
+                    client.reset(new TaskstatsClient(sources.taskstats->GetMode()));
+            }
+        }
+
+        // Returns the taskstats client of <worker>, nullptr to read procfs
+        TaskstatsClient *WorkerTaskstats(Sources &sources, size_t worker)
+        {
+            if (worker == 0 || !sources.taskstats)
+                return sources.taskstats.get();
+            auto &client = sources.worker_taskstats[worker - 1];
+            return client->IsOpen() ? client.get() : nullptr;
+        }
+
+        // Reads the cpu counters of every pid of <sources>, along with the io ones where taskstats answers
+        void ReadProcessesCpu(Sources &sources)
+        {
+            ForEachPid(sources, [&sources](size_t worker, size_t i)
+                       {
+                           auto &counters = sources.counters[i];
+                           auto *taskstats = WorkerTaskstats(sources, worker);
+                           sources.by_taskstats[i] = taskstats != nullptr && QueryProcess(*taskstats, sources.pids[i], counters);
+                           sources.found[i] = sources.by_taskstats[i];
+                           if (sources.by_taskstats[i])
+                               return;
+
+                           proc_parser::PidStat stat;
+                           auto file = sources.reader.PidStat(sources.pids[i]);
+                           if (file && proc_parser::ParsePidStat(file->Data(), file->Size(), stat))
+                           {
+                               counters.cpu = stat.utime + stat.stime + stat.cutime + stat.cstime;
+                               sources.found[i] = true;
+                           }
+                       });
+        }
+
+        // Reads the memory breakdown of <pid> from smaps_rollup. Returns false if it cannot be read
+        bool ReadRollup(ProcReader &reader, uint32_t pid, MemoryUsage &memory)
+        {
+            proc_parser::SmapsRollup rollup;
+            auto file = reader.PidSmapsRollup(pid);
+            if (!file || !proc_parser::ParseSmapsRollup(file->Data(), file->Size(), rollup))
+                return false;
+            memory.rss = rollup.rss;
+            memory.pss = rollup.pss;
+            memory.uss = rollup.private_clean + rollup.private_dirty;
+            memory.anon = rollup.anonymous;
+            memory.file = Delta(rollup.anonymous, rollup.rss);
+            memory.swap = rollup.swap;
+            return true;
+        }
+
+        // Reads the RSS of every pid of <sources>. Taskstats has no current RSS, it always comes from procfs.
+        // The memory breakdown comes from smaps_rollup, read again once the interval has passed, and from
+        // statm where it cannot be read: no sharing is known then, so PSS is RSS
+        void ReadProcessesRam(Sources &sources, uint64_t now_ns)
+        {
+            static const uint64_t page_kb = sysconf(_SC_PAGESIZE) / 1024;
+            bool due = sources.rollup.read_ns == 0 || now_ns - sources.rollup.read_ns >= sources.rollup_interval_ns;
+            const auto &cached = sources.rollup;
+            sources.rolled.assign(sources.pids.size(), false);
+            ForEachPid(sources, [&](size_t, size_t i)
+                       {
+                           uint32_t pid = sources.pids[i];
+                           auto &counters = sources.counters[i];
+                           if (auto file = sources.reader.PidStatm(pid))
+                           {
+                               auto statm = proc_parser::ParseStatm(file->Data(), file->Size());
+                               counters.ram = statm.resident * page_kb;
+                               counters.memory.rss = counters.memory.pss = counters.ram;
+                               counters.memory.file = statm.shared * page_kb;
+                               counters.memory.uss = counters.memory.anon = Delta(counters.memory.file, counters.ram);
+                           }
+
+                           auto it = std::lower_bound(cached.pids.begin(), cached.pids.end(), pid);
+                           if (!due && it != cached.pids.end() && *it == pid)
+                               counters.memory = cached.memory[it - cached.pids.begin()];
+                           else if (!ReadRollup(sources.reader, pid, counters.memory))
+                               return;
+                           sources.rolled[i] = true;
+                       });
+
+            // The pids are sorted: so is the cache
+            auto &next = sources.next_rollup;
+            next.pids.clear();
+            next.memory.clear();
+            next.read_ns = due ? now_ns : cached.read_ns;
+            for (size_t i = 0; i < sources.pids.size(); i++)
+            {
+                if (!sources.rolled[i])
+                    continue;
+                next.pids.push_back(sources.pids[i]);
+                next.memory.push_back(sources.counters[i].memory);
+            }
+            std::swap(sources.rollup, sources.next_rollup);
+        }
+
+        // Returns the namespace <inode> of <namespaces>, sorted by inode, or nullptr
+        const NetNamespaceSnapshot *FindNamespace(const std::vector<NetNamespaceSnapshot> &namespaces, uint64_t inode)
+        {
+            auto it = std::lower_bound(namespaces.begin(), namespaces.end(), inode,
+                                       [](const NetNamespaceSnapshot &ns, uint64_t inode) { return ns.inode < inode; });
+            return it != namespaces.end() && it->inode == inode ? &*it : nullptr;
+        }
+
+        // Reads the network namespace of every pid of <sources>, and the interface counters of each namespace
+        // once, through the first of its processes, into <result>. Every process of a namespace sees the same
+        // /proc/[pid]/net/dev: it is never read per process
+        void ReadNamespaces(Sources &sources, Snapshot &result)
+        {
+            uint64_t own = NetNamespace(0);
+            auto &namespaces = result.namespaces;
+            sources.netns.resize(sources.pids.size());
+            ForEachPid(sources, [&sources, own](size_t, size_t i)
+                       {
+                           // A process whose namespace cannot be read is taken to share the sampler's
+                           uint64_t inode = NetNamespace(sources.pids[i]);
+                           sources.netns[i] = inode != 0 ? inode : own;
+                       });
+
+            for (size_t i = 0; i < sources.pids.size(); i++)
+            {
+                auto it = std::lower_bound(namespaces.begin(), namespaces.end(), sources.netns[i],
+                                           [](const NetNamespaceSnapshot &ns, uint64_t inode) { return ns.inode < inode; });
+                if (it != namespaces.end() && it->inode == sources.netns[i])
+                    continue;
+                NetNamespaceSnapshot ns;
+                ns.inode = sources.netns[i];
+                ns.own = ns.inode == own;
+                if (ns.own)
+                    ns.net = result.net;
+                else if (auto file = sources.reader.PidNetDev(sources.pids[i]))
+                    ns.net = NamespaceBytes(*file);
+                else
+                    continue;
+                namespaces.insert(it, ns);
+            }
+        }
+
+        // Reads the network counters of every pid of <sources> which lives in the sampler's namespace: a process
+        // is given what its TCP sockets have moved since the previous tick, from one sock_diag dump; a socket
+        // several of them share goes to the lowest pid, so that a tree counts it once. The sockets of other
+        // namespaces are not in the dump, their interface counters count for the targets instead
+        void ReadProcessesNet(Sources &sources, const Snapshot &result, uint64_t now_ns)
+        {
+            auto &net = sources.sockets;
+            sources.by_sockets = sources.sock_diag.Dump(net.next_sockets);
+            if (!sources.by_sockets)
+                return;
+
+            // Listing the descriptors is the costly part: every worker appends the sockets it finds to its own
+            // buffer. Attribution depends on the pid order, it is done afterwards on the calling thread.
+            // The sockets of a process are only listed again when its number of descriptors changes, or once
+            // the interval has passed since they were: a socket may take the place of one it closed
+            net.inodes.resize(Workers(sources));
+            for (auto &inodes : net.inodes)
+            {
+                inodes.clear();
+            }
+            net.spans.assign(sources.pids.size(), SocketSpan());
+            ForEachPid(sources, [&](size_t worker, size_t i)
+                       {
+                           const auto *ns = FindNamespace(result.namespaces, sources.netns[i]);
+                           if (ns == nullptr || !ns->own)
+                               return;
+                           uint32_t pid = sources.pids[i];
+                           auto &span = net.spans[i];
+                           uint32_t descriptors = CountDescriptors(pid);
+                           auto known = std::lower_bound(net.known_pids.begin(), net.known_pids.end(), pid);
+                           if (known != net.known_pids.end() && *known == pid)
+                           {
+                               const auto &last = net.known_spans[known - net.known_pids.begin()];
+                               if (last.descriptors == descriptors && now_ns - last.listed_ns < net.relist_interval_ns)
+                               {
+                                   span = last;
+                                   return;
+                               }
+                           }
+                           auto &inodes = net.inodes[worker];
+                           span.worker = worker;
+                           span.offset = inodes.size();
+                           span.descriptors = descriptors;
+                           span.listed_ns = now_ns;
+                           ReadSocketInodes(pid, inodes);
+                           span.count = inodes.size() - span.offset;
+                       });
+
+            auto by_inode = [](const SocketBytes &socket, uint64_t inode) { return socket.inode < inode; };
+            const auto &before = net.sockets;
+            const auto &now = net.next_sockets;
+            net.claimed.assign(now.size(), false);
+            net.next_pids.clear();
+            net.next_bytes.clear();
+            net.next_known_pids.clear();
+            net.next_known_spans.clear();
+            net.next_known.clear();
+            for (size_t i = 0; i < sources.pids.size(); i++)
+            {
+                uint32_t pid = sources.pids[i];
+                const auto *ns = FindNamespace(result.namespaces, sources.netns[i]);
+                if (ns == nullptr || !ns->own)
+                    continue;
+                std::pair<uint64_t, uint64_t> bytes{0, 0};
+                auto known = std::lower_bound(net.pids.begin(), net.pids.end(), pid);
+                if (known != net.pids.end() && *known == pid)
+                    bytes = net.bytes[known - net.pids.begin()];
+
+                const auto &span = net.spans[i];
+                const uint64_t *inodes = (span.known ? net.known : net.inodes[span.worker]).data() + span.offset;
+                for (size_t j = 0; j < span.count; j++)
+                {
+                    uint64_t inode = inodes[j];
+                    auto it = std::lower_bound(now.begin(), now.end(), inode, by_inode);
+                    if (it == now.end() || it->inode != inode || net.claimed[it - now.begin()])
+                        continue;
+                    net.claimed[it - now.begin()] = true;
+
+                    // A socket opened since the previous dump has moved everything within the period
+                    SocketBytes last;
+                    auto prev = std::lower_bound(before.begin(), before.end(), inode, by_inode);
+                    if (prev != before.end() && prev->inode == inode)
+                        last = *prev;
+                    bytes.first += Delta(last.received, it->received);
+                    bytes.second += Delta(last.sent, it->sent);
+                }
+                sources.counters[i].net = bytes;
+                net.next_pids.push_back(pid);
+                net.next_bytes.push_back(bytes);
+
+                SocketSpan listed = span;
+                listed.offset = net.next_known.size();
+                listed.known = true;
+                net.next_known.insert(net.next_known.end(), inodes, inodes + span.count);
+                net.next_known_pids.push_back(pid);
+                net.next_known_spans.push_back(listed);
+            }
+            std::swap(net.sockets, net.next_sockets);
+            std::swap(net.pids, net.next_pids);
+            std::swap(net.bytes, net.next_bytes);
+            std::swap(net.known_pids, net.next_known_pids);
+            std::swap(net.known_spans, net.next_known_spans);
+            std::swap(net.known, net.next_known);
+        }
+
+        // Reads the io counters of every pid of <sources> which taskstats has not answered for
+        void ReadProcessesIo(Sources &sources)
+        {
+            ForEachPid(sources, [&sources](size_t, size_t i)
+                       {
+                           if (sources.by_taskstats[i])
+                               return;
+                           if (auto file = sources.reader.PidIo(sources.pids[i]))
+                           {
+                               auto io = proc_parser::ParsePidIo(file->Data(), file->Size());
+                               sources.counters[i].io.first = io.rchar / 1024;
+                               sources.counters[i].io.second = io.wchar / 1024;
+                           }
+                       });
+        }
+
+        // Reads the counters of the cgroup <cgroup> in the units of the process counters
+        void ReadCgroup(CgroupReader &cgroup, ProcessCounters &counters)
+        {
+            static const uint64_t ticks_per_second = sysconf(_SC_CLK_TCK);
+
+            CgroupCounters raw;
+            if (!cgroup.Read(raw))
+                return;
+            counters.cpu = raw.usage_usec * ticks_per_second / 1000000;
+            // The closest to the summed RSS of the processes; memory.current adds unmapped page cache
+            if (raw.anon != 0 || raw.file_mapped != 0)
+                counters.ram = (raw.anon + raw.file_mapped) / 1024;
+            else
+                counters.ram = raw.memory_current / 1024;
+            counters.io.first = raw.rbytes / 1024;
+            counters.io.second = raw.wbytes / 1024;
+
+            // The kernel charges a page to a single cgroup: the sum is already proportional
+            counters.memory.rss = counters.memory.pss = counters.ram;
+            counters.memory.anon = raw.anon / 1024;
+            counters.memory.file = raw.file / 1024;
+        }
+
+        // Adds the counters of <pid>, which were read into <sources>, to <to>
+        void AddProcess(const Sources &sources, uint32_t pid, ProcessCounters &to)
+        {
+            auto it = std::lower_bound(sources.pids.begin(), sources.pids.end(), pid);
+            if (it == sources.pids.end() || *it != pid)
+                return;
+            const auto &from = sources.counters[it - sources.pids.begin()];
+            to.cpu += from.cpu;
+            to.ram += from.ram;
+            AddPair(to.net, from.net);
+            AddPair(to.io, from.io);
+            to.memory.rss += from.memory.rss;
+            to.memory.pss += from.memory.pss;
+            to.memory.uss += from.memory.uss;
+            to.memory.anon += from.memory.anon;
+            to.memory.file += from.memory.file;
+            to.memory.swap += from.memory.swap;
+        }
+
+        // Adds to <to>, the sum of the processes of <target>, what they counted but no longer do, and keeps their
+        // counters for the next snapshot. Procfs cpu and io include the waited-for children, so a process read
+        // from it which leaves is taken over by its parent; taskstats only counts the process itself, and
+        // socket traffic is only ever counted for the process which held the socket
+        void Account(Sources &sources, const TargetProcesses &target, ProcessCounters &to)
+        {
+            auto &members = sources.members;
+            members.clear();
+            auto add = [&sources, &members](uint32_t pid)
+            {
+                auto it = std::lower_bound(sources.pids.begin(), sources.pids.end(), pid);
+                size_t index = it - sources.pids.begin();
+                if (it != sources.pids.end() && *it == pid && sources.found[index])
+                    members.push_back(index);
+            };
+            add(target.pid);
+            if (target.descendants != nullptr)
+            {
+                for (auto kid : *target.descendants)
+                {
+                    add(kid);
+                }
+            }
+            // The pids are sorted: so are their indexes
+            std::sort(members.begin(), members.end());
+            members.erase(std::unique(members.begin(), members.end()), members.end());
+
+            auto &accounting = *target.accounting;
+            auto &carried = accounting.carried;
+            auto depart = [&accounting, &carried](size_t j)
+            {
+                // Traffic is attributed per process: nobody takes over what a process moved
+                AddPair(carried.net, accounting.counters[j].net);
+                if (!accounting.by_taskstats[j])
+                    return;
+                carried.cpu += accounting.counters[j].cpu;
+                AddPair(carried.io, accounting.counters[j].io);
+            };
+
+            // Both lists are sorted by pid: walk them together
+            accounting.next_pids.clear();
+            accounting.next_counters.clear();
+            accounting.next_by_taskstats.clear();
+            size_t j = 0;
+            for (auto index : members)
+            {
+                uint32_t pid = sources.pids[index];
+                const auto &curr = sources.counters[index];
+                bool by_taskstats = sources.by_taskstats[index];
+                for (; j < accounting.pids.size() && accounting.pids[j] < pid; j++)
+                {
+                    depart(j);
+                }
+                if (j < accounting.pids.size() && accounting.pids[j] == pid)
+                {
+                    // The other source counts from elsewhere, and taskstats counts nothing for a process which
+                    // exited but was not waited for yet: what the process had counted carries on
+                    const auto &last = accounting.counters[j];
+                    bool switched = accounting.by_taskstats[j] != by_taskstats;
+                    carried.cpu += switched || curr.cpu < last.cpu ? last.cpu - curr.cpu : 0;
+                    carried.io.first += switched || curr.io.first < last.io.first ? last.io.first - curr.io.first : 0;
+                    carried.io.second += switched || curr.io.second < last.io.second ? last.io.second - curr.io.second : 0;
+                    j++;
+                }
+                accounting.next_pids.push_back(pid);
+                accounting.next_counters.push_back(curr);
+                accounting.next_by_taskstats.push_back(by_taskstats);
+            }
+            for (; j < accounting.pids.size(); j++)
+            {
+                depart(j);
+            }
+            accounting.pids.swap(accounting.next_pids);
+            accounting.counters.swap(accounting.next_counters);
+            accounting.by_taskstats.swap(accounting.next_by_taskstats);
+
+            to.cpu += carried.cpu;
+            AddPair(to.net, carried.net);
+            AddPair(to.io, carried.io);
+        }
+
+        // Sets the namespaces of <to> to those of the processes of <target> whose interface counters count for
+        // it: every one but the sampler's when its traffic was attributed by socket
+        void AddNamespaces(Sources &sources, const TargetProcesses &target, const Snapshot &result, TargetSnapshot &to)
+        {
+            auto &found = sources.target_netns;
+            found.clear();
+            auto add = [&](uint32_t pid)
+            {
+                auto it = std::lower_bound(sources.pids.begin(), sources.pids.end(), pid);
+                if (it != sources.pids.end() && *it == pid)
+                    found.push_back(sources.netns[it - sources.pids.begin()]);
+            };
+            add(target.pid);
+            if (target.descendants != nullptr)
+            {
+                for (auto kid : *target.descendants)
+                {
+                    add(kid);
+                }
+            }
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+
+            for (auto inode : found)
+            {
+                const auto *ns = FindNamespace(result.namespaces, inode);
+                if (ns != nullptr && !(ns->own && sources.by_sockets))
+                    to.namespaces.push_back(*ns);
+            }
+        }
+
+        // Returns the disk of <prev> which is <curr>, or nullptr if it did not exist then
+        const DiskSnapshot *FindDisk(const Snapshot &prev, size_t index, const DiskSnapshot &curr)
+        {
+            if (index < prev.disks.size() && prev.disks[index].name == curr.name)
+                return &prev.disks[index];
+            for (const auto &disk : prev.disks)
+            {
+                if (disk.name == curr.name)
+                    return &disk;
+            }
+            return nullptr;
+        }
+
+        void AddDisk(proc_parser::DiskCounters &to, const proc_parser::DiskCounters &from)
+        {
+            to.reads += from.reads;
+            to.sectors_read += from.sectors_read;
+            to.read_ms += from.read_ms;
+            to.writes += from.writes;
+            to.sectors_written += from.sectors_written;
+            to.write_ms += from.write_ms;
+            to.in_flight += from.in_flight;
+            to.io_ms += from.io_ms;
+            to.queue_ms += from.queue_ms;
+        }
+
+        // Computes the metrics of a device from its counters <prev> and <curr> taken <elapsed_ns> apart
+        void ComputeDisk(const proc_parser::DiskCounters &prev, const proc_parser::DiskCounters &curr,
+                         uint64_t elapsed_ns, DiskMetrics &result)
+        {
+            uint64_t reads = Delta(prev.reads, curr.reads);
+            uint64_t writes = Delta(prev.writes, curr.writes);
+
+            // Sectors of /proc/diskstats are 512 bytes
+            result.kbps.first = Rate(Delta(prev.sectors_read, curr.sectors_read), elapsed_ns) / 2;
+            result.kbps.second = Rate(Delta(prev.sectors_written, curr.sectors_written), elapsed_ns) / 2;
+            result.iops.first = Rate(reads, elapsed_ns);
+            result.iops.second = Rate(writes, elapsed_ns);
+            if (reads != 0)
+                result.latency_ms.first = static_cast<double>(Delta(prev.read_ms, curr.read_ms)) / reads;
+            if (writes != 0)
+                result.latency_ms.second = static_cast<double>(Delta(prev.write_ms, curr.write_ms)) / writes;
+            if (elapsed_ns != 0)
+            {
+                double elapsed_ms = elapsed_ns / 1e6;
+                result.queue_depth = Delta(prev.queue_ms, curr.queue_ms) / elapsed_ms;
+                result.utilization = std::min(100.0, 100 * Delta(prev.io_ms, curr.io_ms) / elapsed_ms);
+            }
+        }
+
+        // Returns true if <a> and <b> are the same target
+        bool SameTarget(const TargetSnapshot &a, const TargetSnapshot &b)
+        {
+            return a.pid == b.pid && a.cgroup == b.cgroup;
+        }
+
+        // Returns the target of <prev> which is <curr>, or nullptr if it was not monitored then
+        const TargetSnapshot *FindTarget(const Snapshot &prev, size_t index, const TargetSnapshot &curr)
+        {
+            if (index < prev.targets.size() && SameTarget(prev.targets[index], curr))
+                return &prev.targets[index];
+            for (const auto &target : prev.targets)
+            {
+                if (SameTarget(target, curr))
+                    return &target;
+            }
+            return nullptr;
+        }
+    }
+
+    Snapshot TakeSnapshot(Sources &sources, const std::vector<TargetProcesses> &targets)
+    {
+        ProcReader &reader = sources.reader;
+        Snapshot result;
+        result.timestamp_ns = MonotonicNs();
+
+        // Every pid is read once, even if it belongs to several targets
+        auto &pids = sources.pids;
+        pids.clear();
+        for (const auto &target : targets)
+        {
+            if (target.cgroup != nullptr)
+                continue;
+            pids.push_back(target.pid);
+            if (target.descendants != nullptr)
+                pids.insert(pids.end(), target.descendants->begin(), target.descendants->end());
+        }
+        std::sort(pids.begin(), pids.end());
+        pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+
+        sources.counters.assign(pids.size(), ProcessCounters());
+        sources.by_taskstats.assign(pids.size(), false);
+        sources.found.assign(pids.size(), false);
+        if (sources.pool)
+        {
+            PrepareTaskstats(sources);
+            reader.Reserve(pids);
+        }
+
+        // Collector by collector, so that the cost of each one is measured on its own
+        {
+            CollectorTimer timer(result.costs[COLLECTOR_CPU]);
+            if (auto file = reader.Stat())
+            {
+                if (result.cpus.Parse(file->Data(), file->Size()))
+                {
+                    result.cpu_busy = result.cpus.Busy(0);
+                    result.cpu_total = result.cpus.Total(0);
+                }
+            }
+            ReadProcessesCpu(sources);
+        }
+        {
+            CollectorTimer timer(result.costs[COLLECTOR_RAM]);
+            if (auto file = reader.Meminfo())
+            {
+                auto mem = proc_parser::ParseMeminfo(file->Data(), file->Size());
+                result.ram_total = mem.total;
+                result.ram_occupied = mem.total - mem.available;
+            }
+            ReadProcessesRam(sources, result.timestamp_ns);
+        }
+        {
+            CollectorTimer timer(result.costs[COLLECTOR_NET]);
+            sources.interfaces.Update();
+            if (auto file = reader.NetDev())
+            {
+                result.net = NetDevBytes(*file, sources.interfaces);
+            }
+            ReadNamespaces(sources, result);
+            ReadProcessesNet(sources, result, result.timestamp_ns);
+        }
+        {
+            CollectorTimer timer(result.costs[COLLECTOR_IO]);
+            if (sources.disks.Read(result.disks))
+            {
+                for (const auto &disk : result.disks)
+                {
+                    result.io.first += disk.counters.sectors_read;
+                    result.io.second += disk.counters.sectors_written;
+                }
+                // 512-byte sectors to kilobytes
+                result.io.first /= 2;
+                result.io.second /= 2;
+            }
+            ReadProcessesIo(sources);
+        }
+        if (sources.pool)
+            reader.Settle();
+
+        result.targets.resize(targets.size());
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            auto &target = result.targets[i];
+            target.pid = targets[i].pid;
+            target.forks = targets[i].forks;
+            target.exits = targets[i].exits;
+            if (targets[i].cgroup != nullptr)
+            {
+                // Every process of a cgroup is accounted by the kernel: one read whatever their number
+                target.cgroup = targets[i].cgroup->Path();
+                CollectorTimer timer(result.costs[COLLECTOR_CGROUP]);
+                ReadCgroup(*targets[i].cgroup, target.counters);
+                continue;
+            }
+            AddProcess(sources, targets[i].pid, target.counters);
+            if (targets[i].descendants != nullptr)
+            {
+                for (auto kid : *targets[i].descendants)
+                {
+                    AddProcess(sources, kid, target.counters);
+                }
+            }
+            if (targets[i].accounting != nullptr)
+                Account(sources, targets[i], target.counters);
+            AddNamespaces(sources, targets[i], result, target);
+        }
+        return result;
+    }
+
+    Metrics ComputeMetrics(const Snapshot &prev, const Snapshot &curr)
+    {
+        Metrics result;
+        result.elapsed_ns = Delta(prev.timestamp_ns, curr.timestamp_ns);
+        result.costs = curr.costs;
+
+        auto total = Delta(prev.cpu_total, curr.cpu_total);
+        if (total != 0)
+        {
+            result.general_cpu = 100 * Delta(prev.cpu_busy, curr.cpu_busy) / total;
+        }
+        result.cpus.Compute(prev.cpus, curr.cpus);
+        if (curr.ram_total != 0)
+        {
+            result.general_ram = 100 * curr.ram_occupied / curr.ram_total;
+        }
+        result.general_ram_m = curr.ram_occupied / 1024;
+
+        // Network counters are in bytes, the result is in kilobytes
+        result.general_net.first = Rate(Delta(prev.net.first, curr.net.first), result.elapsed_ns) / 1024;
+        result.general_net.second = Rate(Delta(prev.net.second, curr.net.second), result.elapsed_ns) / 1024;
+
+        result.general_io.first = Rate(Delta(prev.io.first, curr.io.first), result.elapsed_ns);
+        result.general_io.second = Rate(Delta(prev.io.second, curr.io.second), result.elapsed_ns);
+
+        result.namespaces.resize(curr.namespaces.size());
+        for (size_t i = 0; i < curr.namespaces.size(); i++)
+        {
+            const auto &now = curr.namespaces[i];
+            const auto *before = FindNamespace(prev.namespaces, now.inode);
+            if (before == nullptr)
+                before = &now;
+            auto &ns = result.namespaces[i];
+            ns.inode = now.inode;
+            ns.own = now.own;
+            ns.net.first = Rate(Delta(before->net.first, now.net.first), result.elapsed_ns) / 1024;
+            ns.net.second = Rate(Delta(before->net.second, now.net.second), result.elapsed_ns) / 1024;
+        }
+
+        // Devices which appeared since the previous snapshot have nothing to compare with yet
+        proc_parser::DiskCounters prev_total;
+        proc_parser::DiskCounters curr_total;
+        result.disks.resize(curr.disks.size());
+        for (size_t i = 0; i < curr.disks.size(); i++)
+        {
+            const auto *before = FindDisk(prev, i, curr.disks[i]);
+            if (before == nullptr)
+                before = &curr.disks[i];
+            auto &disk = result.disks[i];
+            disk.name = curr.disks[i].name;
+            ComputeDisk(before->counters, curr.disks[i].counters, result.elapsed_ns, disk);
+            AddDisk(prev_total, before->counters);
+            AddDisk(curr_total, curr.disks[i].counters);
+            result.general_disk.utilization = std::max(result.general_disk.utilization, disk.utilization);
+        }
+        double utilization = result.general_disk.utilization;
+        ComputeDisk(prev_total, curr_total, result.elapsed_ns, result.general_disk);
+        result.general_disk.utilization = utilization;
+
+        result.targets.resize(curr.targets.size());
+        for (size_t i = 0; i < curr.targets.size(); i++)
+        {
+            const auto &now = curr.targets[i];
+            // A target added since the previous snapshot has nothing to compare with yet
+            const auto *before = FindTarget(prev, i, now);
+            if (before == nullptr)
+                before = &now;
+
+            auto &target = result.targets[i];
+            target.pid = now.pid;
+            target.cgroup = now.cgroup;
+            if (total != 0)
+            {
+                target.cpu = 100 * Delta(before->counters.cpu, now.counters.cpu) / total;
+            }
+            if (curr.ram_total != 0)
+            {
+                target.ram = 100 * now.counters.ram / curr.ram_total;
+            }
+            target.ram_m = now.counters.ram / 1024;
+            target.memory = now.counters.memory;
+
+            // Sockets of its processes, and the namespaces it was in at both snapshots: one which it has just
+            // entered would add everything its interfaces ever moved
+            std::pair<uint64_t, uint64_t> moved{Delta(before->counters.net.first, now.counters.net.first),
+                                                Delta(before->counters.net.second, now.counters.net.second)};
+            for (const auto &ns : now.namespaces)
+            {
+                if (const auto *last = FindNamespace(before->namespaces, ns.inode))
+                {
+                    moved.first += Delta(last->net.first, ns.net.first);
+                    moved.second += Delta(last->net.second, ns.net.second);
+                }
+            }
+            target.net.first = Rate(moved.first, result.elapsed_ns) / 1024;
+            target.net.second = Rate(moved.second, result.elapsed_ns) / 1024;
+            target.io.first = Rate(Delta(before->counters.io.first, now.counters.io.first), result.elapsed_ns);
+            target.io.second = Rate(Delta(before->counters.io.second, now.counters.io.second), result.elapsed_ns);
+
+            target.forks = Delta(before->forks, now.forks);
+            target.exits = Delta(before->exits, now.exits);
+        }
+        return result;
+    }
+}
+
+Rb_sampler::Rb_sampler(unsigned int pid, unsigned long seconds, bool track_events)
+    : Rb_sampler(std::vector<uint32_t>{pid}, std::chrono::seconds(seconds), track_events)
+{
+}
+
+Rb_sampler::Rb_sampler(const std::vector<uint32_t> &pids, unsigned long seconds, bool track_events)
+    : Rb_sampler(pids, std::chrono::seconds(seconds), track_events)
+{
+}
+
+Rb_sampler::Rb_sampler(unsigned int pid, std::chrono::milliseconds period, bool track_events)
+    : Rb_sampler(std::vector<uint32_t>{pid}, period, track_events)
+{
+}
+
+Rb_sampler::Rb_sampler(const std::vector<uint32_t> &pids, std::chrono::milliseconds period, bool track_events)
+    : m_period(std::max(period, std::chrono::milliseconds(1))),
+      m_track_events(track_events),
+      m_targets_changed(false),
+      m_missed(0)
+{
+    for (auto pid : pids)
+    {
+        AddTarget(pid);
+    }
+    m_last = system_metrics::TakeSnapshot(m_sources, processes());
+    m_deadline = std::chrono::steady_clock::now() + m_period;
+}
+
+Rb_sampler::~Rb_sampler()
+{
+}
+
+void Rb_sampler::AddTarget(uint32_t pid, bool tree)
+{
+    Target target;
+    target.pid = pid;
+    target.accounting.reset(new system_metrics::TargetAccounting());
+    if (tree && m_track_events)
+    {
+        target.tree.reset(new system_metrics::ProcEventTracker(pid));
+        target.tree->SetPool(m_sources.pool.get());
+    }
+    else if (tree)
+        target.tree.reset(new system_metrics::DescendantTracker(pid, m_sources.pool.get()));
+    m_targets.push_back(std::move(target));
+}
+
+void Rb_sampler::RemoveTarget(uint32_t pid)
+{
+    for (auto it = m_targets.begin(); it != m_targets.end(); ++it)
+    {
+        if (it->pid == pid && !it->cgroup)
+        {
+            m_targets.erase(it);
+            m_targets_changed = true;
+            return;
+        }
+    }
+}
+
+bool Rb_sampler::UseTaskstats(system_metrics::TaskstatsClient::Mode mode)
+{
+    std::unique_ptr<system_metrics::TaskstatsClient> taskstats(new system_metrics::TaskstatsClient(mode));
+    if (!taskstats->IsOpen())
+        return false;
+    m_sources.taskstats = std::move(taskstats);
+    // Taskstats cpu time does not include waited-for children: start over from a consistent snapshot
+    m_last = system_metrics::TakeSnapshot(m_sources, processes());
+    return true;
+}
+
+void Rb_sampler::AddCgroup(const std::string &path)
+{
+    Target target;
+    target.pid = 0;
+    target.cgroup_path = path;
+    target.cgroup.reset(new system_metrics::CgroupReader(path));
+    m_targets.push_back(std::move(target));
+}
+
+void Rb_sampler::RemoveCgroup(const std::string &path)
+{
+    for (auto it = m_targets.begin(); it != m_targets.end(); ++it)
+    {
+        if (it->cgroup && it->cgroup_path == path)
+        {
+            m_targets.erase(it);
+            return;
+        }
+    }
+}
+
+void Rb_sampler::SetWorkers(size_t workers)
+{
+    if (workers > 1)
+        m_sources.pool.reset(new system_metrics::WorkerPool(workers));
+    else
+        m_sources.pool.reset();
+    for (auto &target : m_targets)
+    {
+        if (target.tree)
+            target.tree->SetPool(m_sources.pool.get());
+    }
+}
+
+void Rb_sampler::SetRollupInterval(std::chrono::milliseconds interval)
+{
+    m_sources.rollup_interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+}
+
+void Rb_sampler::SetRelistInterval(std::chrono::milliseconds interval)
+{
+    m_sources.sockets.relist_interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+}
+
+void Rb_sampler::KeepHistory(size_t retention, size_t window)
+{
+    m_history = std::make_shared<system_metrics::MetricHistory>(retention, window);
+}
+
+void Rb_sampler::KeepTop(size_t count)
+{
+    m_top.reset(new system_metrics::TopProcesses(count));
+    // The first walk has nothing to compare with
+    m_top->Update();
+}
+
+bool Rb_sampler::RecordTo(const std::string &path, size_t keyframe_interval, std::chrono::milliseconds chunk_duration)
+{
+    std::unique_ptr<system_metrics::RecordingWriter> recording(
+        new system_metrics::RecordingWriter(path, keyframe_interval, chunk_duration));
+    if (!recording->IsOpen())
+        return false;
+    recording->Append(m_last);
+    m_recording = std::move(recording);
+    return true;
+}
+
+std::vector<system_metrics::TargetProcesses> Rb_sampler::processes() const
+{
+    std::vector<system_metrics::TargetProcesses> result;
+    result.reserve(m_targets.size());
+    for (const auto &target : m_targets)
+    {
+        if (target.cgroup)
+            result.push_back({0, nullptr, 0, 0, target.cgroup.get(), nullptr});
+        else if (target.tree)
+            result.push_back({target.pid, &target.tree->Descendants(), target.tree->Forks(), target.tree->Exits(), nullptr,
+                              target.accounting.get()});
+        else
+            result.push_back({target.pid, nullptr, 0, 0, nullptr, target.accounting.get()});
+    }
+    return result;
+}
+
+system_metrics::Metrics Rb_sampler::Sample()
+{
+    // The previous cycle overran one or more whole periods: skip their deadlines, keeping the phase
+    uint64_t missed = 0;
+    auto now = std::chrono::steady_clock::now();
+    if (now >= m_deadline + m_period)
+    {
+        missed = (now - m_deadline) / m_period;
+        m_deadline += missed * m_period;
+    }
+
+    // Sleep until the absolute deadline: unlike a relative sleep, nothing is added to the period
+    auto deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(m_deadline.time_since_epoch()).count();
+    timespec until{static_cast<time_t>(deadline / 1000000000), static_cast<long>(deadline % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR)
+    {
+    }
+    m_deadline += m_period;
+    return Collect(missed);
+}
+
+system_metrics::Metrics Rb_sampler::Collect(uint64_t missed)
+{
+    auto start = std::chrono::steady_clock::now();
+    system_metrics::CollectorCost discovery;
+    {
+        system_metrics::CollectorTimer timer(discovery);
+        for (auto &target : m_targets)
+        {
+            if (target.tree && target.tree->Refresh())
+                m_targets_changed = true;
+        }
+    }
+
+    auto curr = system_metrics::TakeSnapshot(m_sources, processes());
+    curr.costs[system_metrics::COLLECTOR_DISCOVERY] = discovery;
+    if (m_targets_changed)
+    {
+        // Close the files of the processes which are not monitored anymore
+        m_sources.reader.Retain(m_sources.pids);
+        m_targets_changed = false;
+    }
+
+    auto result = system_metrics::ComputeMetrics(m_last, curr);
+    if (m_top)
+    {
+        system_metrics::CollectorTimer timer(result.costs[system_metrics::COLLECTOR_TOP]);
+        m_top->Update();
+    }
+    m_self.Record(result.costs);
+    if (m_history)
+        m_history->Record(curr.timestamp_ns, result);
+    if (m_recording)
+        m_recording->Append(curr);
+    m_last = std::move(curr);
+
+    m_missed += missed;
+    result.missed = missed;
+    result.collect_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    return result;
+}
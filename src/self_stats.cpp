@@ -0,0 +1,78 @@
+#include "self_stats.hpp"
+#include "system_metrics.hpp"
+
+#include <ctime>
+
+namespace system_metrics
+{
+    uint64_t ThreadCpuNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    const char *CollectorName(Collector collector)
+    {
+        switch (collector)
+        {
+        case COLLECTOR_CPU:
+            return "cpu";
+        case COLLECTOR_RAM:
+            return "ram";
+        case COLLECTOR_NET:
+            return "net";
+        case COLLECTOR_IO:
+            return "io";
+        case COLLECTOR_CGROUP:
+            return "cgroup";
+        case COLLECTOR_DISCOVERY:
+            return "discovery";
+        case COLLECTOR_TOP:
+            return "top";
+        default:
+            return "unknown";
+        }
+    }
+
+    CollectorTimer::CollectorTimer(CollectorCost &cost) : m_cost(cost),
+                                                          m_wall_ns(MonotonicNs()),
+                                                          m_cpu_ns(ThreadCpuNs() + ThreadWorkerCpuNs()),
+                                                          m_work(ThreadWork())
+    {
+    }
+
+    CollectorTimer::~CollectorTimer()
+    {
+        const WorkCounters &work = ThreadWork();
+        m_cost.wall_ns += MonotonicNs() - m_wall_ns;
+        m_cost.cpu_ns += ThreadCpuNs() + ThreadWorkerCpuNs() - m_cpu_ns;
+        m_cost.work.files_opened += work.files_opened - m_work.files_opened;
+        m_cost.work.bytes_read += work.bytes_read - m_work.bytes_read;
+        m_cost.work.processes_spawned += work.processes_spawned - m_work.processes_spawned;
+    }
+
+    void Histogram::Add(uint64_t value)
+    {
+        // The bucket is the bit length of value - 1: 0 and 1 go to bucket 0, 2 to 1, 3 and 4 to 2...
+        size_t bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+        if (bucket >= kBuckets)
+            bucket = kBuckets - 1;
+        ++m_buckets[bucket];
+        ++m_count;
+        m_sum += value;
+    }
+
+    void SelfStats::Record(const CollectorCosts &costs)
+    {
+        for (size_t i = 0; i < COLLECTORS; i++)
+        {
+            m_wall[i].Add(costs[i].wall_ns);
+            m_cpu[i].Add(costs[i].cpu_ns);
+            m_work[i].files_opened += costs[i].work.files_opened;
+            m_work[i].bytes_read += costs[i].work.bytes_read;
+            m_work[i].processes_spawned += costs[i].work.processes_spawned;
+        }
+        ++m_ticks;
+    }
+}
@@ -0,0 +1,167 @@
+#include "shm_publisher.hpp"
+#include "system_metrics.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Copies <value> into <to> of <size> bytes, truncated and always '\0'-terminated
+    void CopyString(char *to, size_t size, const std::string &value)
+    {
+        size_t length = std::min(value.size(), size - 1);
+        memcpy(to, value.data(), length);
+        to[length] = '\0';
+    }
+}
+
+namespace system_metrics
+{
+    SharedSnapshotPublisher::SharedSnapshotPublisher(const std::string &name) : m_name(name),
+                                                                                m_fd(-1),
+                                                                                m_segment(nullptr),
+                                                                                m_staging(new shm::SharedMetrics())
+    {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            return;
+        }
+        // Two publishers of one object would interleave their seqlocks. The lock goes with the process, so the
+        // object of a publisher which was killed is taken over
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(fd);
+            return;
+        }
+        // The mode is subject to the umask: readers of other users need it as asked
+        fchmod(fd, 0644);
+        if (ftruncate(fd, sizeof(shm::SharedSegment)) != 0)
+        {
+            close(fd);
+            return;
+        }
+        void *address = mmap(nullptr, sizeof(shm::SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+        m_fd = fd;
+
+        m_segment = static_cast<shm::SharedSegment *>(address);
+        m_segment->version = shm::kVersion;
+        m_segment->size = sizeof(shm::SharedSegment);
+        // A previous publisher may have died within a publication: readers must not wait for it
+        uint64_t sequence = m_segment->sequence.load(std::memory_order_relaxed);
+        if (sequence & 1)
+            m_segment->sequence.store(sequence + 1, std::memory_order_release);
+        __atomic_store_n(&m_segment->magic, shm::kMagic, __ATOMIC_RELEASE);
+    }
+
+    SharedSnapshotPublisher::~SharedSnapshotPublisher()
+    {
+        if (m_segment != nullptr)
+        {
+            munmap(m_segment, sizeof(shm::SharedSegment));
+            // Unlinked while still locked, so it is never the object of a publisher which took over
+            shm_unlink(m_name.c_str());
+            close(m_fd);
+        }
+    }
+
+    void SharedSnapshotPublisher::Publish(const Metrics &metrics)
+    {
+        if (m_segment == nullptr)
+        {
+            return;
+        }
+
+        shm::SharedMetrics &out = *m_staging;
+        out.timestamp_ns = MonotonicNs();
+        out.elapsed_ns = metrics.elapsed_ns;
+        out.collect_ns = metrics.collect_ns;
+        out.missed = metrics.missed;
+        out.cpu = metrics.general_cpu;
+        out.ram = metrics.general_ram;
+        out.ram_m = metrics.general_ram_m;
+        out.net_read_kbps = metrics.general_net.first;
+        out.net_write_kbps = metrics.general_net.second;
+        out.io_read_kbps = metrics.general_io.first;
+        out.io_write_kbps = metrics.general_io.second;
+
+        // Row 0 of the matrix is the aggregate
+        out.cores = 0;
+        for (size_t row = 1; row < metrics.cpus.Rows() && out.cores < shm::kMaxCores; row++)
+        {
+            out.core_busy[out.cores++] = metrics.cpus.Busy(row);
+        }
+
+        out.disks = static_cast<uint32_t>(std::min(metrics.disks.size(), shm::kMaxDisks));
+        for (uint32_t i = 0; i < out.disks; i++)
+        {
+            const auto &disk = metrics.disks[i];
+            auto &to = out.disk[i];
+            CopyString(to.name, sizeof(to.name), disk.name);
+            to.read_kbps = disk.kbps.first;
+            to.write_kbps = disk.kbps.second;
+            to.read_iops = disk.iops.first;
+            to.write_iops = disk.iops.second;
+            to.read_latency_ms = disk.latency_ms.first;
+            to.write_latency_ms = disk.latency_ms.second;
+            to.queue_depth = disk.queue_depth;
+            to.utilization = disk.utilization;
+        }
+
+        out.namespaces = static_cast<uint32_t>(std::min(metrics.namespaces.size(), shm::kMaxNamespaces));
+        for (uint32_t i = 0; i < out.namespaces; i++)
+        {
+            const auto &ns = metrics.namespaces[i];
+            auto &to = out.netns[i];
+            to.inode = ns.inode;
+            to.own = ns.own;
+            to.reserved = 0;
+            to.net_read_kbps = ns.net.first;
+            to.net_write_kbps = ns.net.second;
+        }
+
+        out.targets = static_cast<uint32_t>(std::min(metrics.targets.size(), shm::kMaxTargets));
+        for (uint32_t i = 0; i < out.targets; i++)
+        {
+            const auto &target = metrics.targets[i];
+            auto &to = out.target[i];
+            to.pid = target.pid;
+            to.cpu = target.cpu;
+            to.ram = target.ram;
+            to.ram_m = target.ram_m;
+            to.net_read_kbps = target.net.first;
+            to.net_write_kbps = target.net.second;
+            to.io_read_kbps = target.io.first;
+            to.io_write_kbps = target.io.second;
+            to.forks = target.forks;
+            to.exits = target.exits;
+            to.rss_kb = target.memory.rss;
+            to.pss_kb = target.memory.pss;
+            to.uss_kb = target.memory.uss;
+            to.anon_kb = target.memory.anon;
+            to.file_kb = target.memory.file;
+            to.swap_kb = target.memory.swap;
+            CopyString(to.cgroup, sizeof(to.cgroup), target.cgroup);
+        }
+
+        // Only the part in use is copied under the seqlock
+        size_t size = offsetof(shm::SharedMetrics, target) + out.targets * sizeof(shm::SharedTarget);
+        uint64_t sequence = m_segment->sequence.load(std::memory_order_relaxed);
+        m_segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+        // The odd sequence must be visible before any byte of the metrics changes
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&m_segment->metrics, &out, size);
+        m_segment->sequence.store(sequence + 2, std::memory_order_release);
+    }
+}
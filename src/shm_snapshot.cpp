@@ -0,0 +1,88 @@
+#include "shm_snapshot.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Attempts which spin on a publication in progress before yielding the cpu to the publisher
+    const unsigned kSpins = 100;
+}
+
+namespace system_metrics
+{
+    SharedSnapshotReader::SharedSnapshotReader(const std::string &name) : m_segment(nullptr)
+    {
+        int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(shm::SharedSegment))
+        {
+            close(fd);
+            return;
+        }
+        // The mapping outlives the descriptor
+        void *address = mmap(nullptr, sizeof(shm::SharedSegment), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+        {
+            return;
+        }
+
+        auto segment = static_cast<const shm::SharedSegment *>(address);
+        if (segment->magic != shm::kMagic || segment->version != shm::kVersion || segment->size != sizeof(shm::SharedSegment))
+        {
+            munmap(address, sizeof(shm::SharedSegment));
+            return;
+        }
+        m_segment = segment;
+    }
+
+    SharedSnapshotReader::~SharedSnapshotReader()
+    {
+        if (m_segment != nullptr)
+        {
+            munmap(const_cast<shm::SharedSegment *>(m_segment), sizeof(shm::SharedSegment));
+        }
+    }
+
+    bool SharedSnapshotReader::Read(shm::SharedMetrics &metrics, unsigned attempts) const
+    {
+        if (m_segment == nullptr)
+        {
+            return false;
+        }
+        for (unsigned i = 0; i < attempts; i++)
+        {
+            uint64_t before = m_segment->sequence.load(std::memory_order_acquire);
+            if (before == 0)
+                return false;
+            // Odd: a publication is being copied in, it takes a microsecond or so. A publisher which
+            // takes longer has been preempted within it, and spinning only delays it on a busy cpu
+            if (before & 1)
+            {
+                if (i >= kSpins)
+                    sched_yield();
+                continue;
+            }
+            memcpy(&metrics, &m_segment->metrics, sizeof(metrics));
+            // The copy must be done before the sequence is checked again
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_segment->sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+        return false;
+    }
+
+    uint64_t SharedSnapshotReader::Publications() const
+    {
+        return m_segment != nullptr ? m_segment->sequence.load(std::memory_order_acquire) / 2 : 0;
+    }
+}
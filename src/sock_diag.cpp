@@ -0,0 +1,196 @@
+#include "sock_diag.hpp"
+#include "self_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace
+{
+    // TCP states of include/net/tcp_states.h. Listening sockets move no data, time-wait and
+    // syn-recv minisockets have no inode and no tcp_info: they are not dumped
+    const uint32_t kTcpTimeWait = 6;
+    const uint32_t kTcpListen = 10;
+    const uint32_t kTcpNewSynRecv = 12;
+    const uint32_t kDumpedStates = ~((1u << kTcpTimeWait) | (1u << kTcpListen) | (1u << kTcpNewSynRecv));
+
+    // Returns the inode of the link target "socket:[inode]" of <size> bytes, 0 if it is not a socket
+    uint64_t SocketInode(const char *link, ssize_t size)
+    {
+        static const char prefix[] = "socket:[";
+        const ssize_t prefix_size = sizeof(prefix) - 1;
+        if (size <= prefix_size || memcmp(link, prefix, prefix_size) != 0)
+            return 0;
+        uint64_t inode = 0;
+        for (ssize_t i = prefix_size; i < size && link[i] >= '0' && link[i] <= '9'; i++)
+        {
+            inode = inode * 10 + (link[i] - '0');
+        }
+        return inode;
+    }
+}
+
+namespace system_metrics
+{
+    SockDiagClient::SockDiagClient() : m_fd(-1),
+                                       m_sequence(0),
+                                       m_buffer(32768)
+    {
+        m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+        if (m_fd >= 0)
+        {
+            // A dump never takes long; the timeout only guards against a lost reply
+            timeval timeout{1, 0};
+            setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+    }
+
+    SockDiagClient::~SockDiagClient()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    bool SockDiagClient::Dump(std::vector<SocketBytes> &sockets)
+    {
+        sockets.clear();
+        if (m_fd < 0 || !dump(AF_INET, sockets) || !dump(AF_INET6, sockets))
+        {
+            return false;
+        }
+        std::sort(sockets.begin(), sockets.end(),
+                  [](const SocketBytes &a, const SocketBytes &b) { return a.inode < b.inode; });
+        return true;
+    }
+
+    bool SockDiagClient::dump(uint8_t family, std::vector<SocketBytes> &sockets)
+    {
+        struct
+        {
+            nlmsghdr header;
+            inet_diag_req_v2 diag;
+        } request{};
+        request.header.nlmsg_len = sizeof(request);
+        request.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++m_sequence;
+        request.diag.sdiag_family = family;
+        request.diag.sdiag_protocol = IPPROTO_TCP;
+        request.diag.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+        request.diag.idiag_states = kDumpedStates;
+
+        sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        if (sendto(m_fd, &request, sizeof(request), 0, reinterpret_cast<sockaddr *>(&kernel), sizeof(kernel)) < 0)
+        {
+            return false;
+        }
+
+        /*
+        Reply: a multipart message per batch of sockets, ended by NLMSG_DONE
+            struct inet_diag_msg
+            INET_DIAG_INFO, struct tcp_info
+
+        struct tcp_info only ever grows: a shorter one from an older kernel is zero-padded
+        */
+        while (true)
+        {
+            ssize_t size = recv(m_fd, m_buffer.data(), m_buffer.size(), 0);
+            if (size < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            ThreadWork().bytes_read += size;
+
+            int length = static_cast<int>(size);
+            for (auto header = reinterpret_cast<const nlmsghdr *>(m_buffer.data());
+                 NLMSG_OK(header, length);
+                 header = NLMSG_NEXT(header, length))
+            {
+                // A reply to an earlier request which timed out
+                if (header->nlmsg_seq != m_sequence)
+                    continue;
+                if (header->nlmsg_type == NLMSG_DONE)
+                    return true;
+                if (header->nlmsg_type == NLMSG_ERROR)
+                {
+                    auto error = static_cast<const nlmsgerr *>(NLMSG_DATA(header));
+                    errno = -error->error;
+                    return false;
+                }
+                if (header->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+                    continue;
+
+                auto message = static_cast<const inet_diag_msg *>(NLMSG_DATA(header));
+                if (message->idiag_inode == 0)
+                    continue;
+                tcp_info info{};
+                int attributes = static_cast<int>(header->nlmsg_len - NLMSG_LENGTH(sizeof(*message)));
+                for (auto attr = reinterpret_cast<const rtattr *>(message + 1);
+                     RTA_OK(attr, attributes);
+                     attr = RTA_NEXT(attr, attributes))
+                {
+                    if (attr->rta_type == INET_DIAG_INFO)
+                        memcpy(&info, RTA_DATA(attr), std::min<size_t>(RTA_PAYLOAD(attr), sizeof(info)));
+                }
+
+                SocketBytes socket;
+                socket.inode = message->idiag_inode;
+                socket.received = info.tcpi_bytes_received;
+                socket.sent = info.tcpi_bytes_acked;
+                sockets.push_back(socket);
+            }
+        }
+    }
+
+    bool ReadSocketInodes(uint32_t pid, std::vector<uint64_t> &inodes)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%u/fd", pid);
+        DIR *dir = opendir(path);
+        if (dir == nullptr)
+        {
+            return false;
+        }
+        ++ThreadWork().files_opened;
+
+        // Every descriptor is a symbolic link, sockets point to "socket:[inode]"
+        char link[64];
+        while (auto entry = readdir(dir))
+        {
+            if (entry->d_name[0] == '.')
+                continue;
+            ssize_t size = readlinkat(dirfd(dir), entry->d_name, link, sizeof(link));
+            uint64_t inode = SocketInode(link, size);
+            if (inode != 0)
+                inodes.push_back(inode);
+        }
+        closedir(dir);
+        return true;
+    }
+
+    uint32_t CountDescriptors(uint32_t pid)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%u/fd", pid);
+        struct stat info;
+        return stat(path, &info) == 0 ? static_cast<uint32_t>(info.st_size) : 0;
+    }
+}
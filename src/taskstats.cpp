@@ -0,0 +1,214 @@
+#include "taskstats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace
+{
+    // Appends the attribute <type> with <size> bytes of <data> at <offset> of <buffer>. Returns the new offset
+    uint32_t PutAttribute(std::vector<char> &buffer, uint32_t offset, uint16_t type, const void *data, uint16_t size)
+    {
+        auto attribute = reinterpret_cast<nlattr *>(buffer.data() + offset);
+        attribute->nla_type = type;
+        attribute->nla_len = NLA_HDRLEN + size;
+        memcpy(buffer.data() + offset + NLA_HDRLEN, data, size);
+        return offset + NLA_ALIGN(attribute->nla_len);
+    }
+
+    // Calls <callback(type, data, size)> for every attribute within <size> bytes of <data>
+    template <typename Callback>
+    void ForEachAttribute(const char *data, int size, Callback callback)
+    {
+        while (size >= NLA_HDRLEN)
+        {
+            auto attribute = reinterpret_cast<const nlattr *>(data);
+            if (attribute->nla_len < NLA_HDRLEN || attribute->nla_len > size)
+                return;
+            callback(attribute->nla_type & NLA_TYPE_MASK, data + NLA_HDRLEN, attribute->nla_len - NLA_HDRLEN);
+            int step = std::min<int>(NLA_ALIGN(attribute->nla_len), size);
+            data += step;
+            size -= step;
+        }
+    }
+}
+
+namespace system_metrics
+{
+    TaskstatsClient::TaskstatsClient(Mode mode) : m_fd(-1),
+                                                  m_family(0),
+                                                  m_mode(mode),
+                                                  m_sequence(0),
+                                                  m_request(256),
+                                                  m_buffer(8192)
+    {
+        if (!open() && m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    TaskstatsClient::~TaskstatsClient()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    bool TaskstatsClient::open()
+    {
+        m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        // A reply never takes long; the timeout only guards against a lost one
+        timeval timeout{1, 0};
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        if (bind(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            return false;
+        }
+
+        // The id of the TASKSTATS family is assigned at runtime: ask the controller for it
+        std::fill(m_request.begin(), m_request.end(), 0);
+        auto header = reinterpret_cast<nlmsghdr *>(m_request.data());
+        header->nlmsg_type = GENL_ID_CTRL;
+        auto genl = static_cast<genlmsghdr *>(NLMSG_DATA(header));
+        genl->cmd = CTRL_CMD_GETFAMILY;
+        genl->version = 1;
+        uint32_t size = PutAttribute(m_request, NLMSG_HDRLEN + GENL_HDRLEN, CTRL_ATTR_FAMILY_NAME,
+                                     TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+
+        int length = exchange(size);
+        if (length < 0)
+        {
+            return false;
+        }
+        header = reinterpret_cast<nlmsghdr *>(m_buffer.data());
+        ForEachAttribute(m_buffer.data() + NLMSG_HDRLEN + GENL_HDRLEN,
+                         static_cast<int>(header->nlmsg_len) - NLMSG_HDRLEN - GENL_HDRLEN,
+                         [&](int type, const char *data, int size)
+                         {
+                             if (type == CTRL_ATTR_FAMILY_ID && size >= static_cast<int>(sizeof(uint16_t)))
+                                 memcpy(&m_family, data, sizeof(uint16_t));
+                         });
+        return m_family != 0;
+    }
+
+    int TaskstatsClient::exchange(uint32_t size)
+    {
+        auto request = reinterpret_cast<nlmsghdr *>(m_request.data());
+        request->nlmsg_len = size;
+        request->nlmsg_flags = NLM_F_REQUEST;
+        request->nlmsg_seq = ++m_sequence;
+        request->nlmsg_pid = 0;
+
+        sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        if (sendto(m_fd, m_request.data(), size, 0, reinterpret_cast<sockaddr *>(&kernel), sizeof(kernel)) < 0)
+        {
+            return -1;
+        }
+
+        while (true)
+        {
+            ssize_t length = recv(m_fd, m_buffer.data(), m_buffer.size(), 0);
+            if (length < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            auto header = reinterpret_cast<const nlmsghdr *>(m_buffer.data());
+            if (!NLMSG_OK(header, static_cast<int>(length)))
+                return -1;
+            // A reply to an earlier request which timed out
+            if (header->nlmsg_seq != m_sequence)
+                continue;
+            if (header->nlmsg_type == NLMSG_ERROR)
+            {
+                // ESRCH if the process is gone, EPERM without CAP_NET_ADMIN
+                auto error = static_cast<const nlmsgerr *>(NLMSG_DATA(header));
+                errno = -error->error;
+                return -1;
+            }
+            return static_cast<int>(length);
+        }
+    }
+
+    bool TaskstatsClient::Query(uint32_t pid, TaskCounters &counters)
+    {
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        std::fill(m_request.begin(), m_request.begin() + NLMSG_HDRLEN + GENL_HDRLEN, 0);
+        auto header = reinterpret_cast<nlmsghdr *>(m_request.data());
+        header->nlmsg_type = m_family;
+        auto genl = static_cast<genlmsghdr *>(NLMSG_DATA(header));
+        genl->cmd = TASKSTATS_CMD_GET;
+        genl->version = TASKSTATS_GENL_VERSION;
+        uint16_t attribute = m_mode == PER_TGID ? TASKSTATS_CMD_ATTR_TGID : TASKSTATS_CMD_ATTR_PID;
+        uint32_t size = PutAttribute(m_request, NLMSG_HDRLEN + GENL_HDRLEN, attribute, &pid, sizeof(pid));
+
+        int length = exchange(size);
+        if (length < 0)
+        {
+            return false;
+        }
+
+        /*
+        Reply:
+            TASKSTATS_TYPE_AGGR_TGID (or _AGGR_PID), nested
+                TASKSTATS_TYPE_TGID (or _PID), u32
+                TASKSTATS_TYPE_STATS, struct taskstats
+
+        struct taskstats only ever grows: a shorter one from an older kernel is zero-padded
+        */
+        taskstats stats{};
+        bool found = false;
+        header = reinterpret_cast<nlmsghdr *>(m_buffer.data());
+        ForEachAttribute(m_buffer.data() + NLMSG_HDRLEN + GENL_HDRLEN,
+                         static_cast<int>(header->nlmsg_len) - NLMSG_HDRLEN - GENL_HDRLEN,
+                         [&](int type, const char *data, int size)
+                         {
+                             if (type != TASKSTATS_TYPE_AGGR_TGID && type != TASKSTATS_TYPE_AGGR_PID)
+                                 return;
+                             ForEachAttribute(data, size, [&](int type, const char *data, int size)
+                                              {
+                                                  if (type != TASKSTATS_TYPE_STATS)
+                                                      return;
+                                                  memcpy(&stats, data, std::min<size_t>(size, sizeof(stats)));
+                                                  found = true;
+                                              });
+                         });
+        if (!found)
+        {
+            return false;
+        }
+
+        counters.cpu_us = stats.ac_utime + stats.ac_stime;
+        counters.coremem = stats.coremem;
+        counters.hiwater_rss = stats.hiwater_rss;
+        counters.read_char = stats.read_char;
+        counters.write_char = stats.write_char;
+        counters.read_bytes = stats.read_bytes;
+        counters.write_bytes = stats.write_bytes;
+        return true;
+    }
+}
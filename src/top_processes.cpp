@@ -0,0 +1,219 @@
+#include "top_processes.hpp"
+#include "proc_parser.hpp"
+#include "system_metrics.hpp"
+#include "self_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // Returns <curr> - <prev>, or 0 if the counter went backwards
+    uint64_t Delta(uint64_t prev, uint64_t curr)
+    {
+        return curr >= prev ? curr - prev : 0;
+    }
+
+    // Returns the value <state> is ranked by for <metric>
+    uint64_t RankedValue(const system_metrics::ProcessState &state, system_metrics::TopMetric metric)
+    {
+        switch (metric)
+        {
+        case system_metrics::TOP_CPU:
+            return state.cpu_delta;
+        case system_metrics::TOP_RSS:
+            return state.rss;
+        default:
+            return state.io_delta.first + state.io_delta.second;
+        }
+    }
+
+    // Returns the pid named by the /proc entry <name>, 0 if it is not a process
+    uint32_t PidName(const char *name)
+    {
+        uint32_t pid = 0;
+        for (const char *p = name; *p != '\0'; p++)
+        {
+            if (*p < '0' || *p > '9')
+                return 0;
+            pid = pid * 10 + (*p - '0');
+        }
+        return pid;
+    }
+}
+
+namespace system_metrics
+{
+    const char *TopMetricName(TopMetric metric)
+    {
+        switch (metric)
+        {
+        case TOP_CPU:
+            return "cpu";
+        case TOP_RSS:
+            return "rss";
+        case TOP_IO:
+            return "io";
+        default:
+            return "unknown";
+        }
+    }
+
+    TopProcesses::TopProcesses(size_t count) : m_count(count),
+                                               m_proc(opendir("/proc")),
+                                               m_generation(0),
+                                               m_last_ns(0),
+                                               m_elapsed_ns(0),
+                                               m_buffer(4096)
+    {
+        for (auto &top : m_top)
+        {
+            top.reserve(count);
+        }
+        m_order.reserve(m_table.Capacity());
+    }
+
+    TopProcesses::~TopProcesses()
+    {
+        if (m_proc != nullptr)
+        {
+            closedir(m_proc);
+        }
+    }
+
+    ssize_t TopProcesses::readFile(uint32_t pid, const char *name)
+    {
+        // Thousands of processes cannot all be kept open: every walk opens and closes their files
+        char path[48];
+        snprintf(path, sizeof(path), "/proc/%u/%s", pid, name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        ++ThreadWork().files_opened;
+
+        // Both files are far shorter than the buffer: procfs returns them at once
+        ssize_t size;
+        do
+        {
+            size = pread(fd, m_buffer.data(), m_buffer.size() - 1, 0);
+        } while (size < 0 && errno == EINTR);
+        close(fd);
+        if (size < 0)
+        {
+            return -1;
+        }
+        m_buffer[size] = '\0';
+        ThreadWork().bytes_read += size;
+        return size;
+    }
+
+    bool TopProcesses::readProcess(uint32_t pid)
+    {
+        static const uint64_t page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+        ssize_t size = readFile(pid, "stat");
+        proc_parser::PidStat stat;
+        if (size < 0 || !proc_parser::ParsePidStat(m_buffer.data(), size, stat))
+        {
+            return false;
+        }
+
+        // A pid which was reused since the previous walk has another start time: it is a new entry,
+        // and the entry of the process which had it is evicted as unseen
+        ProcessState &state = m_table.Insert(pid, stat.starttime);
+        bool known = state.generation != 0;
+        uint64_t cpu = stat.utime + stat.stime;
+        state.cpu_delta = known ? Delta(state.cpu, cpu) : 0;
+        state.cpu = cpu;
+        state.rss = stat.rss * page_kb;
+        // exec(2) renames a process without changing its start time
+        proc_parser::ParsePidComm(m_buffer.data(), size, state.comm, sizeof(state.comm));
+        state.generation = m_generation;
+
+        // The io of processes of other users cannot be read without privileges: they rank by cpu and RSS only
+        size = readFile(pid, "io");
+        if (size < 0)
+        {
+            state.io_delta = {0, 0};
+            return true;
+        }
+        auto io = proc_parser::ParsePidIo(m_buffer.data(), size);
+        state.io_delta.first = known ? Delta(state.io.first, io.rchar) : 0;
+        state.io_delta.second = known ? Delta(state.io.second, io.wchar) : 0;
+        state.io = {io.rchar, io.wchar};
+        return true;
+    }
+
+    void TopProcesses::Update()
+    {
+        if (m_proc == nullptr)
+        {
+            return;
+        }
+        uint64_t now = MonotonicNs();
+        m_elapsed_ns = m_last_ns != 0 ? now - m_last_ns : 0;
+        m_last_ns = now;
+        ++m_generation;
+
+        // The directory stays open: rewinding it lists the processes of now without allocating a DIR
+        rewinddir(m_proc);
+        while (auto entry = readdir(m_proc))
+        {
+            uint32_t pid = PidName(entry->d_name);
+            if (pid != 0)
+                readProcess(pid);
+        }
+        m_table.Evict(m_generation);
+
+        // Pointers into the table stay valid until the next walk inserts
+        m_order.clear();
+        m_table.ForEach([this](const ProcessState &state) { m_order.push_back(&state); });
+        for (size_t metric = 0; metric < TOP_METRICS; metric++)
+        {
+            rank(static_cast<TopMetric>(metric));
+        }
+    }
+
+    void TopProcesses::rank(TopMetric metric)
+    {
+        // Ties go to the lowest pid, so that a ranking of idle processes does not flicker
+        auto higher = [metric](const ProcessState *a, const ProcessState *b)
+        {
+            uint64_t x = RankedValue(*a, metric);
+            uint64_t y = RankedValue(*b, metric);
+            return x != y ? x > y : a->pid < b->pid;
+        };
+
+        // Selection puts the top N first in linear time, only they are sorted
+        size_t count = std::min(m_count, m_order.size());
+        if (count < m_order.size())
+            std::nth_element(m_order.begin(), m_order.begin() + count, m_order.end(), higher);
+        std::sort(m_order.begin(), m_order.begin() + count, higher);
+
+        static const double ticks_per_second = sysconf(_SC_CLK_TCK);
+        auto &top = m_top[metric];
+        top.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const ProcessState &state = *m_order[i];
+            auto &process = top[i];
+            process.pid = state.pid;
+            std::copy(std::begin(state.comm), std::end(state.comm), process.comm);
+            process.rss = state.rss;
+            process.cpu = 0;
+            process.io = {0, 0};
+            if (m_elapsed_ns != 0)
+            {
+                double seconds = m_elapsed_ns / 1e9;
+                process.cpu = 100 * state.cpu_delta / ticks_per_second / seconds;
+                process.io.first = static_cast<uint64_t>(state.io_delta.first / seconds / 1024);
+                process.io.second = static_cast<uint64_t>(state.io_delta.second / seconds / 1024);
+            }
+        }
+    }
+}
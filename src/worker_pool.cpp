@@ -0,0 +1,200 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Indexes a worker takes off its own range at once: small enough to balance the load,
+    // large enough that the shared counter is not touched per index
+    const uint64_t kGrain = 16;
+
+    uint64_t Pack(uint64_t begin, uint64_t end)
+    {
+        return begin << 32 | end;
+    }
+
+    uint64_t Begin(uint64_t bounds)
+    {
+        return bounds >> 32;
+    }
+
+    uint64_t End(uint64_t bounds)
+    {
+        return bounds & 0xffffffff;
+    }
+
+    // Adds what the calling thread has done since <start> to <to>
+    void AddWork(system_metrics::WorkCounters &to, const system_metrics::WorkCounters &start)
+    {
+        const auto &now = system_metrics::ThreadWork();
+        to.files_opened += now.files_opened - start.files_opened;
+        to.bytes_read += now.bytes_read - start.bytes_read;
+        to.processes_spawned += now.processes_spawned - start.processes_spawned;
+    }
+}
+
+namespace system_metrics
+{
+    WorkerPool::WorkerPool(size_t workers) : m_ranges(std::max<size_t>(workers, 1)),
+                                             m_generation(0),
+                                             m_pending(0),
+                                             m_stop(false),
+                                             m_task(nullptr),
+                                             m_context(nullptr)
+    {
+        m_threads.reserve(m_ranges.size() - 1);
+        for (size_t worker = 1; worker < m_ranges.size(); worker++)
+        {
+            m_threads.emplace_back(&WorkerPool::loop, this, worker);
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::run(size_t count, Task task, void *context)
+    {
+        // Not worth waking anyone
+        if (m_threads.empty() || count <= kGrain)
+        {
+            if (count != 0)
+                task(context, 0, 0, count);
+            return;
+        }
+
+        size_t workers = m_ranges.size();
+        for (size_t worker = 0; worker < workers; worker++)
+        {
+            m_ranges[worker].bounds.store(Pack(count * worker / workers, count * (worker + 1) / workers),
+                                          std::memory_order_relaxed);
+            m_ranges[worker].work = WorkCounters();
+            m_ranges[worker].cpu_ns = 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = task;
+            m_context = context;
+            m_pending = m_threads.size();
+            ++m_generation;
+        }
+        m_wake.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending == 0; });
+
+        // Collector costs are measured on the calling thread
+        auto &work = ThreadWork();
+        for (size_t worker = 1; worker < workers; worker++)
+        {
+            const auto &done = m_ranges[worker].work;
+            work.files_opened += done.files_opened;
+            work.bytes_read += done.bytes_read;
+            work.processes_spawned += done.processes_spawned;
+            ThreadWorkerCpuNs() += m_ranges[worker].cpu_ns;
+        }
+    }
+
+    bool WorkerPool::take(size_t worker, uint64_t &begin, uint64_t &end)
+    {
+        auto &bounds = m_ranges[worker].bounds;
+        uint64_t current = bounds.load(std::memory_order_acquire);
+        while (true)
+        {
+            begin = Begin(current);
+            end = End(current);
+            if (begin >= end)
+                return false;
+            uint64_t next = std::min(begin + kGrain, end);
+            if (bounds.compare_exchange_weak(current, Pack(next, end), std::memory_order_acq_rel))
+            {
+                end = next;
+                return true;
+            }
+        }
+    }
+
+    bool WorkerPool::steal(size_t worker)
+    {
+        size_t workers = m_ranges.size();
+        while (true)
+        {
+            // The largest range is the one most likely to still have work by the time it is split
+            size_t victim = workers;
+            uint64_t current = 0;
+            uint64_t largest = 0;
+            for (size_t i = 1; i < workers; i++)
+            {
+                size_t other = (worker + i) % workers;
+                uint64_t bounds = m_ranges[other].bounds.load(std::memory_order_acquire);
+                uint64_t size = End(bounds) > Begin(bounds) ? End(bounds) - Begin(bounds) : 0;
+                if (size > largest)
+                {
+                    victim = other;
+                    current = bounds;
+                    largest = size;
+                }
+            }
+            if (victim == workers)
+                return false;
+
+            // A failed exchange means the victim or another thief got there first: look again
+            uint64_t split = End(current) - (largest + 1) / 2;
+            if (m_ranges[victim].bounds.compare_exchange_strong(current, Pack(Begin(current), split),
+                                                                std::memory_order_acq_rel))
+            {
+                // The own range is empty: no other thief can change it in between
+                m_ranges[worker].bounds.store(Pack(split, End(current)), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    void WorkerPool::work(size_t worker)
+    {
+        do
+        {
+            uint64_t begin, end;
+            while (take(worker, begin, end))
+            {
+                m_task(m_context, worker, begin, end);
+            }
+        } while (steal(worker));
+    }
+
+    void WorkerPool::loop(size_t worker)
+    {
+        uint64_t generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+                if (m_stop)
+                    return;
+                generation = m_generation;
+            }
+
+            WorkCounters start = ThreadWork();
+            uint64_t cpu_ns = ThreadCpuNs();
+            work(worker);
+            m_ranges[worker].cpu_ns = ThreadCpuNs() - cpu_ns;
+            AddWork(m_ranges[worker].work, start);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0)
+                m_done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "history.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // Pushes <values> one by one, checking the aggregates against the window recomputed from scratch
+    void CheckWindows(size_t capacity, size_t window, const std::vector<double> &values)
+    {
+        system_metrics::MetricSeries series(capacity, window);
+        for (size_t n = 0; n < values.size(); n++)
+        {
+            series.Push(1000000000ull * (n + 1), values[n]);
+
+            size_t count = std::min(n + 1, std::min(window, capacity));
+            auto first = values.begin() + (n + 1 - count);
+            auto last = values.begin() + (n + 1);
+            double sum = 0;
+            for (auto it = first; it != last; ++it)
+            {
+                sum += *it;
+            }
+
+            auto aggregates = series.Aggregates();
+            BOOST_REQUIRE_EQUAL(aggregates.count, count);
+            BOOST_REQUIRE_EQUAL(aggregates.min, *std::min_element(first, last));
+            BOOST_REQUIRE_EQUAL(aggregates.max, *std::max_element(first, last));
+            BOOST_REQUIRE_CLOSE(aggregates.mean, sum / count, 1e-9);
+            // One second between samples
+            double rate = count > 1 ? (values[n] - *first) / (count - 1) : 0;
+            BOOST_REQUIRE_CLOSE(aggregates.rate, rate, 1e-9);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(history)
+
+BOOST_AUTO_TEST_CASE(window_random)
+{
+    std::mt19937 random(3);
+    std::vector<double> values(5000);
+    for (auto &value : values)
+    {
+        value = static_cast<double>(random() % 1000);
+    }
+    CheckWindows(64, 10, values);
+    CheckWindows(64, 64, values);
+    CheckWindows(8, 1, values);
+}
+
+BOOST_AUTO_TEST_CASE(window_monotonic)
+{
+    // Rising values keep every one in the min queue, falling ones in the max queue
+    std::vector<double> rising(500);
+    std::vector<double> falling(500);
+    for (size_t i = 0; i < rising.size(); i++)
+    {
+        rising[i] = static_cast<double>(i);
+        falling[i] = static_cast<double>(rising.size() - i);
+    }
+    CheckWindows(32, 16, rising);
+    CheckWindows(32, 16, falling);
+}
+
+BOOST_AUTO_TEST_CASE(window_ties)
+{
+    std::vector<double> values(300);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = static_cast<double>(i / 7 % 3);
+    }
+    CheckWindows(16, 12, values);
+}
+
+BOOST_AUTO_TEST_CASE(targets)
+{
+    using system_metrics::HISTORY_CPU;
+    system_metrics::MetricHistory history(16, 4);
+    system_metrics::Metrics metrics;
+    metrics.targets.resize(2);
+    metrics.targets[0].pid = 10;
+    metrics.targets[0].cpu = 5;
+    metrics.targets[1].cgroup = "/a";
+    metrics.targets[1].cpu = 7;
+    history.Record(1000000000ull, metrics);
+
+    auto process = history.Target(10, HISTORY_CPU);
+    BOOST_REQUIRE(process);
+    BOOST_REQUIRE(history.Target(0, HISTORY_CPU, "/a"));
+    BOOST_REQUIRE(!history.Target(11, HISTORY_CPU));
+
+    // The remaining target keeps its series when it changes place, the removed one loses it
+    metrics.targets.erase(metrics.targets.begin());
+    history.Record(2000000000ull, metrics);
+    BOOST_REQUIRE(!history.Target(10, HISTORY_CPU));
+    auto cgroup = history.Target(0, HISTORY_CPU, "/a");
+    BOOST_REQUIRE(cgroup);
+    BOOST_REQUIRE_EQUAL(cgroup->Aggregates().count, 2u);
+
+    // A series handed out before the removal stays readable
+    BOOST_REQUIRE_EQUAL(process->Aggregates().count, 1u);
+    BOOST_REQUIRE_EQUAL(process->Aggregates().max, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
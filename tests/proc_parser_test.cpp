@@ -0,0 +1,78 @@
+#include "proc_parser.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+namespace
+{
+    using namespace system_metrics::proc_parser;
+
+    // Returns a /proc/[pid]/stat line of the process <comm> with distinct values in every field the parser reads
+    std::string StatLine(const std::string &comm)
+    {
+        return "1234 (" + comm + ") S 77 1234 1234 0 -1 4194560 3000 0 12 0 "
+                                 "150 25 7 3 20 0 4 0 98765 104857600 2560 18446744073709551615 "
+                                 "1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0\n";
+    }
+
+    void CheckStat(const std::string &comm)
+    {
+        std::string line = StatLine(comm);
+        PidStat stat;
+        BOOST_REQUIRE(ParsePidStat(line.data(), line.size(), stat));
+        BOOST_CHECK_EQUAL(stat.state, 'S');
+        BOOST_CHECK_EQUAL(stat.ppid, 77u);
+        BOOST_CHECK_EQUAL(stat.utime, 150u);
+        BOOST_CHECK_EQUAL(stat.stime, 25u);
+        BOOST_CHECK_EQUAL(stat.cutime, 7u);
+        BOOST_CHECK_EQUAL(stat.cstime, 3u);
+        BOOST_CHECK_EQUAL(stat.num_threads, 4u);
+        BOOST_CHECK_EQUAL(stat.starttime, 98765u);
+        BOOST_CHECK_EQUAL(stat.vsize, 104857600u);
+        BOOST_CHECK_EQUAL(stat.rss, 2560u);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(proc_parser)
+
+BOOST_AUTO_TEST_CASE(pid_stat_comm)
+{
+    CheckStat("bash");
+    CheckStat("Web Content");
+    // A process may name itself anything, fields are only found from the last ')'
+    CheckStat("a) R 1 2 3 (b");
+    CheckStat(") ) )");
+    CheckStat("");
+}
+
+BOOST_AUTO_TEST_CASE(pid_stat_malformed)
+{
+    PidStat stat;
+    std::string line = "1234 (bash S 77 1234";
+    BOOST_CHECK(!ParsePidStat(line.data(), line.size(), stat));
+    BOOST_CHECK(!ParsePidStat("", 0, stat));
+}
+
+BOOST_AUTO_TEST_CASE(pid_comm)
+{
+    char comm[16];
+    std::string line = "1234 (a b) c)\n";
+    BOOST_REQUIRE(ParsePidComm(line.data(), line.size(), comm, sizeof(comm)));
+    BOOST_CHECK_EQUAL(std::string(comm), "a b) c");
+
+    // The comm ends at the last ')' of the line, wherever its other fields are
+    line = StatLine("x (y) z");
+    BOOST_REQUIRE(ParsePidComm(line.data(), line.size(), comm, sizeof(comm)));
+    BOOST_CHECK_EQUAL(std::string(comm), "x (y) z");
+
+    // Truncated to the capacity, always terminated
+    line = "1 (0123456789abcdefghij)";
+    BOOST_REQUIRE(ParsePidComm(line.data(), line.size(), comm, 8));
+    BOOST_CHECK_EQUAL(std::string(comm), "0123456");
+
+    line = "1 bash";
+    BOOST_CHECK(!ParsePidComm(line.data(), line.size(), comm, sizeof(comm)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,97 @@
+#include "process_table.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <random>
+#include <utility>
+
+BOOST_AUTO_TEST_SUITE(process_table)
+
+BOOST_AUTO_TEST_CASE(insert_and_find)
+{
+    system_metrics::ProcessTable table(16);
+    auto &state = table.Insert(100, 5);
+    BOOST_CHECK_EQUAL(state.generation, 0u);
+    state.generation = 1;
+    state.cpu = 42;
+
+    // The same pid with another start time is another process
+    BOOST_CHECK_EQUAL(table.Insert(100, 5).cpu, 42u);
+    BOOST_CHECK_EQUAL(table.Insert(100, 6).cpu, 0u);
+    BOOST_CHECK_EQUAL(table.Size(), 2u);
+    BOOST_REQUIRE(table.Find(100, 5) != nullptr);
+    BOOST_CHECK(table.Find(101, 5) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(grows_when_half_full)
+{
+    system_metrics::ProcessTable table(16);
+    for (uint32_t pid = 1; pid <= 100; pid++)
+    {
+        table.Insert(pid, pid).cpu = pid;
+    }
+    BOOST_CHECK_EQUAL(table.Size(), 100u);
+    BOOST_CHECK_GE(table.Capacity(), 200u);
+    for (uint32_t pid = 1; pid <= 100; pid++)
+    {
+        BOOST_REQUIRE(table.Find(pid, pid) != nullptr);
+        BOOST_CHECK_EQUAL(table.Find(pid, pid)->cpu, pid);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(evict_against_reference)
+{
+    // Four processes a walk, eight at most before the eviction, never grow a table of 16 slots: clusters
+    // often run past the last slot and wrap to the first ones, where Evict() has already been. Every walk
+    // keeps about half of the processes and replaces the others, some by the same pid with another start time
+    system_metrics::ProcessTable table(16);
+    std::map<std::pair<uint32_t, uint64_t>, uint64_t> reference;
+    std::mt19937 random(7);
+    for (uint64_t generation = 1; generation <= 20000; generation++)
+    {
+        std::map<std::pair<uint32_t, uint64_t>, uint64_t> next;
+        for (const auto &entry : reference)
+        {
+            if (random() % 2 == 0)
+                next.insert(entry);
+        }
+        while (next.size() < 4)
+        {
+            next.emplace(std::make_pair(1 + random() % 64, random() % 4), 0);
+        }
+        for (auto &entry : next)
+        {
+            table.Insert(entry.first.first, entry.first.second).generation = generation;
+            entry.second = generation;
+        }
+
+        size_t evicted = table.Evict(generation);
+        size_t expected = reference.size();
+        for (const auto &entry : reference)
+        {
+            if (next.count(entry.first) != 0)
+                --expected;
+        }
+        BOOST_REQUIRE_EQUAL(evicted, expected);
+        BOOST_REQUIRE_EQUAL(table.Size(), next.size());
+        for (const auto &entry : reference)
+        {
+            if (next.count(entry.first) == 0)
+                BOOST_REQUIRE(table.Find(entry.first.first, entry.first.second) == nullptr);
+        }
+        for (const auto &entry : next)
+        {
+            auto state = table.Find(entry.first.first, entry.first.second);
+            BOOST_REQUIRE(state != nullptr);
+            BOOST_REQUIRE_EQUAL(state->generation, generation);
+        }
+        size_t visited = 0;
+        table.ForEach([&visited](const system_metrics::ProcessState &) { ++visited; });
+        BOOST_REQUIRE_EQUAL(visited, next.size());
+        reference.swap(next);
+    }
+    BOOST_CHECK_EQUAL(table.Capacity(), 16u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,272 @@
+#include "recording.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    using namespace system_metrics;
+
+    // Returns a path in /tmp no other process uses
+    std::string TempPath(const char *name)
+    {
+        return "/tmp/rb_metrics_test." + std::to_string(getpid()) + "." + name;
+    }
+
+    // Returns the size of the file at <path>
+    off_t FileSize(const std::string &path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+    }
+
+    // Returns <count> snapshots whose counters grow and whose cores, namespaces, disks and targets come and go
+    std::vector<Snapshot> Snapshots(size_t count)
+    {
+        std::mt19937_64 random(1);
+        std::vector<Snapshot> result;
+        Snapshot snapshot;
+        for (size_t i = 0; i < count; i++)
+        {
+            snapshot.timestamp_ns += 10000000 + random() % 1000;
+            snapshot.cpu_busy += random() % 100;
+            snapshot.cpu_total += 100;
+            snapshot.ram_total = 16 << 20;
+            snapshot.ram_occupied = random() % (16 << 20);
+            snapshot.net.first += random() % 100000;
+            snapshot.io.second += random() % 1000;
+
+            // The aggregate row and up to 4 cores, which go offline now and then
+            snapshot.cpus.Resize(2 + random() % 4);
+            for (size_t row = 0; row < snapshot.cpus.Rows(); row++)
+            {
+                if (row > 0 && random() % 8 == 0)
+                    snapshot.cpus.SetId(row, static_cast<int>(row - 1 + random() % 2));
+                for (int state = 0; state < CPU_STATES; state++)
+                {
+                    snapshot.cpus.At(row, static_cast<CpuState>(state)) += random() % 100;
+                }
+            }
+
+            snapshot.namespaces.resize(random() % 3);
+            for (auto &ns : snapshot.namespaces)
+            {
+                if (random() % 8 == 0)
+                    ns.inode = 4026531840 + random() % 16;
+                ns.own = ns.inode % 2 == 0;
+                ns.net.first += random() % 10000;
+                ns.net.second += random() % 10000;
+            }
+
+            snapshot.disks.resize(1 + random() % 2);
+            for (auto &disk : snapshot.disks)
+            {
+                if (random() % 16 == 0 || disk.name.empty())
+                {
+                    disk.name = std::string("sd") + static_cast<char>('a' + random() % 3);
+                    disk.counters.major = 8;
+                    disk.counters.minor = (disk.name.back() - 'a') * 16;
+                }
+                disk.counters.reads += random() % 50;
+                disk.counters.sectors_written += random() % 5000;
+                disk.counters.in_flight = random() % 4;
+                disk.counters.queue_ms += random() % 20;
+            }
+
+            snapshot.targets.resize(1 + random() % 3);
+            for (auto &target : snapshot.targets)
+            {
+                if (random() % 10 == 0)
+                    target = TargetSnapshot();
+                if (target.pid == 0 && target.cgroup.empty())
+                {
+                    if (random() % 2 == 0)
+                        target.pid = 1 + random() % 32768;
+                    else
+                        target.cgroup = "/sys/fs/cgroup/test" + std::to_string(random() % 4);
+                }
+                target.counters.cpu += random() % 200;
+                target.counters.ram = random() % 100000;
+                target.counters.net.second += random() % 5000;
+                target.counters.io.first += random() % 500;
+                target.counters.memory.rss = target.counters.ram;
+                target.counters.memory.pss = random() % 100000;
+                target.counters.memory.uss = random() % 100000;
+                target.counters.memory.swap = random() % 10;
+                target.forks += random() % 2;
+                target.namespaces.resize(random() % 2);
+                for (auto &ns : target.namespaces)
+                {
+                    ns.inode = 4026532000;
+                    ns.net.first += random() % 1000;
+                }
+            }
+            result.push_back(snapshot);
+        }
+        return result;
+    }
+
+    void CheckNamespaces(const std::vector<NetNamespaceSnapshot> &actual, const std::vector<NetNamespaceSnapshot> &expected)
+    {
+        BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+        for (size_t i = 0; i < actual.size(); i++)
+        {
+            BOOST_CHECK_EQUAL(actual[i].inode, expected[i].inode);
+            BOOST_CHECK_EQUAL(actual[i].own, expected[i].own);
+            BOOST_CHECK(actual[i].net == expected[i].net);
+        }
+    }
+
+    // Checks every field a recording keeps
+    void CheckSnapshot(const Snapshot &actual, const Snapshot &expected)
+    {
+        BOOST_CHECK_EQUAL(actual.timestamp_ns, expected.timestamp_ns);
+        BOOST_CHECK_EQUAL(actual.cpu_busy, expected.cpu_busy);
+        BOOST_CHECK_EQUAL(actual.cpu_total, expected.cpu_total);
+        BOOST_CHECK_EQUAL(actual.ram_total, expected.ram_total);
+        BOOST_CHECK_EQUAL(actual.ram_occupied, expected.ram_occupied);
+        BOOST_CHECK(actual.net == expected.net);
+        BOOST_CHECK(actual.io == expected.io);
+
+        BOOST_REQUIRE_EQUAL(actual.cpus.Rows(), expected.cpus.Rows());
+        for (size_t row = 0; row < actual.cpus.Rows(); row++)
+        {
+            BOOST_CHECK_EQUAL(actual.cpus.Id(row), expected.cpus.Id(row));
+            for (int state = 0; state < CPU_STATES; state++)
+            {
+                auto cpu_state = static_cast<CpuState>(state);
+                BOOST_CHECK_EQUAL(actual.cpus.At(row, cpu_state), expected.cpus.At(row, cpu_state));
+            }
+        }
+        CheckNamespaces(actual.namespaces, expected.namespaces);
+
+        BOOST_REQUIRE_EQUAL(actual.disks.size(), expected.disks.size());
+        for (size_t i = 0; i < actual.disks.size(); i++)
+        {
+            const auto &a = actual.disks[i];
+            const auto &e = expected.disks[i];
+            BOOST_CHECK_EQUAL(a.name, e.name);
+            BOOST_CHECK_EQUAL(a.counters.major, e.counters.major);
+            BOOST_CHECK_EQUAL(a.counters.minor, e.counters.minor);
+            BOOST_CHECK_EQUAL(a.counters.reads, e.counters.reads);
+            BOOST_CHECK_EQUAL(a.counters.sectors_written, e.counters.sectors_written);
+            BOOST_CHECK_EQUAL(a.counters.in_flight, e.counters.in_flight);
+            BOOST_CHECK_EQUAL(a.counters.queue_ms, e.counters.queue_ms);
+        }
+
+        BOOST_REQUIRE_EQUAL(actual.targets.size(), expected.targets.size());
+        for (size_t i = 0; i < actual.targets.size(); i++)
+        {
+            const auto &a = actual.targets[i];
+            const auto &e = expected.targets[i];
+            BOOST_CHECK_EQUAL(a.pid, e.pid);
+            BOOST_CHECK_EQUAL(a.cgroup, e.cgroup);
+            BOOST_CHECK_EQUAL(a.counters.cpu, e.counters.cpu);
+            BOOST_CHECK_EQUAL(a.counters.ram, e.counters.ram);
+            BOOST_CHECK(a.counters.net == e.counters.net);
+            BOOST_CHECK(a.counters.io == e.counters.io);
+            BOOST_CHECK_EQUAL(a.counters.memory.rss, e.counters.memory.rss);
+            BOOST_CHECK_EQUAL(a.counters.memory.pss, e.counters.memory.pss);
+            BOOST_CHECK_EQUAL(a.counters.memory.uss, e.counters.memory.uss);
+            BOOST_CHECK_EQUAL(a.counters.memory.swap, e.counters.memory.swap);
+            BOOST_CHECK_EQUAL(a.forks, e.forks);
+            BOOST_CHECK_EQUAL(a.exits, e.exits);
+            CheckNamespaces(a.namespaces, e.namespaces);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(recording)
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    const std::string path = TempPath("round_trip.rec");
+    auto snapshots = Snapshots(100);
+    {
+        RecordingWriter writer(path, 16);
+        BOOST_REQUIRE(writer.IsOpen());
+        for (const auto &snapshot : snapshots)
+        {
+            BOOST_REQUIRE(writer.Append(snapshot));
+        }
+    }
+
+    RecordingReader reader(path);
+    BOOST_REQUIRE(reader.IsOpen());
+    BOOST_CHECK_EQUAL(reader.Chunks(), 7u);
+    BOOST_CHECK_EQUAL(reader.FirstTimestamp(), snapshots.front().timestamp_ns);
+    BOOST_CHECK_EQUAL(reader.LastTimestamp(), snapshots.back().timestamp_ns);
+
+    size_t next = 0;
+    size_t replayed = reader.Replay(0, UINT64_MAX, [&](const Snapshot &snapshot)
+                                    {
+                                        BOOST_REQUIRE_LT(next, snapshots.size());
+                                        CheckSnapshot(snapshot, snapshots[next++]);
+                                    });
+    BOOST_CHECK_EQUAL(replayed, snapshots.size());
+
+    // A range within a chunk decodes that chunk from its keyframe
+    next = 40;
+    replayed = reader.Replay(snapshots[40].timestamp_ns, snapshots[44].timestamp_ns,
+                             [&](const Snapshot &snapshot) { CheckSnapshot(snapshot, snapshots[next++]); });
+    BOOST_CHECK_EQUAL(replayed, 5u);
+    unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(chunk_duration)
+{
+    // Snapshots 10ms apart: a chunk is written once it spans 50ms, long before the record count is reached
+    const std::string path = TempPath("duration.rec");
+    auto snapshots = Snapshots(100);
+    {
+        RecordingWriter writer(path, 1000, std::chrono::milliseconds(50));
+        for (const auto &snapshot : snapshots)
+        {
+            BOOST_REQUIRE(writer.Append(snapshot));
+        }
+    }
+
+    RecordingReader reader(path);
+    BOOST_REQUIRE(reader.IsOpen());
+    BOOST_CHECK_EQUAL(reader.Chunks(), 17u);
+    size_t next = 0;
+    size_t replayed = reader.Replay(0, UINT64_MAX, [&](const Snapshot &snapshot)
+                                    { CheckSnapshot(snapshot, snapshots[next++]); });
+    BOOST_CHECK_EQUAL(replayed, snapshots.size());
+    unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_last_chunk)
+{
+    // A recorder killed while writing its last chunk leaves it cut short, with no index
+    const std::string path = TempPath("truncated.rec");
+    auto snapshots = Snapshots(35);
+    off_t complete = 0;
+    {
+        RecordingWriter writer(path, 10);
+        for (size_t i = 0; i < snapshots.size(); i++)
+        {
+            writer.Append(snapshots[i]);
+            if (i == 29)
+                complete = FileSize(path);
+        }
+    }
+    BOOST_REQUIRE_GT(complete, 0);
+    BOOST_REQUIRE_EQUAL(truncate(path.c_str(), complete + 20), 0);
+
+    RecordingReader reader(path);
+    BOOST_REQUIRE(reader.IsOpen());
+    BOOST_CHECK_EQUAL(reader.Chunks(), 3u);
+    size_t next = 0;
+    size_t replayed = reader.Replay(0, UINT64_MAX, [&](const Snapshot &snapshot)
+                                    { CheckSnapshot(snapshot, snapshots[next++]); });
+    BOOST_CHECK_EQUAL(replayed, 30u);
+    unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()